@@ -0,0 +1,111 @@
+#ifndef __HINATA_CORE_ALIGNED_ALLOCATOR_H__
+#define __HINATA_CORE_ALIGNED_ALLOCATOR_H__
+
+#include "common.h"
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+#ifdef HINATA_COMPILER_MSVC
+	#include <malloc.h>
+#endif
+
+HINATA_NAMESPACE_BEGIN
+
+/*!
+	Allocate aligned memory.
+	The default heap only guarantees 8-byte alignment on Win32,
+	which is not enough for the types aligned with HINATA_ALIGN.
+	\param size Size in bytes.
+	\param alignment Alignment in bytes (power of two).
+	\return Allocated memory, or nullptr if failed.
+*/
+inline void* AlignedMalloc(size_t size, size_t alignment)
+{
+#ifdef HINATA_COMPILER_MSVC
+	return _aligned_malloc(size, alignment);
+#else
+	void* p;
+	return posix_memalign(&p, alignment < sizeof(void*) ? sizeof(void*) : alignment, size) == 0 ? p : nullptr;
+#endif
+}
+
+inline void AlignedFree(void* p)
+{
+#ifdef HINATA_COMPILER_MSVC
+	_aligned_free(p);
+#else
+	free(p);
+#endif
+}
+
+/*!
+	Aligned allocator.
+	STL allocator which allocates the elements with the given alignment,
+	e.g., std::vector<T, AlignedAllocator<T, 16>> for the elements loaded with SSE.
+	\tparam T Element type.
+	\tparam Alignment Alignment in bytes (power of two).
+*/
+template <typename T, size_t Alignment>
+class AlignedAllocator
+{
+public:
+
+	typedef T value_type;
+	typedef T* pointer;
+	typedef const T* const_pointer;
+	typedef T& reference;
+	typedef const T& const_reference;
+	typedef size_t size_type;
+	typedef ptrdiff_t difference_type;
+
+	template <typename U>
+	struct rebind { typedef AlignedAllocator<U, Alignment> other; };
+
+public:
+
+	AlignedAllocator() {}
+	template <typename U> AlignedAllocator(const AlignedAllocator<U, Alignment>&) {}
+
+public:
+
+	pointer address(reference v) const { return &v; }
+	const_pointer address(const_reference v) const { return &v; }
+	size_type max_size() const { return (size_type)-1 / sizeof(T); }
+
+	pointer allocate(size_type n, const void* = nullptr)
+	{
+		if (n == 0)
+		{
+			return nullptr;
+		}
+
+		if (n > max_size())
+		{
+			throw std::bad_alloc();
+		}
+
+		void* p = AlignedMalloc(n * sizeof(T), Alignment);
+		if (p == nullptr)
+		{
+			throw std::bad_alloc();
+		}
+
+		return static_cast<pointer>(p);
+	}
+
+	void deallocate(pointer p, size_type)
+	{
+		AlignedFree(p);
+	}
+
+	void construct(pointer p, const T& v) { new (p) T(v); }
+	void destroy(pointer p) { p->~T(); }
+
+	bool operator==(const AlignedAllocator&) const { return true; }
+	bool operator!=(const AlignedAllocator&) const { return false; }
+
+};
+
+HINATA_NAMESPACE_END
+
+#endif // __HINATA_CORE_ALIGNED_ALLOCATOR_H__
\ No newline at end of file
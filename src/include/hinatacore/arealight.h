@@ -3,12 +3,11 @@
 
 #include "common.h"
 #include "math.h"
+#include "distribution.h"
 #include <memory>
 
 HINATA_NAMESPACE_BEGIN
 
-class Primitive;
-
 /*!
 	Area light.
 	Diffuse area light emitter.
@@ -49,19 +48,23 @@ private:
 public:
 
 	/*!
-		Add a primitive to the light.
-		Multiple primitives can be added to a light.
+		Add a triangle to the light.
+		Multiple triangles can be added to a light.
+		The light keeps its own copy of the positions in world space,
+		so that it does not depend on the representation of the geometry.
 		After the registration, Initialize function must be called.
-		\param primitive Primitive to be added.
+		\param p1 First vertex in world space.
+		\param p2 Second vertex in world space.
+		\param p3 Third vertex in world space.
 		\sa Initialize
 	*/
-	void AddPrimitive(const std::shared_ptr<Primitive>& primitive);
+	void AddTriangle(const Vec3d& p1, const Vec3d& p2, const Vec3d& p3);
 
 	/*!
 		Initialize the light.
-		The function must be called after registration of primitives
-		by AddPrimitive function.
-		\sa AddPrimitive
+		The function must be called after registration of triangles
+		by AddTriangle function.
+		\sa AddTriangle
 	*/
 	void Initialize();
 
@@ -91,6 +94,17 @@ public:
 	*/
 	void SamplePosition(SampleRecord& sampleRecord);
 
+	/*!
+		Sample a position on a triangle of the light.
+		Input
+		- positionSample
+		Output
+		- p, n, pdf (conditioned on the triangle)
+		\param triangle Index of the triangle.
+		\param sampleRecord Query record.
+	*/
+	void SamplePosition(int triangle, SampleRecord& sampleRecord);
+
 	/*!
 		Evaluate cosine weighted contribution.
 		Evaluate L_e(x_0\to x_1) \cos{(\theta_0)} / p_A(x_0)
@@ -121,6 +135,14 @@ public:
 	*/
 	double PdfPosition() { return 1.0 / area; }
 
+	/*!
+		Evaluate PDF of positional component on a triangle.
+		Evaluate p_A(x_n) conditioned on the triangle.
+		\param triangle Index of the triangle.
+		\return Evaluated value.
+	*/
+	double PdfPosition(int triangle) { return 1.0 / triangleAreas[triangle]; }
+
 	/*!
 		Evaluate PDF of directional component.
 		Evaluate p_\sigma(y_0\to y_1).
@@ -130,13 +152,31 @@ public:
 	*/
 	double PdfDirection(const Vec3d& d, const Vec3d& n);
 
+	/*!
+		Index of the light in the scene.
+		Assigned by the scene.
+	*/
+	int Index() const { return index; }
+	void SetIndex(int index) { this->index = index; }
+
+	const Vec3d& Radiance() const { return L; }
+	int NumTriangles() const { return (int)positions.size() / 3; }
+	const Vec3d& Position(int triangle, int vertex) const { return positions[3*triangle+vertex]; }
+
+private:
+
+	void SampleTriangle(const Vec2d& positionSample, Vec3d& p, Vec3d& n);
+	void SampleTriangle(int triangle, const Vec2d& positionSample, Vec3d& p, Vec3d& n);
+
 private:
 
 	Vec3d L;
-	std::vector<std::shared_ptr<Primitive>> primitives;
-	std::vector<double> primitiveAreaCdf;
+	std::vector<Vec3d> positions;		// Three vertices for each triangle
+	std::vector<double> triangleAreas;
+	AliasTable triangleDistribution;	// Triangles chosen in proportion to the area
 	double area;
 	Vec3d power;
+	int index;
 
 };
 
@@ -0,0 +1,171 @@
+#ifndef __HINATA_CORE_BPT_RENDERER_H__
+#define __HINATA_CORE_BPT_RENDERER_H__
+
+#include "renderer.h"
+#include "intersection.h"
+
+HINATA_NAMESPACE_BEGIN
+
+class BPTRendererConfig : public RendererConfig
+{
+public:
+
+	BPTRendererConfig();
+	void DefineOptions(boost::program_options::options_description& opt);
+	void ParseOptions(boost::program_options::variables_map& vm);
+
+public:
+
+	// Options
+	int samplePerPixel;
+	int tileSize;
+	int rrDepth;
+	int splatBufferSize;
+
+};
+
+// --------------------------------------------------------------------------------
+
+class Ray;
+class RandomSampler;
+class SplatBuffer;
+
+/*!
+	Bidirectional path tracing renderer.
+	For each camera subpath a light subpath is sampled, and all pairs of their vertices
+	are connected. The contributions of the strategies are combined with
+	the balance heuristic [Veach 1997].
+	The image is divided into tiles as PTRenderer, but the strategies connecting to the camera (t = 1)
+	contribute to arbitrary pixels, so all contributions are accumulated through the per-thread splat buffer.
+*/
+class BPTRenderer : public Renderer
+{
+public:
+
+	enum class PathVertexType
+	{
+		Camera,
+		Light,
+		Surface
+	};
+
+	/*!
+		Vertex of a subpath.
+		The PDFs are in area measure. pdfFwd is the PDF of sampling the vertex
+		from the previous vertex of the subpath, and pdfRev is the PDF of sampling the vertex
+		from the next vertex if the path were sampled from the other side.
+		Both PDFs of the delta vertices are zero, which are skipped in MIS.
+	*/
+	struct PathVertex
+	{
+		PathVertexType type;
+		Vec3d throughput;		// Throughput of the subpath up to the vertex
+		Intersection isect;		// p and gn are valid for all types, the others for surfaces
+		Vec3d wi;				// Direction to the previous vertex (surfaces only)
+		bool delta;				// BSDF sampled a delta component at the vertex
+		double pdfFwd;
+		double pdfRev;
+	};
+
+	struct BPT_Thread_SharedData : public Thread_SharedData
+	{
+		std::vector<Vec3d> tile;					// Contributions of the camera subpaths to the tile
+		std::shared_ptr<RandomSampler> sampler;
+		std::shared_ptr<SplatBuffer> splats;		// Contributions not yet accumulated to the image
+		std::vector<PathVertex> cameraSubpath;
+		std::vector<PathVertex> lightSubpath;
+	};
+
+public:
+
+	BPTRenderer(const std::shared_ptr<BPTRendererConfig>& config);
+
+private:
+
+	void Preprocess();
+	void RenderPassFinished();
+	double ImageSaveWeight();
+	int NumRenderTasks();
+	std::shared_ptr<Thread_SharedData> Create_Thread_SharedData();
+	void InitializeThread(std::shared_ptr<Thread_InitParam>& param, std::shared_ptr<Thread_SharedData>& shared);
+	void ProcessThread_Render(std::shared_ptr<Thread_SharedData>& shared, int taskIndex);
+
+private:
+
+	int NumTilesX();
+
+	/*!
+		Render a sample.
+		Samples a camera subpath and a light subpath and evaluates all strategies.
+		The strategies with t = 1 are splatted.
+		\param shared Thread data.
+		\param rasterPos Raster position of the camera subpath.
+		\return Contribution of the strategies with t >= 2 to the pixel.
+	*/
+	Vec3d RenderSample(BPT_Thread_SharedData& shared, const Vec2d& rasterPos);
+
+	/*!
+		Extend a subpath with random walk.
+		\param ray Ray from the last vertex of the subpath.
+		\param throughput Throughput of the subpath including the sampled ray.
+		\param pdf PDF of the sampled ray (solid angle measure).
+		\param adjoint True for the light subpaths.
+		\param sampler Sampler.
+		\param subpath Subpath to be extended.
+		\return Contribution of the environment light if the camera subpath escapes from the scene.
+	*/
+	Vec3d RandomWalk(Ray& ray, Vec3d throughput, double pdf, bool adjoint, RandomSampler& sampler, std::vector<PathVertex>& subpath);
+
+	/*!
+		Evaluate a strategy.
+		Connects the first s vertices of the light subpath
+		and the first t vertices of the camera subpath.
+		\param shared Thread data.
+		\param s Number of the vertices of the light subpath.
+		\param t Number of the vertices of the camera subpath.
+		\param rasterPos Raster position of the path if t = 1.
+		\return Contribution weighted by MIS.
+	*/
+	Vec3d Connect(BPT_Thread_SharedData& shared, int s, int t, Vec2d& rasterPos);
+
+	/*!
+		MIS weight of a strategy.
+		Evaluates the balance heuristic with the ratios of the PDFs of the neighbouring strategies.
+		The reverse PDFs of the connected vertices are temporarily replaced.
+	*/
+	double MISWeight(BPT_Thread_SharedData& shared, int s, int t);
+
+	/*!
+		Evaluate the BSDF or the emission of a vertex for a connection.
+		\param v Vertex.
+		\param target Connected point.
+		\param adjoint True if v is in the light subpath.
+		\return f(wi, wo) cos(theta_o) for surfaces, L_e cos(theta_o) for lights.
+	*/
+	Vec3d EvaluateConnection(PathVertex& v, const Vec3d& target, bool adjoint);
+
+	/*!
+		PDF of sampling next from v (area measure).
+		\param v Vertex.
+		\param prev Previous vertex of v, or nullptr for the endpoints.
+		\param next Vertex to be sampled.
+	*/
+	double Pdf(PathVertex& v, const PathVertex* prev, const PathVertex& next);
+
+	/*!
+		Convert a PDF in solid angle measure around from to area measure at to.
+	*/
+	double ConvertDensity(double pdf, const PathVertex& from, const PathVertex& to);
+
+	bool Visible(const PathVertex& v1, const PathVertex& v2);
+
+private:
+
+	std::shared_ptr<BPTRendererConfig> config;
+	long long numSamplesPerPixel;		// Total number of the samples per pixel
+
+};
+
+HINATA_NAMESPACE_END
+
+#endif // __HINATA_CORE_BPT_RENDERER_H__
\ No newline at end of file
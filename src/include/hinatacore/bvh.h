@@ -0,0 +1,240 @@
+#ifndef __HINATA_CORE_BVH_H__
+#define __HINATA_CORE_BVH_H__
+
+#include "common.h"
+#include "math.h"
+#include "alignedallocator.h"
+#include "constarray.h"
+#include <vector>
+#include <boost/serialization/serialization.hpp>
+#include <boost/serialization/nvp.hpp>
+#include <boost/serialization/vector.hpp>
+#include <boost/serialization/split_member.hpp>
+#include <boost/serialization/is_bitwise_serializable.hpp>
+
+HINATA_NAMESPACE_BEGIN
+
+class Ray;
+class TaskScheduler;
+struct BVHBuildData;
+struct BVHTraversalData;
+
+/*!
+	Binary BVH node.
+	Nodes are stored in a linear array in depth-first order,
+	so the first child of an internal node is always the next node in the array
+	and only the offset to the second child is stored.
+	The binary BVH is only used for building and collapsed into QBVH.
+*/
+struct HINATA_ALIGN_32 BVHNode
+{
+
+	enum class NodeType
+	{
+		Leaf,
+		Internal
+	};
+
+	AABB bound;
+
+	union
+	{
+		int primitiveOffset;	// Leaf : Index of the first primitive in primitiveIndices
+		int secondChildOffset;	// Internal : Index of the second child in the node array
+	};
+
+	int numPrimitives;			// Leaf : Number of primitives in the node
+	NodeType type;
+	int splitAxis;				// Internal : Split axis
+
+};
+
+// std::allocator does not respect the alignment of the node
+typedef std::vector<BVHNode, AlignedAllocator<BVHNode, 32>> BVHNodeArray;
+
+/*!
+	QBVH node.
+	4-wide BVH node which stores the bounds of up to 4 children in SoA layout,
+	so that all children can be tested with one SIMD slab test.
+	Bounds are stored in single precision and conservatively rounded outwards.
+*/
+struct HINATA_ALIGN_16 QBVHNode
+{
+
+	float boundMin[3][4];		// Minimum of the child bounds : [axis][child]
+	float boundMax[3][4];		// Maximum of the child bounds : [axis][child]
+
+	int child[4];				// Internal child : Index of the child node, leaf child : Index of the first primitive, empty : -1
+	int numPrimitives[4];		// Number of primitives in the leaf child, or 0 for internal or empty children
+
+};
+
+// Nodes are loaded with aligned SSE loads in the traversal
+typedef AlignedAllocator<QBVHNode, 16> QBVHNodeAllocator;
+typedef std::vector<QBVHNode, QBVHNodeAllocator> QBVHNodeArray;
+
+/*!
+	BVH.
+	Bounding volume hierarchy over a set of bounds.
+	The hierarchy is built as a binary BVH with binned SAH and collapsed into QBVH.
+	The BVH knows nothing about the primitives, so the traversal calls
+	the given function for each primitive in the intersected leaves.
+	The primitives are identified by the position in the leaf order,
+	which can be converted to the index of the bound given for building with PrimitiveIndex.
+*/
+class BVH
+{
+public:
+
+	BVH();
+
+public:
+
+	/*!
+		Build BVH.
+		\param bounds Bounds of the primitives.
+		\param scheduler Thread pool used for building.
+	*/
+	void Build(const std::vector<AABB>& bounds, TaskScheduler& scheduler);
+
+	/*!
+		Set the build product.
+		Used to load the BVH without building, e.g., from the memory-mapped scene file.
+		The arrays can refer to external memory, which must outlive the BVH.
+		\param nodes QBVH nodes.
+		\param primitiveIndices Indices of the primitives in the leaf order.
+		\param bound Bound of the root.
+		\param numBuildNodes Number of the nodes of the binary BVH.
+		\param sahCost SAH cost of the binary BVH.
+	*/
+	void Set(ConstArray<QBVHNode, QBVHNodeAllocator>&& nodes, ConstArray<int>&& primitiveIndices, const AABB& bound, int numBuildNodes, double sahCost);
+
+	/*!
+		Check consistency.
+		Checks the indices in the nodes and the depth of the hierarchy,
+		so that the traversal of the BVH loaded from a file never accesses out of the arrays.
+		\param numBounds Number of the bounds given for building.
+		\retval true The BVH is consistent.
+		\retval false The BVH is corrupted.
+	*/
+	bool Valid(int numBounds) const;
+
+	/*!
+		Intersection query.
+		Traverse the BVH from near to far and call func(ray, i) for each primitive in the intersected leaves,
+		where i is the position of the primitive in the leaf order.
+		The function must return true and update ray.maxT if the ray hits the primitive.
+		\param ray Ray.
+		\param func Intersection function for the primitives.
+		\retval true Intersected with one of the primitives.
+		\retval false Not intersected.
+	*/
+	template <typename IntersectFunc>
+	bool Intersect(Ray& ray, const IntersectFunc& func) const;
+
+	/*!
+		Occlusion query.
+		Same as Intersect but the traversal terminates as soon as func(ray, i) returns true.
+		\param ray Ray.
+		\param func Occlusion function for the primitives.
+		\retval true Occluded.
+		\retval false Not occluded.
+	*/
+	template <typename OccludedFunc>
+	bool Occluded(const Ray& ray, const OccludedFunc& func) const;
+
+	/*!
+		Get the index of the primitive.
+		\param i Position of the primitive in the leaf order.
+		\return Index of the bound given for building.
+	*/
+	int PrimitiveIndex(int i) const { return primitiveIndices[i]; }
+
+	const ConstArray<QBVHNode, QBVHNodeAllocator>& Nodes() const { return nodes; }
+	const ConstArray<int>& PrimitiveIndices() const { return primitiveIndices; }
+
+	int NumPrimitives() const { return (int)primitiveIndices.size(); }
+	int NumNodes() const { return (int)nodes.size(); }
+	int NumBuildNodes() const { return numBuildNodes; }
+	double SAHCost() const { return sahCost; }
+	AABB Bound() const { return bound; }
+
+private:
+
+	int Build(BVHBuildData& data, BVHNodeArray& buildNodes, int begin, int end, const AABB& bound, const AABB& centroidBound, int depth);
+	int CreateLeafNode(BVHNodeArray& buildNodes, int begin, int end, const AABB& bound);
+	int AppendNodes(BVHNodeArray& buildNodes, const BVHNodeArray& subtreeNodes);
+	double EvaluateSAHCost(const BVHNodeArray& buildNodes);
+	int Collapse(const BVHNodeArray& buildNodes, int buildNodeIndex, QBVHNodeArray& qbvhNodes);
+	static int Intersect(const QBVHNode& node, const BVHTraversalData& data, float* tNear);
+	static float RoundDown(double v);
+	static float RoundUp(double v);
+
+private:
+
+	// Maximum depth of the traversal stack
+	// Each QBVH node pushes at most 3 entries.
+	static const int MaxTraversalStackSize = 256;
+
+	// Maximum depth of the binary BVH
+	// A QBVH node is at least one level deeper than its parent,
+	// so the traversal stack holds at most 3 * MaxBuildDepth + 4 entries.
+	static const int MaxBuildDepth = 64;
+	static_assert(3 * MaxBuildDepth + 4 <= MaxTraversalStackSize, "Traversal stack can overflow");
+
+private:
+
+	int maxPrimitivesInNode;
+	int numBuildThreads;
+	ConstArray<int> primitiveIndices;
+	ConstArray<QBVHNode, QBVHNodeAllocator> nodes;
+
+	AABB bound;
+	int numBuildNodes;
+	double sahCost;
+
+private:
+
+	// The build product can be serialized for the BVH cache.
+	// The arrays are serialized as std::vector.
+	friend class boost::serialization::access;
+	template <class Archive>
+	void save(Archive& ar, unsigned int version) const
+	{
+		std::vector<int> primitiveIndices(this->primitiveIndices.begin(), this->primitiveIndices.end());
+		QBVHNodeArray nodes(this->nodes.begin(), this->nodes.end());
+		ar & BOOST_SERIALIZATION_NVP(maxPrimitivesInNode);
+		ar & BOOST_SERIALIZATION_NVP(primitiveIndices);
+		ar & BOOST_SERIALIZATION_NVP(nodes);
+		ar & BOOST_SERIALIZATION_NVP(bound);
+		ar & BOOST_SERIALIZATION_NVP(numBuildNodes);
+		ar & BOOST_SERIALIZATION_NVP(sahCost);
+	}
+
+	template <class Archive>
+	void load(Archive& ar, unsigned int version)
+	{
+		std::vector<int> primitiveIndices;
+		QBVHNodeArray nodes;
+		ar & BOOST_SERIALIZATION_NVP(maxPrimitivesInNode);
+		ar & BOOST_SERIALIZATION_NVP(primitiveIndices);
+		ar & BOOST_SERIALIZATION_NVP(nodes);
+		ar & BOOST_SERIALIZATION_NVP(bound);
+		ar & BOOST_SERIALIZATION_NVP(numBuildNodes);
+		ar & BOOST_SERIALIZATION_NVP(sahCost);
+		this->primitiveIndices = ConstArray<int>(std::move(primitiveIndices));
+		this->nodes = ConstArray<QBVHNode, QBVHNodeAllocator>(std::move(nodes));
+	}
+
+	BOOST_SERIALIZATION_SPLIT_MEMBER()
+
+};
+
+HINATA_NAMESPACE_END
+
+// Nodes are serialized as raw memory by binary archives
+BOOST_IS_BITWISE_SERIALIZABLE(hinata::QBVHNode)
+
+#include "bvh.inl"
+
+#endif // __HINATA_CORE_BVH_H__
\ No newline at end of file
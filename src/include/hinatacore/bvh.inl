@@ -0,0 +1,251 @@
+#include "common.h"
+#include "ray.h"
+#include <limits>
+#include <cmath>
+#include <cassert>
+
+HINATA_NAMESPACE_BEGIN
+
+struct BVHTraversalData
+{
+
+	BVHTraversalData(const Ray& ray)
+		: ray(ray)
+	{
+		for (int i = 0; i < 3; i++)
+		{
+			rayOrigin[i] = (float)ray.o[i];
+			invRayDir[i] = (float)(1.0 / ray.d[i]);
+			rayDirNegative[i] = ray.d[i] < 0.0;
+		}
+	}
+
+	const Ray& ray;
+	int rayDirNegative[3];	// Each component of the rayDir is negative
+	float rayOrigin[3];		// Origin of the ray in single precision
+	float invRayDir[3];		// Inverse of the rayDir in single precision
+
+};
+
+// Traversal stack entry
+struct BVHTraversalStackEntry
+{
+	int nodeIndex;			// Index of the node
+	float tNear;			// Distance to the entry point of the node bound
+};
+
+// Relative enlargement of the slab test range which
+// compensates the rounding errors in single precision.
+const float BVHSlabTestRangeScale = 1.0f + 4.0f * std::numeric_limits<float>::epsilon();
+
+template <typename IntersectFunc>
+bool BVH::Intersect( Ray& ray, const IntersectFunc& func ) const
+{
+	BVHTraversalData data(ray);
+
+	bool intersected = false;
+	BVHTraversalStackEntry stack[MaxTraversalStackSize];
+	int stackIndex = 0;
+
+	stack[stackIndex].nodeIndex = 0;
+	stack[stackIndex++].tNear = 0.0f;
+
+	while (stackIndex > 0)
+	{
+		// Skip the node if it is farther than the current closest hit
+		const auto& entry = stack[--stackIndex];
+		if ((double)entry.tNear > ray.maxT * (double)BVHSlabTestRangeScale)
+		{
+			continue;
+		}
+
+		const auto& node = nodes[entry.nodeIndex];
+
+		// Check intersection to the children bounds
+		float tNear[4];
+		int mask = Intersect(node, data, tNear);
+
+		if (mask == 0)
+		{
+			continue;
+		}
+
+		// Sort intersected children by the distance (nearest first)
+		int order[4];
+		int numHits = 0;
+
+		for (int i = 0; i < 4; i++)
+		{
+			if ((mask & (1 << i)) == 0 || node.child[i] < 0)
+			{
+				continue;
+			}
+
+			int j = numHits++;
+			for (; j > 0 && tNear[order[j - 1]] > tNear[i]; j--)
+			{
+				order[j] = order[j - 1];
+			}
+
+			order[j] = i;
+		}
+
+		// Leaf children are processed immediately from the nearest one
+		for (int j = 0; j < numHits; j++)
+		{
+			int i = order[j];
+			if (node.numPrimitives[i] > 0)
+			{
+				for (int k = node.child[i]; k < node.child[i] + node.numPrimitives[i]; k++)
+				{
+					if (func(ray, k))
+					{
+						intersected = true;
+					}
+				}
+			}
+		}
+
+		// Internal children are pushed from the farthest one
+		// so that the nearest one is traversed first.
+		for (int j = numHits - 1; j >= 0; j--)
+		{
+			int i = order[j];
+			if (node.numPrimitives[i] == 0)
+			{
+				assert(stackIndex < MaxTraversalStackSize);
+				stack[stackIndex].nodeIndex = node.child[i];
+				stack[stackIndex++].tNear = tNear[i];
+			}
+		}
+	}
+
+	return intersected;
+}
+
+template <typename OccludedFunc>
+bool BVH::Occluded( const Ray& ray, const OccludedFunc& func ) const
+{
+	BVHTraversalData data(ray);
+
+	int stack[MaxTraversalStackSize];
+	int stackIndex = 0;
+
+	stack[stackIndex++] = 0;
+
+	while (stackIndex > 0)
+	{
+		const auto& node = nodes[stack[--stackIndex]];
+
+		float tNear[4];
+		int mask = Intersect(node, data, tNear);
+
+		for (int i = 0; i < 4; i++)
+		{
+			if ((mask & (1 << i)) == 0 || node.child[i] < 0)
+			{
+				continue;
+			}
+
+			if (node.numPrimitives[i] > 0)
+			{
+				// Any hit is sufficient, so terminate the traversal immediately
+				for (int k = node.child[i]; k < node.child[i] + node.numPrimitives[i]; k++)
+				{
+					if (func(ray, k))
+					{
+						return true;
+					}
+				}
+			}
+			else
+			{
+				assert(stackIndex < MaxTraversalStackSize);
+				stack[stackIndex++] = node.child[i];
+			}
+		}
+	}
+
+	return false;
+}
+
+HINATA_FORCE_INLINE int BVH::Intersect( const QBVHNode& node, const BVHTraversalData& data, float* tNear )
+{
+	// Slab test against 4 children at once.
+	// Note that the NaNs arising from 0 * inf are
+	// discarded by the ordering of the operands of min/max.
+	float rayMinT = RoundDown(data.ray.minT);
+	float rayMaxT = RoundUp(data.ray.maxT);
+
+#ifdef HINATA_USE_SSE
+	__m128 tmin = _mm_set1_ps(rayMinT);
+	__m128 tmax = _mm_set1_ps(rayMaxT);
+
+	for (int axis = 0; axis < 3; axis++)
+	{
+		__m128 o = _mm_set1_ps(data.rayOrigin[axis]);
+		__m128 invD = _mm_set1_ps(data.invRayDir[axis]);
+
+		const float* nearBound = data.rayDirNegative[axis] ? node.boundMax[axis] : node.boundMin[axis];
+		const float* farBound  = data.rayDirNegative[axis] ? node.boundMin[axis] : node.boundMax[axis];
+
+		__m128 t0 = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(nearBound), o), invD);
+		__m128 t1 = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(farBound), o), invD);
+
+		tmin = _mm_max_ps(t0, tmin);
+		tmax = _mm_min_ps(t1, tmax);
+	}
+
+	_mm_storeu_ps(tNear, tmin);
+	return _mm_movemask_ps(_mm_cmple_ps(tmin, _mm_mul_ps(tmax, _mm_set1_ps(BVHSlabTestRangeScale))));
+#else
+	int mask = 0;
+
+	for (int i = 0; i < 4; i++)
+	{
+		float tmin = rayMinT;
+		float tmax = rayMaxT;
+
+		for (int axis = 0; axis < 3; axis++)
+		{
+			float nearBound = data.rayDirNegative[axis] ? node.boundMax[axis][i] : node.boundMin[axis][i];
+			float farBound  = data.rayDirNegative[axis] ? node.boundMin[axis][i] : node.boundMax[axis][i];
+
+			float t0 = (nearBound - data.rayOrigin[axis]) * data.invRayDir[axis];
+			float t1 = (farBound  - data.rayOrigin[axis]) * data.invRayDir[axis];
+
+			tmin = t0 > tmin ? t0 : tmin;
+			tmax = t1 < tmax ? t1 : tmax;
+		}
+
+		tNear[i] = tmin;
+		if (tmin <= tmax * BVHSlabTestRangeScale)
+		{
+			mask |= 1 << i;
+		}
+	}
+
+	return mask;
+#endif
+}
+
+HINATA_FORCE_INLINE float BVH::RoundDown( double v )
+{
+	// Conversion to single precision rounded toward -inf.
+	// Values out of the range of float are converted to infinities.
+	if (v < -(double)std::numeric_limits<float>::max()) return -std::numeric_limits<float>::infinity();
+	if (v > (double)std::numeric_limits<float>::max()) return std::numeric_limits<float>::max();
+	float f = (float)v;
+	return (double)f > v ? std::nextafter(f, -std::numeric_limits<float>::infinity()) : f;
+}
+
+HINATA_FORCE_INLINE float BVH::RoundUp( double v )
+{
+	// Conversion to single precision rounded toward +inf.
+	if (v > (double)std::numeric_limits<float>::max()) return std::numeric_limits<float>::infinity();
+	if (v < -(double)std::numeric_limits<float>::max()) return -std::numeric_limits<float>::max();
+	float f = (float)v;
+	return (double)f < v ? std::nextafter(f, std::numeric_limits<float>::infinity()) : f;
+}
+
+HINATA_NAMESPACE_END
\ No newline at end of file
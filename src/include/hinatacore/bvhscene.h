@@ -3,46 +3,130 @@
 
 #include "scene.h"
 #include "math.h"
+#include "bvh.h"
+#include "constarray.h"
 #include <memory>
 #include <vector>
 
 HINATA_NAMESPACE_BEGIN
 
-struct BVHNode;
-struct BVHBuildData;
-struct BVHTraversalData;
 class BSDF;
 class AreaLight;
 struct TriangleMesh;
-class Primitive;
+struct SceneData;
+class SceneFile;
+class TaskScheduler;
 
+/*!
+	Precomputed triangle.
+	Triangle baked at load time for the ray-triangle intersection,
+	which avoids the indirection to the mesh.
+	Triangles are stored in the leaf order of the BVH of the mesh,
+	so that the triangles in a leaf are contiguous in memory.
+*/
+struct BVHTriangle
+{
+
+	Vec3d p1;					// First vertex in mesh space
+	Vec3d e1;					// Edge p2 - p1
+	Vec3d e2;					// Edge p3 - p1
+	bool oneSided;				// Ignore the ray from the back side
+
+};
+
+/*!
+	Bottom level acceleration structure.
+	BVH over the faces of a mesh in its own space.
+	The BVH is built once for each mesh and shared by all instances of the mesh.
+	Faces are referred by the index in the face array of the mesh,
+	so no per-face objects are created.
+*/
+struct BVHMesh
+{
+	BVH bvh;
+	std::vector<BVHTriangle> triangles;
+	int materialIndex;			// Index of the material shared by all faces of the mesh
+};
+
+/*!
+	Mesh instance.
+	Placement of a mesh in the scene, which is the leaf of the top level BVH.
+*/
+struct BVHInstance
+{
+	int meshIndex;				// Index of the mesh
+	Mat4d worldToLocal;			// Transform from world space to mesh space
+	Mat4d localToWorld;			// Transform from mesh space to world space
+	Mat3d normalLocalToWorld;	// Transform of the normals from mesh space to world space
+	int lightTriangleOffset;	// Index of the triangle in the light for the first face if emissive
+};
+
+/*!
+	BVH scene.
+	Scene with two-level BVH.
+	The bottom level BVHs are built for each mesh
+	and the top level BVH is built over the instances of the meshes.
+*/
 class BVHScene : public Scene
 {
 public:
 
-	BVHScene(const std::string& scenePath);
+	/*!
+		Constructor.
+		Loads the scene and builds BVH.
+		\param scenePath Path to the scene file.
+		\param scheduler Thread pool used for building BVH.
+	*/
+	BVHScene(const std::string& scenePath, TaskScheduler& scheduler);
 
 public:
 
 	bool Intersect(Ray& ray, Intersection& isect);
-	std::vector<std::shared_ptr<Primitive>> Primitives() { return primitives; }
+	bool Occluded(const Ray& ray);
+
+public:
+
+	/*!
+		Build BVH cache.
+		Builds BVH for each mesh in the scene data and stores them in the scene data,
+		so that the BVHs are loaded instead of being built when the scene is loaded.
+		\param sceneData Scene data.
+		\param scheduler Thread pool used for building BVH.
+	*/
+	static void BuildBVHCache(SceneData& sceneData, TaskScheduler& scheduler);
+
+	/*!
+		Hash of the geometry of a mesh.
+		Used to check if the BVH cache is built for the mesh.
+		\param positions Positions of the mesh.
+		\param faces Faces of the mesh.
+		\return Hash value.
+	*/
+	static unsigned long long MeshHash(const ConstArray<Vec3d>& positions, const ConstArray<Vec3i>& faces);
+
+	/*!
+		Version of the BVH cache.
+		Increment when the builder or the layout of BVH is changed in order to invalidate old caches.
+	*/
+	static const unsigned long long BVHCacheVersion = 1;
 
 private:
 
-	bool Intersect(const std::shared_ptr<BVHNode>& node, BVHTraversalData& data, Intersection& isect);
-	bool Intersect(const AABB& bound, BVHTraversalData& data);
-	std::shared_ptr<BVHNode> Build(const BVHBuildData& data, int begin, int end);
 	void LoadPrimitives(const std::string& scenePath);
+	void CreateMeshTriangles(int meshIndex);
+	void BuildInstanceBVH();
+	static void BuildMeshBVH(const ConstArray<Vec3d>& positions, const ConstArray<Vec3i>& faces, BVH& bvh, TaskScheduler& scheduler);
 
 private:
 
 	std::vector<std::tuple<std::shared_ptr<BSDF>, std::shared_ptr<AreaLight>>> materials;
 	std::vector<std::shared_ptr<TriangleMesh>> meshes;
-	std::vector<std::shared_ptr<Primitive>> primitives;
+	std::shared_ptr<SceneFile> sceneFile;		// Keeps the mapping referred by the meshes
 
-	int maxPrimitivesInNode;
-	std::vector<int> bvhPrimitiveIndices;
-	std::shared_ptr<BVHNode> root;
+	TaskScheduler& scheduler;					// Thread pool used for building BVH
+	std::vector<BVHMesh> meshBVHs;
+	std::vector<BVHInstance> instances;
+	BVH instanceBVH;
 
 };
 
@@ -0,0 +1,122 @@
+#ifndef __HINATA_CORE_CONST_ARRAY_H__
+#define __HINATA_CORE_CONST_ARRAY_H__
+
+#include "common.h"
+#include <vector>
+
+HINATA_NAMESPACE_BEGIN
+
+/*!
+	Read-only array.
+	The elements are either owned by the array as std::vector
+	or stored in the external memory, e.g., the memory-mapped scene file.
+	In the latter case the array does not manage the lifetime of the memory.
+	The interface follows std::vector so that it can be used in place of it.
+	\tparam T Element type.
+	\tparam Allocator Allocator of the owned elements.
+*/
+template <typename T, typename Allocator = std::allocator<T>>
+class ConstArray
+{
+public:
+
+	ConstArray()
+		: ptr(nullptr)
+		, count(0)
+	{}
+
+	/*!
+		Constructor.
+		Takes the ownership of the elements.
+		\param v Elements.
+	*/
+	ConstArray(std::vector<T, Allocator>&& v)
+		: storage(std::move(v))
+		, ptr(storage.empty() ? nullptr : &storage[0])
+		, count(storage.size())
+	{}
+
+	/*!
+		Constructor.
+		Refers to the external memory.
+		\param data Pointer to the first element.
+		\param size Number of elements.
+	*/
+	ConstArray(const T* data, size_t size)
+		: ptr(data)
+		, count(size)
+	{}
+
+	// Copying owned elements copies them, a copy of the view refers to the same memory
+	ConstArray(const ConstArray& o)
+		: storage(o.storage)
+		, ptr(storage.empty() ? o.ptr : &storage[0])
+		, count(o.count)
+	{}
+
+	ConstArray& operator=(const ConstArray& o)
+	{
+		if (this != &o)
+		{
+			storage = o.storage;
+			ptr = storage.empty() ? o.ptr : &storage[0];
+			count = o.count;
+		}
+
+		return *this;
+	}
+
+	// Moving std::vector keeps the address of the elements
+	ConstArray(ConstArray&& o)
+		: storage(std::move(o.storage))
+		, ptr(o.ptr)
+		, count(o.count)
+	{
+		o.ptr = nullptr;
+		o.count = 0;
+	}
+
+	ConstArray& operator=(ConstArray&& o)
+	{
+		if (this != &o)
+		{
+			storage = std::move(o.storage);
+			ptr = o.ptr;
+			count = o.count;
+			o.ptr = nullptr;
+			o.count = 0;
+		}
+
+		return *this;
+	}
+
+public:
+
+	const T& operator[](size_t i) const { return ptr[i]; }
+	const T* data() const { return ptr; }
+	size_t size() const { return count; }
+	bool empty() const { return count == 0; }
+	const T* begin() const { return ptr; }
+	const T* end() const { return ptr + count; }
+
+private:
+
+	std::vector<T, Allocator> storage;
+	const T* ptr;
+	size_t count;
+
+};
+
+/*!
+	Create an array referring to the elements of std::vector.
+	The vector must outlive the array.
+*/
+template <typename T>
+ConstArray<T> MakeConstArrayView(const std::vector<T>& v)
+{
+	return ConstArray<T>(v.empty() ? nullptr : &v[0], v.size());
+}
+
+HINATA_NAMESPACE_END
+
+#endif // __HINATA_CORE_CONST_ARRAY_H__
\ No newline at end of file
@@ -27,6 +27,7 @@ public:
 public:
 
 	bool Intersect(Ray& ray, Intersection& isect);
+	bool Occluded(const Ray& ray);
 
 private:
 
@@ -0,0 +1,162 @@
+#ifndef __HINATA_CORE_DISTRIBUTION_H__
+#define __HINATA_CORE_DISTRIBUTION_H__
+
+#include "common.h"
+#include "math.h"
+#include <vector>
+
+HINATA_NAMESPACE_BEGIN
+
+/*!
+	Alias table.
+	Discrete distribution sampled in constant time with Walker's alias method.
+	The table is built with Vose's algorithm.
+*/
+class AliasTable
+{
+public:
+
+	AliasTable() {}
+
+public:
+
+	/*!
+		Build the table.
+		The probabilities are proportional to the weights.
+		If all weights are zero, the distribution is uniform.
+		\param weights Non-negative weights.
+	*/
+	void Build(const std::vector<double>& weights);
+
+	/*!
+		Sample an index.
+		The sample is rescaled to [0, 1) so that it can be reused.
+		\param u Uniform sample in [0, 1), which is replaced by the reused sample.
+		\return Sampled index.
+	*/
+	int Sample(double& u) const;
+
+	/*!
+		Evaluate the probability of an index.
+		\param index Index.
+		\return Probability.
+	*/
+	double Pdf(int index) const { return pdfs[index]; }
+
+	int Size() const { return (int)bins.size(); }
+	bool Empty() const { return bins.empty(); }
+
+private:
+
+	struct Bin
+	{
+		double q;		// Probability of choosing the bin itself
+		int alias;		// Index chosen otherwise
+	};
+
+	std::vector<Bin> bins;
+	std::vector<double> pdfs;
+
+};
+
+/*!
+	Piecewise constant 1D distribution.
+	Continuous distribution on [0, 1) with n constant segments, sampled by inverting the CDF.
+	Unlike the alias table, the sampling is monotonic in the sample,
+	so the stratification of the samples is preserved.
+*/
+class PiecewiseConstant1D
+{
+public:
+
+	PiecewiseConstant1D()
+		: integral(0)
+	{}
+
+public:
+
+	/*!
+		Build the distribution.
+		If the function is zero everywhere, the distribution is uniform.
+		\param f Non-negative values of the segments.
+		\param n Number of segments.
+	*/
+	void Build(const double* f, int n);
+
+	/*!
+		Sample a point.
+		\param u Uniform sample in [0, 1).
+		\param pdf Density of the sampled point.
+		\param offset Index of the segment containing the sampled point.
+		\return Sampled point in [0, 1).
+	*/
+	double Sample(double u, double& pdf, int& offset) const;
+
+	/*!
+		Evaluate the density.
+		\param x Point in [0, 1).
+		\return Density.
+	*/
+	double Pdf(double x) const;
+
+	/*!
+		Integral of the function over [0, 1).
+		\return Integral.
+	*/
+	double Integral() const { return integral; }
+
+private:
+
+	std::vector<double> func;
+	std::vector<double> cdf;
+	double integral;
+
+};
+
+/*!
+	Piecewise constant 2D distribution.
+	Continuous distribution on [0, 1)^2 with nu * nv constant cells.
+	The second coordinate is sampled from the marginal distribution
+	and then the first one from the conditional distribution of the row.
+*/
+class PiecewiseConstant2D
+{
+public:
+
+	PiecewiseConstant2D() {}
+
+public:
+
+	/*!
+		Build the distribution.
+		\param f Non-negative values of the cells in row-major order.
+		\param nu Number of cells in the first coordinate.
+		\param nv Number of cells in the second coordinate.
+	*/
+	void Build(const std::vector<double>& f, int nu, int nv);
+
+	/*!
+		Sample a point.
+		\param u Uniform sample in [0, 1)^2.
+		\param pdf Density of the sampled point.
+		\return Sampled point in [0, 1)^2.
+	*/
+	Vec2d Sample(const Vec2d& u, double& pdf) const;
+
+	/*!
+		Evaluate the density.
+		\param p Point in [0, 1)^2.
+		\return Density.
+	*/
+	double Pdf(const Vec2d& p) const;
+
+private:
+
+	std::vector<PiecewiseConstant1D> conditionals;
+	PiecewiseConstant1D marginal;
+
+};
+
+HINATA_NAMESPACE_END
+
+#endif // __HINATA_CORE_DISTRIBUTION_H__
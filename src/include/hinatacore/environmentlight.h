@@ -3,6 +3,7 @@
 
 #include "common.h"
 #include "math.h"
+#include "distribution.h"
 #include <memory>
 
 HINATA_NAMESPACE_BEGIN
@@ -10,8 +11,7 @@ HINATA_NAMESPACE_BEGIN
 /*!
 	Environment light.
 	We note that current implementation separates AreaLight and EnvironmentLight,
-	and the class does not have the sampling related functions.
-	So for now, it can be applicable only the PT based renderers.
+	and for now, it can be applicable only the PT based renderers.
 	TODO : Integrate environment light and area light into general Light class.
 */
 class EnvironmentLight
@@ -30,8 +30,29 @@ private:
 
 public:
 
+	/*!
+		Evaluate the radiance.
+		\param d Direction of the emission, i.e., from the environment to the receiver.
+		\return Radiance.
+	*/
 	virtual Vec3d Evaluate(const Vec3d& d) = 0;
 
+	/*!
+		Sample a direction of the emission.
+		\param u Sample.
+		\param d Sampled direction of the emission.
+		\param pdf PDF of the direction in solid angle measure.
+		\return Radiance to the sampled direction.
+	*/
+	virtual Vec3d Sample(const Vec2d& u, Vec3d& d, double& pdf) = 0;
+
+	/*!
+		Evaluate PDF of the direction.
+		\param d Direction of the emission.
+		\return PDF in solid angle measure.
+	*/
+	virtual double Pdf(const Vec3d& d) = 0;
+
 };
 
 // ------------------------------------------------------------------------------------------
@@ -45,6 +66,8 @@ public:
 public:
 
 	Vec3d Evaluate(const Vec3d& d) { return Le; }
+	Vec3d Sample(const Vec2d& u, Vec3d& d, double& pdf);
+	double Pdf(const Vec3d& d) { return 1.0 / (4.0 * Pi); }
 
 private:
 
@@ -56,6 +79,12 @@ private:
 
 class Image;
 
+/*!
+	Bitmap environment light.
+	Environment map in the latitude-longitude format.
+	Directions are sampled in proportion to the luminance of the pixels
+	weighted by sin(theta) of the rows, i.e., the solid angles of the pixels.
+*/
 class BitmapEnvironmentLight : public EnvironmentLight
 {
 public:
@@ -65,10 +94,17 @@ public:
 public:
 
 	Vec3d Evaluate(const Vec3d& d);
+	Vec3d Sample(const Vec2d& u, Vec3d& d, double& pdf);
+	double Pdf(const Vec3d& d);
+
+private:
+
+	Vec2d DirectionToUV(const Vec3d& d);
 
 private:
 
 	std::shared_ptr<Image> image;
+	PiecewiseConstant2D distribution;
 	double offset;
 	double scale;
 
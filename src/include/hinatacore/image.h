@@ -3,11 +3,23 @@
 
 #include "common.h"
 #include "math.h"
+#include <cstdio>
 #include <mutex>
 #include <string>
+#include <vector>
 
 HINATA_NAMESPACE_BEGIN
 
+/*!
+	Splat.
+	Contribution to a pixel of the image.
+*/
+struct ImageSplat
+{
+	int index;		// Index of the pixel (y * width + x)
+	Vec3d L;		// Contribution
+};
+
 class Image
 {
 public:
@@ -27,9 +39,66 @@ public:
 	int Width() { return width; }
 	int Height() { return height; }
 	Vec3d Evaluate(const Vec2d& uv);
+
+	/*!
+		Accumulate a tile.
+		Adds the colors of the tile to the region of the image.
+		The image is not locked, so the regions of concurrent calls must not overlap.
+		\param rect Region of the tile (x, y, width, height).
+		\param v Colors of the tile in row-major order (width * height elements).
+	*/
 	void Accumulate(const Vec4i& rect, const std::vector<Vec3d>& v);
+
+	/*!
+		Accumulate splats.
+		Adds the contributions to arbitrary pixels of the image.
+		The image is locked during the call.
+		\param splats Splats.
+	*/
+	void Accumulate(const std::vector<ImageSplat>& splats);
+
+	/*!
+		Accumulate an image.
+		Adds the pixels of another image of the same size.
+		The images are not locked.
+		\param src Source image.
+	*/
+	void Accumulate(const Image& src);
+
+	/*!
+		Clear the pixels to zero.
+	*/
+	void Clear();
+
+	/*!
+		Copy the pixels to another image of the same size.
+		Used to take a snapshot of the image being rendered.
+		\param dst Destination image.
+	*/
+	void CopyTo(Image& dst) const;
+
+	/*!
+		Multiply per-pixel weights.
+		\param weights Weights in the order of the pixels (width * height elements).
+	*/
+	void Scale(const std::vector<double>& weights);
+
+	/*!
+		Save the image.
+		The format is chosen by the extension of the path:
+		.pfm (32-bit float), .exr (16-bit half float, uncompressed tiles), otherwise 8-bit PPM.
+		Only PPM clamps the pixel values; the float formats keep the linear HDR values.
+		\param path Output path.
+		\param weight Weight multiplied to the pixels.
+	*/
 	void Save(const std::string& path, double weight);
 
+private:
+
+	void SavePPM(FILE* fp, double weight);
+	void SavePFM(FILE* fp, double weight);
+	void SaveEXR(FILE* fp, double weight);
+
 private:
 
 	int width;
@@ -39,6 +108,63 @@ private:
 
 };
 
+/*!
+	Splat buffer.
+	Bounded buffer of the splats for the renderers
+	which contribute to arbitrary pixels, e.g., PSSMLT.
+	The splats are accumulated to the image when the buffer is full or flushed,
+	so the memory usage does not depend on the resolution
+	and the image is locked only once for each flush.
+*/
+class SplatBuffer
+{
+public:
+
+	/*!
+		Constructor.
+		\param image Target image.
+		\param capacity Maximum number of the splats held in the buffer.
+	*/
+	SplatBuffer(Image& image, int capacity);
+
+private:
+
+	SplatBuffer(const SplatBuffer&);
+	SplatBuffer(SplatBuffer&&);
+	void operator=(const SplatBuffer&);
+	void operator=(SplatBuffer&&);
+
+public:
+
+	/*!
+		Add a splat.
+		\param x X coordinate of the pixel.
+		\param y Y coordinate of the pixel.
+		\param L Contribution.
+	*/
+	void Splat(int x, int y, const Vec3d& L);
+
+	/*!
+		Accumulate the splats in the buffer to the image.
+		The function must be called after the last splat of the pass.
+	*/
+	void Flush();
+
+	/*!
+		Change the target image.
+		The splats in the buffer are accumulated to the current target before the change.
+		\param image New target image.
+	*/
+	void SetImage(Image& image);
+
+private:
+
+	Image* image;
+	int capacity;
+	std::vector<ImageSplat> splats;
+
+};
+
 HINATA_NAMESPACE_END
 
 #endif // __HINATA_CORE_IMAGE_H__
\ No newline at end of file
@@ -0,0 +1,88 @@
+#ifndef __HINATA_CORE_IMAGE_WRITER_H__
+#define __HINATA_CORE_IMAGE_WRITER_H__
+
+#include "common.h"
+#include <memory>
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+HINATA_NAMESPACE_BEGIN
+
+class Image;
+
+/*!
+	Asynchronous image writer.
+	Saves snapshots of the image in a background thread.
+	The snapshots are double-buffered, so the image can be modified
+	right after the snapshot is taken while the previous one is still being written.
+*/
+class ImageWriter
+{
+public:
+
+	/*!
+		Constructor.
+		Allocates the snapshot buffers and starts the writer thread.
+		\param width Width of the image.
+		\param height Height of the image.
+	*/
+	ImageWriter(int width, int height);
+
+	/*!
+		Destructor.
+		Waits for the pending snapshots to be written.
+	*/
+	~ImageWriter();
+
+private:
+
+	ImageWriter(const ImageWriter&);
+	ImageWriter(ImageWriter&&);
+	void operator=(const ImageWriter&);
+	void operator=(ImageWriter&&);
+
+public:
+
+	/*!
+		Request to save the image.
+		Copies the image to a free snapshot buffer and returns without waiting for the write.
+		Waits only if both buffers are still being written.
+		\param image Image to be saved.
+		\param path Output path.
+		\param weight Weight multiplied to the pixels.
+		\param pixelWeights Per-pixel weights multiplied in addition to weight, or empty.
+	*/
+	void Save(const Image& image, const std::string& path, double weight, const std::vector<double>& pixelWeights);
+
+private:
+
+	struct Snapshot
+	{
+		std::unique_ptr<Image> image;
+		std::string path;
+		double weight;
+		std::vector<double> pixelWeights;
+		bool pending;			// Waiting for or being written
+	};
+
+	void Process();
+
+private:
+
+	Snapshot snapshots[2];
+	int next;					// Index of the snapshot to be written next
+	bool done;
+
+	std::mutex mutex;
+	std::condition_variable snapshotPending;
+	std::condition_variable snapshotWritten;
+	std::thread thread;
+
+};
+
+HINATA_NAMESPACE_END
+
+#endif // __HINATA_CORE_IMAGE_WRITER_H__
\ No newline at end of file
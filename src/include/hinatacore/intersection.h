@@ -3,17 +3,21 @@
 
 #include "common.h"
 #include "math.h"
-#include <memory>
 
 HINATA_NAMESPACE_BEGIN
 
-class Primitive;
+class BSDF;
+class AreaLight;
 
 class Intersection
 {
 public:
 
-	std::shared_ptr<Primitive> primitive;
+	// Non-owning, the scene keeps the ownership.
+	// Avoids the reference counting for each hit.
+	BSDF* bsdf;			// BSDF of the surface
+	AreaLight* light;	// Light associated with the surface if emissive, or nullptr
+	int lightTriangle;	// Index of the triangle in the light if emissive
 
 	Vec3d p;		// Intersection point
 	Vec3d gn;		// Geometry normal
@@ -0,0 +1,127 @@
+#ifndef __HINATA_CORE_LIGHT_BVH_H__
+#define __HINATA_CORE_LIGHT_BVH_H__
+
+#include "common.h"
+#include "math.h"
+#include "aabb.h"
+#include <memory>
+#include <vector>
+
+HINATA_NAMESPACE_BEGIN
+
+class AreaLight;
+
+/*!
+	Light BVH.
+	Hierarchy over the triangles of the area lights for many-light sampling.
+	Each node bounds the positions, the emitted directions, and the power of the triangles below it.
+	A triangle is sampled by descending the tree from the root, choosing a child
+	in proportion to its importance for the shading point and normal.
+	Based on [Conty Estevez & Kulla 2018], "Importance Sampling of Many Lights with Adaptive Tree Splitting".
+*/
+class LightBVH
+{
+public:
+
+	LightBVH() {}
+
+private:
+
+	LightBVH(const LightBVH&);
+	LightBVH(LightBVH&&);
+	void operator=(const LightBVH&);
+	void operator=(LightBVH&&);
+
+public:
+
+	/*!
+		Build the hierarchy.
+		Indices of the lights must be assigned beforehand.
+		Triangles without power are excluded, so they are never sampled.
+		\param lights Initialized lights.
+	*/
+	void Build(const std::vector<std::shared_ptr<AreaLight>>& lights);
+
+	/*!
+		Sample a triangle of the lights.
+		The sample is rescaled at each level so that it can be reused.
+		\param p Shading point.
+		\param n Shading normal, or zero vector to ignore the orientation of the receiver.
+		\param u Uniform sample in [0, 1), which is replaced by the reused sample.
+		\param lightIndex Index of the sampled light.
+		\param triangle Index of the sampled triangle in the light.
+		\param pdf Discrete probability of the sampled triangle.
+		\retval true Sampled.
+		\retval false No light contributes to the shading point.
+	*/
+	bool Sample(const Vec3d& p, const Vec3d& n, double& u, int& lightIndex, int& triangle, double& pdf) const;
+
+	/*!
+		Evaluate the probability of sampling a triangle.
+		Evaluates exactly the probability that Sample returns the triangle
+		for the same shading point and normal.
+		\param p Shading point.
+		\param n Shading normal, or zero vector.
+		\param lightIndex Index of the light.
+		\param triangle Index of the triangle in the light.
+		\return Discrete probability.
+	*/
+	double Pdf(const Vec3d& p, const Vec3d& n, int lightIndex, int triangle) const;
+
+	bool Empty() const { return nodes.empty(); }
+
+private:
+
+	/*!
+		Bound of the lights.
+		The emitted directions are bounded by the cone around axis with spread thetaO.
+		Area lights are diffuse, so the emission spreads pi/2 around each direction in the cone.
+	*/
+	struct LightBound
+	{
+		LightBound()
+			: axis(0, 0, 1)
+			, cosThetaO(1)
+			, power(0)
+		{}
+
+		void Merge(const LightBound& o);
+		double Importance(const Vec3d& p, const Vec3d& n) const;
+		double OrientationCost() const;
+
+		AABB bound;
+		Vec3d axis;
+		double cosThetaO;
+		double power;
+	};
+
+	struct Node
+	{
+		LightBound lightBound;
+		int parent;				// Index of the parent node, or -1 for the root
+		int children[2];		// Indices of the children for the interior node
+		int lightIndex;			// Triangle for the leaf node, or -1 for the interior node
+		int triangle;
+	};
+
+	struct LightPrimitive
+	{
+		LightBound lightBound;
+		Vec3d centroid;
+		int lightIndex;
+		int triangle;
+	};
+
+	int Build(std::vector<LightPrimitive>& primitives, int begin, int end, int parent);
+
+private:
+
+	std::vector<Node> nodes;
+	std::vector<int> leafOffsets;		// Offset of the first triangle of each light in leaves
+	std::vector<int> leaves;			// Leaf node of each triangle, or -1 if excluded
+
+};
+
+HINATA_NAMESPACE_END
+
+#endif // __HINATA_CORE_LIGHT_BVH_H__
\ No newline at end of file
@@ -0,0 +1,87 @@
+#ifndef __HINATA_CORE_LOW_DISCREPANCY_SAMPLER_H__
+#define __HINATA_CORE_LOW_DISCREPANCY_SAMPLER_H__
+
+#include "sampler.h"
+
+HINATA_NAMESPACE_BEGIN
+
+/*!
+	Sobol sampler.
+	Generates the points of the Sobol sequence per pixel,
+	Owen-scrambled with the hash of the pixel and the dimension (Burley 2020).
+	The dimensions beyond NumDimensions are padded with the pseudo-random numbers.
+*/
+class SobolSampler : public Sampler
+{
+public:
+
+	/*!
+		Constructor.
+		\param rng Random number generator for the padded dimensions.
+		\param seed Seed of the scrambling. Must be the same for all samplers rendering the same image.
+	*/
+	SobolSampler(const std::shared_ptr<Random>& rng, unsigned int seed);
+
+public:
+
+	double Next();
+	void StartSample(const Vec2i& pixel, long long index);
+	void SetDimension(int dimension) { this->dimension = dimension; }
+	std::shared_ptr<Random> Rng() { return rng; }
+
+public:
+
+	static const int NumDimensions = 21;
+
+private:
+
+	std::shared_ptr<Random> rng;
+	unsigned int seed;
+	unsigned int pixelSeed;
+	unsigned int index;
+	int dimension;
+
+};
+
+/*!
+	Halton sampler.
+	Generates the points of the Halton sequence per pixel.
+	The digits are scrambled with the hash of the pixel, dimension, and the preceding digits,
+	i.e., a nested (Owen-style) scrambling in the base of the dimension.
+	The dimensions beyond NumDimensions are padded with the pseudo-random numbers.
+*/
+class HaltonSampler : public Sampler
+{
+public:
+
+	/*!
+		Constructor.
+		\param rng Random number generator for the padded dimensions.
+		\param seed Seed of the scrambling. Must be the same for all samplers rendering the same image.
+	*/
+	HaltonSampler(const std::shared_ptr<Random>& rng, unsigned int seed);
+
+public:
+
+	double Next();
+	void StartSample(const Vec2i& pixel, long long index);
+	void SetDimension(int dimension) { this->dimension = dimension; }
+	std::shared_ptr<Random> Rng() { return rng; }
+
+public:
+
+	static const int NumDimensions = 64;
+
+private:
+
+	std::shared_ptr<Random> rng;
+	unsigned int seed;
+	unsigned int pixelSeed;
+	unsigned long long index;
+	int dimension;
+
+};
+
+HINATA_NAMESPACE_END
+
+#endif // __HINATA_CORE_LOW_DISCREPANCY_SAMPLER_H__
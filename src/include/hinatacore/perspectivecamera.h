@@ -47,6 +47,14 @@ public:
 	*/
 	Vec3d SampleAndEvaluate(const Vec3d& ref, Vec2d& rasterPos, double& pdf);
 
+	/*!
+		Evaluate PDF of directional component.
+		Evaluate p_\sigma(z_0\to z_1) of the direction sampled by the first SampleAndEvaluate.
+		\param d Direction from the camera in world coordinates.
+		\return Evaluated value, or zero if the direction is out of the view.
+	*/
+	double PdfDirection(const Vec3d& d);
+
 	/*!
 		Position of the camera.
 		\return Position of the camera.
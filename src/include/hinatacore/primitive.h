@@ -32,18 +32,27 @@ private:
 public:
 
 	bool Intersect(Ray& ray, Intersection& isect);
+	bool Intersect(const Ray& ray);
 	void SamplePosition(ShapePositionSampleRecord& record);
 	double Area();
 	AABB Bound();
 
-	std::shared_ptr<Shape> GetShape() { return shape; }
-	std::shared_ptr<BSDF> Bsdf() { return bsdf; }
-	std::shared_ptr<AreaLight> Light() { return light; }
-	Mat4d LocalToWorld() { return localToWorld; }
+	const std::shared_ptr<Shape>& GetShape() const { return shape; }
+	const std::shared_ptr<BSDF>& Bsdf() const { return bsdf; }
+	const std::shared_ptr<AreaLight>& Light() const { return light; }
+	const Mat4d& LocalToWorld() const { return localToWorld; }
+
+	/*!
+		Index of the triangle in the light.
+		Used for emissive primitives with triangle shape.
+	*/
+	int LightTriangle() const { return lightTriangle; }
+	void SetLightTriangle(int lightTriangle) { this->lightTriangle = lightTriangle; }
 
 private:
 
 	void InitializeTransform();
+	void TransformIntersection(Intersection& isect);
 
 private:
 
@@ -54,6 +63,7 @@ private:
 	std::shared_ptr<Shape> shape;
 	std::shared_ptr<BSDF> bsdf;
 	std::shared_ptr<AreaLight> light;
+	int lightTriangle;
 
 };
 
@@ -2,6 +2,7 @@
 #define __HINATA_CORE_PSSMLT_RENDERER_H__
 
 #include "renderer.h"
+#include "pssmltsampler.h"
 #include <string>
 
 HINATA_NAMESPACE_BEGIN
@@ -34,15 +35,15 @@ public:
 	PSSMLTEstimatorMode estimatorMode;
 	double kernelSizeS1;
 	double kernelSizeS2;
+	int splatBufferSize;
+	int numChains;			// Number of Markov chains (number of render tasks if 0)
 
 };
 
 
 // ------------------------------------------------------------------------------------------
 
-class Sampler;
-class RestorableSampler;
-class LazyPSSSampler;
+class SplatBuffer;
 class Ray;
 
 class PSSMLTRenderer : public Renderer
@@ -54,12 +55,12 @@ public:
 	struct PathSeed
 	{
 		PathSeed() {}
-		PathSeed(int index, double I)
+		PathSeed(long long index, double I)
 			: index(index)
 			, I(I)
 		{}
 
-		int index;
+		long long index;
 		double I;
 	};
 
@@ -70,17 +71,29 @@ public:
 		double I;
 	};
 
-	struct PSSMLT_Thread_InitParam : public Thread_InitParam  
+	/*!
+		Markov chain.
+		The chains are distributed over the render tasks and
+		a task interleaves the mutations of its chains.
+		The chains are stored by value and the random number generator
+		is borrowed from the thread processing the chain,
+		so the state of a chain is only the records and the primary samples.
+	*/
+	struct MarkovChain
 	{
-		PathSeed seed;
-		std::shared_ptr<RestorableSampler> rSampler;
+		MarkovChain(double s1, double s2)
+			: current(0)
+			, sampler(s1, s2)
+		{}
+
+		PathSampleRecord record[2];
+		int current;
+		LazyPSSSampler sampler;
 	};
 
 	struct PSSMLT_Thread_SharedData : public Thread_SharedData
 	{
-		PathSampleRecord record[2];
-		int current;
-		std::shared_ptr<LazyPSSSampler> sampler;
+		std::shared_ptr<SplatBuffer> splats;	// Contributions not yet accumulated to the image
 	};
 
 public:
@@ -90,22 +103,22 @@ public:
 private:
 
 	void Preprocess();
-	void SampleAndEvaluatePath(const std::shared_ptr<Sampler>& sampler, PathSampleRecord& record);
+	void SampleAndEvaluatePath(Sampler& sampler, PathSampleRecord& record);
 	void RenderPassFinished();
 	void SaveImageFinished();
 	double ImageSaveWeight();
-	std::shared_ptr<Thread_InitParam> Create_Thread_InitParam(int id);
+	int NumRenderTasks();
 	std::shared_ptr<Thread_SharedData> Create_Thread_SharedData();
 	void InitializeThread(std::shared_ptr<Thread_InitParam>& p, std::shared_ptr<Thread_SharedData>& s);
-	void ProcessThread_Render(std::shared_ptr<Thread_SharedData>& s);
+	void ProcessThread_Render(std::shared_ptr<Thread_SharedData>& s, int taskIndex);
 	void AccumulateColor(std::shared_ptr<PSSMLT_Thread_SharedData>& shared, PathSampleRecord& record, double weight);
 
 private:
 
 	std::shared_ptr<PSSMLTRendererConfig> config;
 	long long totalMutations;
-	std::vector<PathSeed> seeds;
 	double b;
+	std::vector<MarkovChain> chains;
 	std::shared_ptr<RestorableSampler> rSampler;
 
 };
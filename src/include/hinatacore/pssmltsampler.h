@@ -18,8 +18,14 @@ public:
 public:
 
 	double Next();
-	void SetIndex(int index);
-	int Index() { return currentIndex; }
+
+	/*!
+		Restore the state after the given number of samples.
+		Constant time, since the random number generator is counter-based.
+		\param index Number of samples generated from the initial state.
+	*/
+	void SetIndex(long long index);
+	long long Index() { return currentIndex; }
 	std::shared_ptr<Random> Rng() { return rng; }
 
 private:
@@ -28,7 +34,7 @@ private:
 	std::shared_ptr<Random> rng;
 
 	// Number of generated samples
-	int currentIndex;
+	long long currentIndex;
 
 };
 
@@ -5,6 +5,19 @@
 
 HINATA_NAMESPACE_BEGIN
 
+enum class PTPixelSampling
+{
+	Random,			// Samples scattered to random positions in the tile
+	Stratified		// Stratified samples per pixel, pixels in Morton order in the tile
+};
+
+enum class PTSamplerType
+{
+	Random,
+	Sobol,			// Owen-scrambled Sobol sequence per pixel
+	Halton			// Scrambled Halton sequence per pixel
+};
+
 class PTRendererConfig : public RendererConfig
 {
 public:
@@ -16,17 +29,72 @@ public:
 public:
 
 	// Options
-	int samplePerTask;
+	int samplePerPixel;
+	int tileSize;
+	PTPixelSampling pixelSampling;
+	PTSamplerType samplerType;		// Sampler of the paths of the stratified or adaptive passes
 	int rrDepth;
+	bool adaptiveSampling;			// Distribute the samples according to the estimated error of the pixels
+	int adaptiveInitialPasses;		// Number of passes with uniform samples before adapting
+	double targetError;				// Stop when the errors of all pixels are below the value (disabled if 0)
 
 };
 
 // --------------------------------------------------------------------------------
 
 class Ray;
-
+class Sampler;
+class RandomSampler;
+
+/*!
+	Path tracing renderer.
+	The image is divided into tiles and each render task renders a tile,
+	so that a thread only writes to its own tile.
+	The renderer tracks the number of samples and the variance of the luminance of each pixel,
+	which are used for the per-pixel normalization of the image and the adaptive sampling.
+*/
 class PTRenderer : public Renderer
 {
+public:
+
+	/*!
+		Statistics of the samples of a pixel.
+		The variance is accumulated with Welford's algorithm.
+	*/
+	struct PixelStats
+	{
+		PixelStats() : numSamples(0), mean(0), m2(0) {}
+
+		void Add(double v)
+		{
+			numSamples++;
+			double d = v - mean;
+			mean += d / numSamples;
+			m2 += d * (v - mean);
+		}
+
+		int numSamples;
+		double mean;		// Mean of the luminance
+		double m2;			// Sum of the squared differences from the mean
+	};
+
+	/*!
+		Error statistics of a tile.
+		Updated by the task rendering the tile.
+	*/
+	struct TileError
+	{
+		double errorSum;				// Sum of the errors of the pixels
+		int numUnconvergedPixels;		// Number of the pixels with errors above the target
+	};
+
+	struct PT_Thread_SharedData : public Thread_SharedData
+	{
+		std::vector<Vec3d> tile;					// Colors of the tile being rendered
+		std::shared_ptr<RandomSampler> randomSampler;	// Batched samples from rng
+		std::shared_ptr<Sampler> sampler;				// Sampler of the paths of the pixels
+	};
+
 public:
 
 	PTRenderer(const std::shared_ptr<PTRendererConfig>& config);
@@ -36,17 +104,41 @@ private:
 	void Preprocess();
 	void RenderPassFinished();
 	double ImageSaveWeight();
+	void ImageSavePixelWeights(std::vector<double>& weights);
+	bool RenderConverged();
+	int NumRenderTasks();
+	std::shared_ptr<Thread_SharedData> Create_Thread_SharedData();
 	void InitializeThread(std::shared_ptr<Thread_InitParam>& param, std::shared_ptr<Thread_SharedData>& shared);
-	void ProcessThread_Render(std::shared_ptr<Thread_SharedData>& shared);
+	void ProcessThread_Render(std::shared_ptr<Thread_SharedData>& shared, int taskIndex);
 
 private:
 
-	Vec3d Li(Ray& initialRay, std::shared_ptr<Thread_SharedData>& shared);
+	Vec3d Li(Ray& initialRay, Sampler& sampler);
+	int NumTilesX();
+	void RenderPixel(PT_Thread_SharedData& shared, int tileX, int tileY, int tileWidth, int x, int y, int numSamples);
+	double PixelError(const PixelStats& stats);
+	int NumPixelSamples(const PixelStats& stats, RandomSampler& sampler, int pass);
 
 public:
 
 	std::shared_ptr<PTRendererConfig> config;
-	long long processedSamples;
+	std::vector<PixelStats> pixelStats;
+	unsigned int samplerSeed;				// Seed of the scrambling of the low-discrepancy samplers
+
+	// Results of the passes, indexed by the pass (% 2).
+	// The tasks of the next pass are running while a pass is finished, so they are kept for each pass.
+	std::vector<TileError> tileErrors[2];	// Indexed by the task
+	std::vector<int> passNumSamples[2];		// Number of samples of the pixels at the end of the pass
+
+	// Sample allocation of the passes, indexed by the pass (% 2).
+	// Samples of a pixel are uniformSamples + samplesPerError * (error of the pixel)
+	// in the adaptive passes, or the uniform samples if samplesPerError is 0.
+	// The next pass is already running when a pass is finished,
+	// so the errors of a pass determine the allocation of the pass after the next.
+	int numFinishedPasses;
+	double uniformSamples[2];
+	double samplesPerError[2];
+	bool converged;
 
 };
 
@@ -2,13 +2,15 @@
 #define __HINATA_CORE_RANDOM_H__
 
 #include "common.h"
-#include <random>
 
 HINATA_NAMESPACE_BEGIN
 
 /*!
 	Random.
 	Random number generator.
+	Counter-based generator using Philox4x32-10 (Salmon et al. 2011).
+	The i-th number of the sequence is a function of the seed and i,
+	so the generator can seek to any position of the sequence in constant time.
 */
 class Random
 {
@@ -18,13 +20,39 @@ public:
 	double Next();
 	void SetSeed(unsigned int seed);
 
+	/*!
+		Generate numbers in bulk.
+		Same as calling Next() n times, but the blocks are generated in parallel with SIMD.
+		\param v Output numbers (n elements).
+		\param n Number of numbers.
+	*/
+	void NextN(double* v, int n);
+
+	/*!
+		Seek to the given position of the sequence.
+		The next call of Next() returns the index-th number (0-based) of the sequence.
+		\param index Index of the number.
+	*/
+	void SetIndex(unsigned long long index);
+
+	/*!
+		Number of the generated numbers since the seed is set.
+		\return Index of the next number.
+	*/
+	unsigned long long Index() const { return index; }
+
+private:
+
+	void GenerateBlock(unsigned long long block);
+
 private:
 
-	std::mt19937 engine;
-	std::uniform_real_distribution<double> uniformReal;
+	unsigned int key;
+	unsigned long long index;	// Index of the next number
+	unsigned int bits[4];		// Output of the current block (two numbers)
 
 };
 
 HINATA_NAMESPACE_END
 
-#endif // __HINATA_CORE_RANDOM_H__
\ No newline at end of file
+#endif // __HINATA_CORE_RANDOM_H__
@@ -3,9 +3,11 @@
 
 #include "common.h"
 #include "math.h"
-#include "syncqueue.h"
 #include <memory>
 #include <vector>
+#include <queue>
+#include <chrono>
+#include <atomic>
 #include <mutex>
 #include <condition_variable>
 #include <boost/program_options.hpp>
@@ -30,6 +32,7 @@ public:
 	int height;
 	std::string outputDir;
 	std::string outputFilePrefix;
+	std::string imageFormat;			// Format of the output images (ppm, pfm, or exr)
 	bool disableOutputFileSuffix;
 	bool fixedScene;
 	std::string scenePath;
@@ -51,23 +54,13 @@ public:
 class Random;
 class Image;
 class Scene;
+class TaskScheduler;
+class ImageWriter;
 
 class Renderer
 {
 public:
 
-	enum class Command
-	{
-		Render,
-		UpdateImage
-	};
-
-	struct Task
-	{
-		Command command;
-		bool needSync;
-	};
-
 	struct Thread_InitParam
 	{
 		virtual ~Thread_InitParam() {}
@@ -77,8 +70,9 @@ public:
 	struct Thread_SharedData
 	{
 		virtual ~Thread_SharedData() {}
-		std::vector<Vec3d> color;
 		std::shared_ptr<Random> rng;
+		int pass;			// Pass of the task being processed
+		Image* image;		// Accumulation image of the pass
 	};
 
 public:
@@ -100,35 +94,112 @@ public:
 private:
 
 	virtual void Preprocess() = 0;
+
+	/*!
+		Called when all tasks of a pass are finished.
+		The index of the pass is given by the member pass.
+		The tasks of the next pass can be running concurrently (see ProcessThread_Render()),
+		but the pass after the next is not started before the function and the image save of the pass return.
+	*/
 	virtual void RenderPassFinished() = 0;
 	virtual void SaveImageFinished() {}
 	virtual double ImageSaveWeight() = 0;
+
+	/*!
+		Per-pixel weights of the saved image.
+		Multiplied to the pixels in addition to ImageSaveWeight(),
+		e.g., the reciprocals of the per-pixel sample counts.
+		Called after RenderPassFinished() of the pass saving the image.
+		\param weights Weights in the order of the pixels. Left empty if not used.
+	*/
+	virtual void ImageSavePixelWeights(std::vector<double>& weights) {}
+
+	/*!
+		Check if the rendering is converged.
+		Called after RenderPassFinished(). If true, the final image is saved
+		and the rendering finishes before the execution time.
+	*/
+	virtual bool RenderConverged() { return false; }
+	virtual int NumRenderTasks() { return commonConfig->numRenderTasks; }
 	virtual void InitializeThread(std::shared_ptr<Thread_InitParam>& param, std::shared_ptr<Thread_SharedData>& shared) {}
-	virtual void ProcessThread_Render(std::shared_ptr<Thread_SharedData>& shared) = 0;
+
+	/*!
+		Process a render task.
+		Render tasks write their contributions directly to shared->image, the accumulation image of the pass,
+		so there is no reduction of the per-thread buffers after a pass.
+		The contributions of a task must be accumulated to the image before the function returns.
+		Two passes are in flight: the tasks of the next pass start while the other tasks of the pass are running,
+		and while the pass is being finished. The task of the next pass with the same index starts
+		after the function returns, so the state of a task is never accessed concurrently.
+		The state written by the tasks and read after the pass (e.g., in RenderPassFinished())
+		must be kept for each pass, e.g., indexed by shared->pass % 2.
+		\param shared Thread data.
+		\param taskIndex Index of the render task in the pass (0 to NumRenderTasks() - 1).
+	*/
+	virtual void ProcessThread_Render(std::shared_ptr<Thread_SharedData>& shared, int taskIndex) = 0;
 	virtual std::shared_ptr<Thread_InitParam> Create_Thread_InitParam(int id) { return std::make_shared<Thread_InitParam>(); }
 	virtual std::shared_ptr<Thread_SharedData> Create_Thread_SharedData() { return std::make_shared<Thread_SharedData>(); }
 
 private:
 
-	void ProcessThread(std::shared_ptr<Thread_InitParam> param);
+	/*!
+		Result of a render pass.
+		Passed from the worker thread finishing the pass to the main thread.
+	*/
+	struct PassResult
+	{
+		int pass;
+		double elapsed;
+		std::string savedImagePath;		// Path of the image requested to be saved, or empty
+	};
+
+	void InitializeWorker(int threadIndex);
+	void SubmitTask(int pass, int taskIndex);
+	void ProcessTask(int pass, int taskIndex, int threadIndex);
+	void FinishPass(int pass);
+	std::string ImagePath(double elapsed);
 
 protected:
 
 	std::shared_ptr<RendererConfig> commonConfig;
 
+	// The thread pool is created first since it is used for loading the scene
+	std::unique_ptr<TaskScheduler> scheduler;
 	std::unique_ptr<Image> image;
 	std::unique_ptr<Scene> scene;
 
-	SyncQueue<Task> queue;
-	std::vector<std::shared_ptr<Thread_SharedData>> threadSharedData;
-
-	int finishedTasks;
-	std::mutex taskFinishedMutex;
-	std::condition_variable taskFinished;
+	std::unique_ptr<ImageWriter> imageWriter;
+	std::vector<std::shared_ptr<Thread_SharedData>> threadSharedData;	// Indexed by the worker thread
 
-	int waitingThreads;
-	std::mutex taskSyncMutex;
-	std::condition_variable taskSync;
+	// Render passes in flight
+	// A task of pass N submits the task of pass N + 1 with the same index when it finishes,
+	// so the tasks of the next pass are queued before the pass drains.
+	// Pass N + 2 is started after pass N is finished, so at most two passes are in flight
+	// and the per-pass data is indexed by pass % 2.
+	int numRenderTasks;
+	std::unique_ptr<Image> passImages[2];		// Contributions of the passes, merged to the image when the pass is finished
+	std::atomic<int> remainingTasks[2];
+	std::atomic<int> lastPass;					// Last pass to be rendered; the tasks of the later passes are skipped
+	std::atomic<int> numInFlightTasks;			// Number of the submitted tasks not yet finished
+	std::mutex passMutex;
+	int numFinalizedPasses;						// Passes are finished in order
+	bool completedPasses[2];					// All tasks of the pass are finished, but the pass is not finished yet
+	int startablePass;							// Last pass whose tasks can be started
+	std::vector<int> pendingTasks;				// Tasks waiting for the next pass to be startable
+
+	// Modified only by the task finishing the pass.
+	int pass;									// Pass being finished
+	double nextImageSaveTime;
+	int totalImageSaves;
+	std::vector<double> imageSavePixelWeights;
+	std::string timeStamp;
+	std::chrono::high_resolution_clock::time_point renderStart;
+
+	// Results of the passes for the main thread
+	std::queue<PassResult> passResults;
+	bool renderFinished;
+	std::mutex passFinishedMutex;
+	std::condition_variable passFinished;
 
 };
 
@@ -2,6 +2,7 @@
 #define __HINATA_CORE_SAMPLER_H__
 
 #include "common.h"
+#include "math.h"
 #include <memory>
 
 HINATA_NAMESPACE_BEGIN
@@ -16,13 +17,37 @@ public:
 	virtual double Next() = 0;
 	virtual std::shared_ptr<Random> Rng() = 0;
 
+	/*!
+		Start a sample of a pixel.
+		Low-discrepancy samplers generate the index-th point of the sequence of the pixel
+		from the first dimension. Ignored by the pseudo-random samplers.
+		\param pixel Pixel coordinates.
+		\param index Index of the sample in the pixel.
+	*/
+	virtual void StartSample(const Vec2i& pixel, long long index) {}
+
+	/*!
+		Set the dimension of the next number.
+		Used to assign fixed dimensions to the parts of a path,
+		so that a dimension is used for the same purpose in all samples.
+		Ignored by the pseudo-random samplers.
+		\param dimension Dimension.
+	*/
+	virtual void SetDimension(int dimension) {}
+
 };
 
+/*!
+	Random sampler.
+	Pulls the random numbers from the generator in batches,
+	so the numbers are generated with the bulk (SIMD) path of the generator.
+*/
 class RandomSampler : public Sampler
 {
 public:
 
 	RandomSampler();
+	RandomSampler(const std::shared_ptr<Random>& rng);
 
 public:
 
@@ -31,7 +56,11 @@ public:
 
 private:
 
+	static const int BatchSize = 64;
+
 	std::shared_ptr<Random> rng;
+	double batch[BatchSize];
+	int batchIndex;				// Index of the next number in the batch
 
 };
 
@@ -3,6 +3,8 @@
 
 #include "common.h"
 #include "math.h"
+#include "distribution.h"
+#include "lightbvh.h"
 #include <memory>
 
 HINATA_NAMESPACE_BEGIN
@@ -41,40 +43,98 @@ public:
 	*/
 	virtual bool Intersect(Ray& ray, Intersection& isect) = 0;
 
+	/*!
+		Occlusion query.
+		The function checks if the ray hits anything in the scene
+		within the range of the ray, e.g., for shadow rays.
+		The query terminates on the first hit found
+		and no information on the hit point is computed.
+		\param ray Ray.
+		\retval true Occluded.
+		\retval false Not occluded.
+	*/
+	virtual bool Occluded(const Ray& ray) = 0;
+
 	/*!
 		Get camera.
 		Get main camera of the scene.
 		We note that only one camera is allowed to exist.
 	*/
-	std::shared_ptr<PerspectiveCamera> Camera() { return camera; }
+	const std::shared_ptr<PerspectiveCamera>& Camera() const { return camera; }
 
 	/*!
 		Sample light sources.
+		Lights are chosen in proportion to their power with an alias table.
 		We Note that given sample can be reused.
+		The returned light is owned by the scene.
 	*/
-	void SampleLight(double& u, std::shared_ptr<AreaLight>& light, double& pdf);
+	void SampleLight(double& u, AreaLight*& light, double& pdf);
 
 	/*!
 		Evaluate light selection PDF.
-		Discrete PDF of selecting a light from the scene.
+		Discrete PDF of selecting the light from the scene.
+		\param light Light of the scene.
+		\return Evaluated value.
+	*/
+	double LightSelectionPdf(const AreaLight* light) const;
+
+	/*!
+		Sample a triangle of the light sources for a shading point.
+		Triangles are chosen with the light BVH according to
+		the position and the orientation of the shading point.
+		We Note that given sample can be reused.
+		The returned light is owned by the scene.
+		\param p Shading point.
+		\param n Shading normal.
+		\param u Sample.
+		\param light Sampled light.
+		\param triangle Index of the sampled triangle in the light.
+		\param pdf Discrete PDF of the triangle.
+		\retval true Sampled.
+		\retval false No light contributes to the shading point.
+	*/
+	bool SampleLight(const Vec3d& p, const Vec3d& n, double& u, AreaLight*& light, int& triangle, double& pdf);
+
+	/*!
+		Evaluate light selection PDF for a shading point.
+		Discrete PDF of selecting the triangle of the light with SampleLight
+		for the same shading point and normal.
+		\param p Shading point.
+		\param n Shading normal.
+		\param light Light of the scene.
+		\param triangle Index of the triangle in the light.
 		\return Evaluated value.
 	*/
-	double LightSelectionPdf()
-	{
-		return 1.0 / (double)lights.size();
-	}
+	double LightSelectionPdf(const Vec3d& p, const Vec3d& n, const AreaLight* light, int triangle) const;
+
+	/*!
+		Get the number of the area lights.
+		\return Number of the lights.
+	*/
+	int NumLights() const { return (int)lights.size(); }
 
 	/*!
 		Get environment light.
 		\return Environment light.
 	*/
-	std::shared_ptr<EnvironmentLight> GetEnvironmentLight() { return environmentLight; }
+	const std::shared_ptr<EnvironmentLight>& GetEnvironmentLight() const { return environmentLight; }
+
+protected:
+
+	/*!
+		Initialize the distributions of the light selection.
+		Builds the power-based distribution and the light BVH.
+		Must be called after all lights are initialized.
+	*/
+	void InitializeLightDistribution();
 
 protected:
 
 	std::shared_ptr<PerspectiveCamera> camera;
 	std::vector<std::shared_ptr<AreaLight>> lights;
 	std::shared_ptr<EnvironmentLight> environmentLight;
+	AliasTable lightDistribution;
+	LightBVH lightBVH;
 
 };
 
@@ -3,6 +3,7 @@
 
 #include "common.h"
 #include "math.h"
+#include "bvh.h"
 #include <vector>
 #include <boost/shared_ptr.hpp>
 #include <boost/serialization/serialization.hpp>
@@ -10,6 +11,8 @@
 #include <boost/serialization/string.hpp>
 #include <boost/serialization/vector.hpp>
 #include <boost/serialization/shared_ptr.hpp>
+#include <boost/serialization/array.hpp>
+#include <boost/serialization/version.hpp>
 
 // Serialization for vectors and matrices
 namespace boost
@@ -58,6 +61,22 @@ namespace serialization
 		ar & boost::serialization::make_nvp("v3", m[3]);
 	}
 
+	template <class Archive>
+	void serialize(Archive& ar, hinata::AABB& b, unsigned int version)
+	{
+		ar & boost::serialization::make_nvp("min", b.min);
+		ar & boost::serialization::make_nvp("max", b.max);
+	}
+
+	template <class Archive>
+	void serialize(Archive& ar, hinata::QBVHNode& node, unsigned int version)
+	{
+		ar & boost::serialization::make_nvp("boundMin", boost::serialization::make_array(&node.boundMin[0][0], 12));
+		ar & boost::serialization::make_nvp("boundMax", boost::serialization::make_array(&node.boundMax[0][0], 12));
+		ar & boost::serialization::make_nvp("child", boost::serialization::make_array(node.child, 4));
+		ar & boost::serialization::make_nvp("numPrimitives", boost::serialization::make_array(node.numPrimitives, 4));
+	}
+
 }
 }
 
@@ -183,6 +202,30 @@ private:
 
 };
 
+/*!
+	BVH cache.
+	BVH of a mesh built in advance by the scene converter.
+	The BVH is used only if the hash matches the content of the mesh,
+	otherwise the BVH is rebuilt on loading.
+*/
+struct SceneDataElement_MeshBVH
+{
+
+	unsigned long long hash;	// Hash of the geometry of the mesh
+	BVH bvh;
+
+private:
+
+	friend class boost::serialization::access;
+	template <class Archive>
+	void serialize(Archive& ar, unsigned int version)
+	{
+		ar & BOOST_SERIALIZATION_NVP(hash);
+		ar & BOOST_SERIALIZATION_NVP(bvh);
+	}
+
+};
+
 struct SceneData
 {
 
@@ -191,6 +234,7 @@ struct SceneData
 	std::vector<boost::shared_ptr<SceneDataElement_TriangleMesh>> meshes;
 	std::vector<boost::shared_ptr<SceneDataElement_Material>> materials;
 	std::vector<boost::shared_ptr<SceneDataElement_Primitive>> primitives;
+	std::vector<boost::shared_ptr<SceneDataElement_MeshBVH>> meshBVHs;		// BVH cache for each mesh (optional)
 
 private:
 
@@ -203,10 +247,18 @@ private:
 		ar & BOOST_SERIALIZATION_NVP(meshes);
 		ar & BOOST_SERIALIZATION_NVP(materials);
 		ar & BOOST_SERIALIZATION_NVP(primitives);
+
+		// BVH cache is available from version 1
+		if (version >= 1)
+		{
+			ar & BOOST_SERIALIZATION_NVP(meshBVHs);
+		}
 	}
 
 };
 
 HINATA_NAMESPACE_END
 
+BOOST_CLASS_VERSION(hinata::SceneData, 1)
+
 #endif // __HINATA_CORE_SCENE_DATA_H__
\ No newline at end of file
@@ -0,0 +1,128 @@
+#ifndef __HINATA_CORE_SCENE_FILE_H__
+#define __HINATA_CORE_SCENE_FILE_H__
+
+#include "common.h"
+#include "math.h"
+#include "constarray.h"
+#include <string>
+#include <boost/shared_ptr.hpp>
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+
+HINATA_NAMESPACE_BEGIN
+
+struct SceneData;
+struct SceneFileMeshEntry;
+struct SceneFileBVHEntry;
+class BVH;
+class TaskScheduler;
+
+/*!
+	Memory-mapped scene file.
+	Versioned binary container of the scene data, which consists of
+		- Header (magic, version, byte order and element sizes)
+		- Mesh table (offset and number of elements of each mesh attribute, hash of the mesh)
+		- BVH table (optional, offset and number of elements of the BVH cache of each mesh)
+		- Mesh attributes and BVH caches as raw arrays aligned to 64 bytes
+		- Metadata (boost binary archive of SceneData without the mesh attributes and BVH caches)
+	The file is mapped to memory on loading and the mesh attributes and the BVH caches
+	are used directly from the mapping without parsing or copying.
+	Only the small metadata is deserialized.
+	The layout is little-endian and the byte order is checked on loading.
+	The whole file is mapped at once, so the scene files larger than
+	the address space of 32-bit processes (around 1-2 GB) require the x64 build.
+*/
+class SceneFile
+{
+public:
+
+	/*!
+		Constructor.
+		Maps the scene file to memory and loads the metadata.
+		\param path Path to the scene file.
+	*/
+	SceneFile(const std::string& path);
+
+private:
+
+	SceneFile(const SceneFile&);
+	void operator=(const SceneFile&);
+
+public:
+
+	/*!
+		Get the metadata.
+		Mesh attributes in the returned scene data are empty,
+		which are accessed with Positions, Normals, Texcoords, and Faces.
+	*/
+	boost::shared_ptr<SceneData> Data() const { return sceneData; }
+
+	/*!
+		Mesh attributes.
+		The returned arrays refer to the mapped memory,
+		so the scene file must outlive them.
+		\param meshIndex Index of the mesh.
+	*/
+	ConstArray<Vec3d> Positions(int meshIndex) const;
+	ConstArray<Vec3d> Normals(int meshIndex) const;
+	ConstArray<Vec2d> Texcoords(int meshIndex) const;
+	ConstArray<Vec3i> Faces(int meshIndex) const;
+
+	/*!
+		Get the BVH cache of a mesh.
+		The nodes and the primitive indices of the BVH refer to the mapped memory,
+		so the scene file must outlive the BVH.
+		The cache is valid only if the mesh is not changed after the cache is built,
+		which is checked with the hashes stored in the file.
+		\param meshIndex Index of the mesh.
+		\param bvh BVH set from the cache.
+		\retval true The valid cache is found.
+		\retval false No cache for the mesh.
+	*/
+	bool MeshBVH(int meshIndex, BVH& bvh) const;
+
+	/*!
+		Check the face indices of a mesh against the number of the vertex attributes.
+		Not checked on mapping, since the check reads all faces of the mesh.
+		The faces are processed in parallel with the thread pool.
+		\param meshIndex Index of the mesh.
+		\param scheduler Thread pool used for the check.
+	*/
+	void CheckFaces(int meshIndex, TaskScheduler& scheduler) const;
+
+public:
+
+	/*!
+		Save the scene data as the scene file.
+		\param path Path to the scene file.
+		\param sceneData Scene data.
+	*/
+	static void Save(const std::string& path, const boost::shared_ptr<SceneData>& sceneData);
+
+	/*!
+		Check if the file is the scene file.
+		Only checks the magic number, so that the old scene files
+		serialized directly with boost archive can be distinguished.
+		\param path Path to the file.
+	*/
+	static bool IsSceneFile(const std::string& path);
+
+private:
+
+	template <typename T>
+	ConstArray<T> MappedArray(unsigned long long offset, unsigned long long count) const;
+	const SceneFileMeshEntry& MeshEntry(int meshIndex) const;
+	const SceneFileBVHEntry* BVHEntry(int meshIndex) const;
+
+private:
+
+	boost::interprocess::file_mapping mapping;
+	boost::interprocess::mapped_region region;
+	boost::shared_ptr<SceneData> sceneData;
+	std::string path;
+
+};
+
+HINATA_NAMESPACE_END
+
+#endif // __HINATA_CORE_SCENE_FILE_H__
\ No newline at end of file
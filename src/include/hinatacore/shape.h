@@ -35,6 +35,18 @@ private:
 public:
 
 	virtual bool Intersect(Ray& ray, Intersection& isect) = 0;
+	virtual bool Intersect(const Ray& ray) = 0;
+
+	/*!
+		Fill in the surface information of the hit point.
+		Used for the hit found without the shape, e.g., with precomputed triangles.
+		\param ray Ray.
+		\param t Distance to the hit point.
+		\param b Barycentric coordinates of the hit point (only for triangles).
+		\param isect Intersection data.
+	*/
+	virtual void FillIntersection(const Ray& ray, double t, const Vec2d& b, Intersection& isect) = 0;
+
 	virtual void SamplePosition(ShapePositionSampleRecord& record, const Mat4d& transform) = 0;
 	virtual double Area(const Mat4d& transform) = 0;
 	virtual AABB Bound(const Mat4d& transform) = 0;
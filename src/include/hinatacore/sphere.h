@@ -19,6 +19,8 @@ public:
 public:
 
 	bool Intersect(Ray& ray, Intersection& isect);
+	bool Intersect(const Ray& ray);
+	void FillIntersection(const Ray& ray, double t, const Vec2d& b, Intersection& isect);
 	void SamplePosition(ShapePositionSampleRecord& record, const Mat4d& transform);
 	double Area(const Mat4d& transform);
 	AABB Bound(const Mat4d& transform);
@@ -0,0 +1,116 @@
+#ifndef __HINATA_CORE_TASK_SCHEDULER_H__
+#define __HINATA_CORE_TASK_SCHEDULER_H__
+
+#include "common.h"
+#include <vector>
+#include <deque>
+#include <memory>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+
+HINATA_NAMESPACE_BEGIN
+
+/*!
+	Work-stealing task scheduler.
+	Thread pool where each worker thread has its own task deque.
+	A worker processes the tasks in its own deque from the back (LIFO),
+	and when the deque is empty, steals a task from the front (FIFO) of the other deques,
+	so that the workers are not idle while there are tasks left in the pool.
+	There is no barrier between tasks; dependent work is expressed as continuations,
+	i.e., the task which completes a group of tasks submits the next tasks by itself.
+	The pool is shared by the whole process, e.g., the BVH build and the preprocessing of the renderers
+	use the same workers as the render passes through ParallelFor.
+*/
+class TaskScheduler
+{
+public:
+
+	/*!
+		Task.
+		The argument is the index of the worker thread processing the task.
+	*/
+	typedef std::function<void (int)> Task;
+
+public:
+
+	/*!
+		Constructor.
+		Creates the worker threads.
+		\param numThreads Number of worker threads.
+	*/
+	TaskScheduler(int numThreads);
+
+	/*!
+		Destructor.
+		Stops the worker threads. Tasks not started yet are discarded.
+	*/
+	~TaskScheduler();
+
+private:
+
+	TaskScheduler(const TaskScheduler&);
+	TaskScheduler(TaskScheduler&&);
+	void operator=(const TaskScheduler&);
+	void operator=(TaskScheduler&&);
+
+public:
+
+	/*!
+		Submit a task.
+		A task submitted from a worker thread is pushed to the worker's own deque,
+		so the continuations run on the same worker while the data is in its cache
+		and the other workers steal them only when they are idle.
+		Tasks submitted from the other threads are distributed over the deques in round-robin order.
+		Thread-safe, can be called from the tasks.
+		\param task Task.
+	*/
+	void Submit(const Task& task);
+
+	/*!
+		Process [begin, end) in parallel and wait for the completion.
+		The range is divided into numChunks chunks and
+		func(chunkIndex, chunkBegin, chunkEnd) is called once for each chunk.
+		The calling thread also processes the chunks, and the other chunks are claimed by the tasks
+		submitted to the pool, so a chunk is never waiting in a deque while the caller waits.
+		Therefore the function can be nested in the chunks or in the tasks, e.g., the recursive BVH build.
+		\param numChunks Number of chunks.
+		\param begin Beginning of the range.
+		\param end End of the range.
+		\param func Function processing a chunk.
+	*/
+	void ParallelFor(int numChunks, int begin, int end, const std::function<void (int, int, int)>& func);
+
+	int NumThreads() const { return (int)workers.size(); }
+
+private:
+
+	struct Worker
+	{
+		std::deque<Task> tasks;
+		std::mutex mutex;
+	};
+
+	void Process(int threadIndex);
+	bool Pop(int threadIndex, Task& task);
+	bool Steal(int threadIndex, Task& task);
+	int CurrentThreadIndex() const;
+
+private:
+
+	std::vector<std::unique_ptr<Worker>> workers;
+	std::vector<std::thread> threads;
+
+	std::atomic<int> numQueuedTasks;		// Number of tasks in the deques
+	std::atomic<unsigned int> nextWorker;	// Deque for the next submitted task
+	bool done;
+	std::mutex sleepMutex;
+	std::condition_variable wakeUp;
+
+};
+
+HINATA_NAMESPACE_END
+
+#endif // __HINATA_CORE_TASK_SCHEDULER_H__
\ No newline at end of file
@@ -2,16 +2,22 @@
 #define __HINATA_CORE_TRIANGLE_H__
 
 #include "shape.h"
+#include "constarray.h"
 #include <memory>
 
 HINATA_NAMESPACE_BEGIN
 
+/*!
+	Triangle mesh.
+	Attributes are either owned by the mesh
+	or refer to the memory-mapped scene file.
+*/
 struct TriangleMesh
 {
-	std::vector<Vec3d> positions;
-	std::vector<Vec3d> normals;
-	std::vector<Vec2d> texcoords;
-	//std::vector<int> indices;
+	ConstArray<Vec3d> positions;
+	ConstArray<Vec3d> normals;
+	ConstArray<Vec2d> texcoords;
+	ConstArray<Vec3i> faces;	// Indices for each face
 	bool oneSided;
 };
 
@@ -24,10 +30,27 @@ public:
 public:
 
 	bool Intersect( Ray& ray, Intersection& isect );
+	bool Intersect( const Ray& ray );
+	void FillIntersection(const Ray& ray, double t, const Vec2d& b, Intersection& isect);
 	void SamplePosition(ShapePositionSampleRecord& record, const Mat4d& transform);
 	double Area(const Mat4d& transform);
 	AABB Bound(const Mat4d& transform);
 	Vec3d Position(int i, const Mat4d& transform);
+	bool OneSided() { return mesh->oneSided; }
+
+public:
+
+	/*!
+		Fill in the surface information of the hit point on a face of the mesh.
+		Used for the meshes referred without Triangle objects, e.g., in BVHScene.
+		\param mesh Triangle mesh.
+		\param face Indices of the vertices of the face.
+		\param ray Ray in mesh space.
+		\param t Distance to the hit point.
+		\param b Barycentric coordinates of the hit point.
+		\param isect Intersection data.
+	*/
+	static void FillIntersection(const TriangleMesh& mesh, const Vec3i& face, const Ray& ray, double t, const Vec2d& b, Intersection& isect);
 
 private:
 
@@ -1,5 +1,6 @@
 #include <hinatacore/pssmltrenderer.h>
 //#include <hinatacore/ptrenderer.h>
+//#include <hinatacore/bptrenderer.h>
 #include <iostream>
 #include <memory>
 
@@ -9,10 +10,12 @@ int main(int argc, char** argv)
 	{
 		auto config = std::make_shared<hinata::PSSMLTRendererConfig>();
 		//auto config = std::make_shared<hinata::PTRendererConfig>();
+		//auto config = std::make_shared<hinata::BPTRendererConfig>();
 		if (config->ProcessArgs(argc, argv))
 		{
 			hinata::PSSMLTRenderer(config).Render();
 			//hinata::PTRenderer(config).Render();
+			//hinata::BPTRenderer(config).Render();
 		}
 	}
 	catch (const std::exception& e)
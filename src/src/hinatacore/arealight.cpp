@@ -1,73 +1,59 @@
 #include "pch.h"
 #include <hinatacore/arealight.h>
-#include <hinatacore/primitive.h>
-#include <hinatacore/shape.h>
 #include <hinatacore/renderutils.h>
 
 HINATA_NAMESPACE_BEGIN
 
 AreaLight::AreaLight( const Vec3d& L )
 	: L(L)
+	, area(0)
+	, index(0)
 {
 
 }
 
-void AreaLight::AddPrimitive( const std::shared_ptr<Primitive>& primitive )
+void AreaLight::AddTriangle( const Vec3d& p1, const Vec3d& p2, const Vec3d& p3 )
 {
-	primitives.push_back(primitive);
+	positions.push_back(p1);
+	positions.push_back(p2);
+	positions.push_back(p3);
 }
 
 void AreaLight::Initialize()
 {
-	// Create CDF
-	primitiveAreaCdf.clear();
-	primitiveAreaCdf.push_back(0);
+	// Areas of the triangles
+	triangleAreas.clear();
+	area = 0;
 
-	for (auto& primitive : primitives)
+	for (size_t i = 0; i < positions.size(); i += 3)
 	{
-		primitiveAreaCdf.push_back(primitiveAreaCdf.back() + primitive->Area());
+		auto& p1 = positions[i];
+		auto& p2 = positions[i+1];
+		auto& p3 = positions[i+2];
+		triangleAreas.push_back(0.5 * Math::Length(Math::Cross(p2 - p1, p3 - p1)));
+		area += triangleAreas.back();
 	}
 
-	// Normalize
-	area = primitiveAreaCdf.back();
-	for (double& v : primitiveAreaCdf)
-	{
-		v /= area;
-	}
+	triangleDistribution.Build(triangleAreas);
 
 	power = L * Pi * area;
 }
 
 Vec3d AreaLight::SampleAndEvaluate( SampleRecord& sampleRecord )
 {
-	Vec2d ps(sampleRecord.positionSample);
-
-	// Choose a shape according to the area
-	int idx =
-		Math::Clamp(
-		(int)(std::upper_bound(primitiveAreaCdf.begin(), primitiveAreaCdf.end(), ps.y) - primitiveAreaCdf.begin() - 1),
-		0, (int)primitiveAreaCdf.size() - 2);
-
-	// Reuse sample
-	ps.y = (ps.y - primitiveAreaCdf[idx]) / (primitiveAreaCdf[idx+1] - primitiveAreaCdf[idx]);
-
 	// Sample position
 	// Note: pdf is not used (eliminated in transformation)
-	ShapePositionSampleRecord psr;
-	psr.sample = ps;
-	primitives[idx]->SamplePosition(psr);
+	SampleTriangle(sampleRecord.positionSample, sampleRecord.p, sampleRecord.n);
 
 	// Sample direction
 	auto localDir = RenderUtils::CosineSampleHemisphere(sampleRecord.directionSample);
 
 	Vec3d s, t;
-	RenderUtils::CreateCoordinateSystem(psr.n, s, t);
+	RenderUtils::CreateCoordinateSystem(sampleRecord.n, s, t);
 
-	auto localToWorld = Mat3d(s, t, psr.n);
+	auto localToWorld = Mat3d(s, t, sampleRecord.n);
 
 	sampleRecord.d = localToWorld * localDir;
-	sampleRecord.p = psr.p;
-	sampleRecord.n = psr.n;
 	sampleRecord.pdf = PdfPosition() * PdfDirection(sampleRecord.d, sampleRecord.n);
 
 	// Return value is
@@ -86,25 +72,37 @@ Vec3d AreaLight::SampleAndEvaluate( SampleRecord& sampleRecord )
 
 void AreaLight::SamplePosition( SampleRecord& sampleRecord )
 {
-	Vec2d ps(sampleRecord.positionSample);
+	SampleTriangle(sampleRecord.positionSample, sampleRecord.p, sampleRecord.n);
+	sampleRecord.pdf = PdfPosition();
+}
 
-	// Choose a shape according to the area
-	int idx =
-		Math::Clamp(
-		(int)(std::upper_bound(primitiveAreaCdf.begin(), primitiveAreaCdf.end(), ps.y) - primitiveAreaCdf.begin() - 1),
-		0, (int)primitiveAreaCdf.size() - 2);
+void AreaLight::SamplePosition( int triangle, SampleRecord& sampleRecord )
+{
+	SampleTriangle(triangle, sampleRecord.positionSample, sampleRecord.p, sampleRecord.n);
+	sampleRecord.pdf = PdfPosition(triangle);
+}
+
+void AreaLight::SampleTriangle( const Vec2d& positionSample, Vec3d& p, Vec3d& n )
+{
+	Vec2d ps(positionSample);
 
-	// Reuse sample
-	ps.y = (ps.y - primitiveAreaCdf[idx]) / (primitiveAreaCdf[idx+1] - primitiveAreaCdf[idx]);
+	// Choose a triangle according to the area
+	// The sample is reused for the position in the triangle.
+	int idx = triangleDistribution.Sample(ps.y);
 
+	SampleTriangle(idx, ps, p, n);
+}
+
+void AreaLight::SampleTriangle( int triangle, const Vec2d& positionSample, Vec3d& p, Vec3d& n )
+{
 	// Sample position
-	ShapePositionSampleRecord psr;
-	psr.sample = ps;
-	primitives[idx]->SamplePosition(psr);
+	auto& p1 = positions[3*triangle];
+	auto& p2 = positions[3*triangle+1];
+	auto& p3 = positions[3*triangle+2];
 
-	sampleRecord.p = psr.p;
-	sampleRecord.n = psr.n;
-	sampleRecord.pdf = PdfPosition();
+	auto b = RenderUtils::UniformSampleTriangle(positionSample);
+	p = p1 * (1.0 - b.x - b.y) + p2 * b.x + p3 * b.y;
+	n = Math::Normalize(Math::Cross(p2 - p1, p3 - p1));
 }
 
 Vec3d AreaLight::EvaluateCos( const Vec3d& d, const Vec3d& n )
@@ -0,0 +1,640 @@
+#include "pch.h"
+#include <hinatacore/bptrenderer.h>
+#include <hinatacore/ray.h>
+#include <hinatacore/random.h>
+#include <hinatacore/sampler.h>
+#include <hinatacore/scene.h>
+#include <hinatacore/perspectivecamera.h>
+#include <hinatacore/arealight.h>
+#include <hinatacore/environmentlight.h>
+#include <hinatacore/bsdf.h>
+#include <hinatacore/renderutils.h>
+#include <hinatacore/image.h>
+
+namespace
+{
+
+	// Zero PDFs (delta vertices) are replaced by one in the ratios of the PDFs
+	HINATA_FORCE_INLINE double Remap0(double v)
+	{
+		return v != 0 ? v : 1;
+	}
+
+}
+
+HINATA_NAMESPACE_BEGIN
+
+BPTRendererConfig::BPTRendererConfig()
+{
+	appName = "bpt";
+	samplePerPixel = 1;
+	tileSize = 64;
+	rrDepth = 3;
+	splatBufferSize = 4096;
+}
+
+void BPTRendererConfig::DefineOptions( boost::program_options::options_description& opt )
+{
+	namespace po = boost::program_options;
+
+	opt.add_options()
+		("sample-per-pixel", po::value<int>(), "Sample per pixel in a pass")
+		("tile-size", po::value<int>(), "Width and height of the tile rendered by a task")
+		("rr-depth", po::value<int>(), "Depth to enable RR for path termination")
+		("splat-buffer-size", po::value<int>(), "Number of splats buffered per thread before accumulated to the image");
+}
+
+void BPTRendererConfig::ParseOptions( boost::program_options::variables_map& vm )
+{
+	if (vm.count("sample-per-pixel"))
+		samplePerPixel = Math::Max(1, vm["sample-per-pixel"].as<int>());
+	if (vm.count("tile-size"))
+		tileSize = Math::Max(1, vm["tile-size"].as<int>());
+	if (vm.count("rr-depth"))
+		rrDepth = vm["rr-depth"].as<int>();
+	if (vm.count("splat-buffer-size"))
+		splatBufferSize = vm["splat-buffer-size"].as<int>();
+}
+
+// --------------------------------------------------------------------------------
+
+BPTRenderer::BPTRenderer( const std::shared_ptr<BPTRendererConfig>& config )
+	: Renderer(config)
+	, config(config)
+{
+
+}
+
+void BPTRenderer::Preprocess()
+{
+	numSamplesPerPixel = 0;
+}
+
+void BPTRenderer::RenderPassFinished()
+{
+	numSamplesPerPixel += config->samplePerPixel;
+}
+
+double BPTRenderer::ImageSaveWeight()
+{
+	// The number of the light subpaths is the same as the camera subpaths,
+	// so the splats are normalized with the same weight.
+	return 1.0 / numSamplesPerPixel;
+}
+
+int BPTRenderer::NumRenderTasks()
+{
+	int numTilesY = (config->height + config->tileSize - 1) / config->tileSize;
+	return NumTilesX() * numTilesY;
+}
+
+int BPTRenderer::NumTilesX()
+{
+	return (config->width + config->tileSize - 1) / config->tileSize;
+}
+
+std::shared_ptr<BPTRenderer::Thread_SharedData> BPTRenderer::Create_Thread_SharedData()
+{
+	return std::make_shared<BPT_Thread_SharedData>();
+}
+
+void BPTRenderer::InitializeThread( std::shared_ptr<Thread_InitParam>& param, std::shared_ptr<Thread_SharedData>& s )
+{
+	auto shared = std::dynamic_pointer_cast<BPT_Thread_SharedData>(s);
+	shared->sampler = std::make_shared<RandomSampler>(shared->rng);
+	shared->splats = std::make_shared<SplatBuffer>(*shared->image, config->splatBufferSize);
+}
+
+void BPTRenderer::ProcessThread_Render( std::shared_ptr<Thread_SharedData>& s, int taskIndex )
+{
+	auto shared = std::dynamic_pointer_cast<BPT_Thread_SharedData>(s);
+
+	// Contributions are accumulated to the image of the pass
+	shared->splats->SetImage(*shared->image);
+
+	// Region of the tile
+	int tileX = taskIndex % NumTilesX() * config->tileSize;
+	int tileY = taskIndex / NumTilesX() * config->tileSize;
+	int tileWidth = Math::Min(config->tileSize, config->width - tileX);
+	int tileHeight = Math::Min(config->tileSize, config->height - tileY);
+
+	shared->tile.assign(tileWidth * tileHeight, Vec3d());
+
+	auto& sampler = *shared->sampler;
+
+	for (int y = 0; y < tileHeight; y++)
+	{
+		for (int x = 0; x < tileWidth; x++)
+		{
+			for (int i = 0; i < config->samplePerPixel; i++)
+			{
+				Vec2d rasterPos(
+					(tileX + x + sampler.Next()) / config->width,
+					(tileY + y + sampler.Next()) / config->height);
+
+				shared->tile[y * tileWidth + x] += RenderSample(*shared, rasterPos);
+			}
+		}
+	}
+
+	// The splats of the other threads may be written to the tile,
+	// so the tile is also accumulated through the splat buffer which locks the image.
+	for (int y = 0; y < tileHeight; y++)
+	{
+		for (int x = 0; x < tileWidth; x++)
+		{
+			shared->splats->Splat(tileX + x, tileY + y, shared->tile[y * tileWidth + x]);
+		}
+	}
+
+	shared->splats->Flush();
+}
+
+// --------------------------------------------------------------------------------
+
+Vec3d BPTRenderer::RenderSample( BPT_Thread_SharedData& shared, const Vec2d& rasterPos )
+{
+	auto& sampler = *shared.sampler;
+	auto& camera = scene->Camera();
+	auto& cameraSubpath = shared.cameraSubpath;
+	auto& lightSubpath = shared.lightSubpath;
+
+	cameraSubpath.clear();
+	lightSubpath.clear();
+
+	Vec3d L;
+
+	// Camera subpath
+	{
+		Ray ray;
+		double pdf;
+		auto We = camera->SampleAndEvaluate(rasterPos, ray, pdf);
+
+		PathVertex v;
+		v.type = PathVertexType::Camera;
+		v.throughput = Vec3d(1.0);
+		v.isect.p = ray.o;
+		v.isect.bsdf = nullptr;
+		v.isect.light = nullptr;
+		v.isect.rayEpsilon = 0;
+		v.delta = false;
+		v.pdfFwd = 1.0;
+		v.pdfRev = 0;
+		cameraSubpath.push_back(v);
+
+		L += RandomWalk(ray, We, pdf, false, sampler, cameraSubpath);
+	}
+
+	// Light subpath
+	if (scene->NumLights() > 0)
+	{
+		double u = sampler.Next();
+		AreaLight* light;
+		double selectionPdf;
+		scene->SampleLight(u, light, selectionPdf);
+
+		AreaLight::SampleRecord record;
+		record.positionSample = Vec2d(sampler.Next(), sampler.Next());
+		record.directionSample = Vec2d(sampler.Next(), sampler.Next());
+		auto power = light->SampleAndEvaluate(record);
+
+		PathVertex v;
+		v.type = PathVertexType::Light;
+		v.isect.p = record.p;
+		v.isect.gn = record.n;
+		v.isect.bsdf = nullptr;
+		v.isect.light = light;
+		v.delta = false;
+		v.pdfFwd = selectionPdf * light->PdfPosition();
+		v.pdfRev = 0;
+
+		// L_e is evaluated in the connections
+		v.throughput = Vec3d(1.0 / v.pdfFwd);
+
+		// The point is not found by a ray, so the epsilon is taken
+		// as if the point were hit by a ray from the camera
+		v.isect.rayEpsilon = 1e-5 * Math::Length(record.p - camera->Position());
+
+		lightSubpath.push_back(v);
+
+		Ray ray;
+		ray.o = record.p;
+		ray.d = record.d;
+		ray.minT = v.isect.rayEpsilon;
+		ray.maxT = Inf;
+
+		RandomWalk(ray, power / selectionPdf, light->PdfDirection(record.d, record.n), true, sampler, lightSubpath);
+	}
+
+	// Evaluate all strategies.
+	// Strategies with t = 1 connect to the camera and contribute to the other pixels.
+	int numCameraVertices = (int)cameraSubpath.size();
+	int numLightVertices = (int)lightSubpath.size();
+
+	for (int t = 1; t <= numCameraVertices; t++)
+	{
+		for (int s = 0; s <= numLightVertices; s++)
+		{
+			if (s + t < 2)
+			{
+				continue;
+			}
+
+			Vec2d splatPos;
+			auto C = Connect(shared, s, t, splatPos);
+
+			if (C == Vec3d())
+			{
+				continue;
+			}
+
+			if (t == 1)
+			{
+				int x = Math::Clamp((int)(splatPos.x * config->width), 0, config->width - 1);
+				int y = Math::Clamp((int)(splatPos.y * config->height), 0, config->height - 1);
+				shared.splats->Splat(x, y, C);
+			}
+			else
+			{
+				L += C;
+			}
+		}
+	}
+
+	return L;
+}
+
+Vec3d BPTRenderer::RandomWalk( Ray& ray, Vec3d throughput, double pdf, bool adjoint, RandomSampler& sampler, std::vector<PathVertex>& subpath )
+{
+	Vec3d L;
+	int depth = 0;
+
+	auto& envLight = scene->GetEnvironmentLight();
+
+	while (true)
+	{
+		PathVertex v;
+
+		// Check intersection
+		if (!scene->Intersect(ray, v.isect))
+		{
+			// Only the camera subpaths can sample the environment light,
+			// so the contribution is not weighted.
+			if (!adjoint && envLight != nullptr)
+			{
+				L += throughput * envLight->Evaluate(-ray.d);
+			}
+
+			break;
+		}
+
+		v.type = PathVertexType::Surface;
+		v.throughput = throughput;
+		v.wi = -ray.d;
+		v.delta = false;
+		v.pdfFwd = ConvertDensity(pdf, subpath.back(), v);
+		v.pdfRev = 0;
+		subpath.push_back(v);
+
+		auto& curr = subpath.back();
+		auto& prev = subpath[subpath.size() - 2];
+
+		// ----------------------------------------------------------------------
+
+		// Sample BSDF
+		auto* bsdf = curr.isect.bsdf;
+
+		BSDFSample sample;
+		sample.u = Vec2d(sampler.Next(), sampler.Next());
+		sample.uComponent = sampler.Next();
+
+		BSDFRecord record;
+		record.type = BSDFType::All;
+		record.adjoint = adjoint;
+		record.wi = Math::Normalize(curr.isect.worldToShading * -ray.d);
+
+		auto weight = bsdf->SampleAndEvaluate(record, sample, pdf, curr.isect);
+
+		if (pdf == 0.0 || weight == Vec3d())
+		{
+			break;
+		}
+
+		// PDF of sampling the previous vertex in the reverse direction
+		double pdfRev;
+
+		if ((record.sampledType & BSDFType::Delta) != 0)
+		{
+			curr.delta = true;
+			pdf = 0;
+			pdfRev = 0;
+		}
+		else
+		{
+			BSDFRecord revRecord = record;
+			std::swap(revRecord.wi, revRecord.wo);
+			pdfRev = bsdf->Pdf(revRecord);
+		}
+
+		prev.pdfRev = ConvertDensity(pdfRev, curr, prev);
+
+		// Update throughput
+		throughput *= weight;
+
+		// Setup next ray
+		ray.d = Math::Normalize(curr.isect.shadingToWorld * record.wo);
+		ray.o = curr.isect.p;
+		ray.minT = curr.isect.rayEpsilon;
+		ray.maxT = Inf;
+
+		// ----------------------------------------------------------------------
+
+		if (++depth >= config->rrDepth)
+		{
+			// Russian roulette for path termination
+			double p = std::min(0.5, RenderUtils::Luminance(throughput));
+
+			if (sampler.Next() > p)
+			{
+				break;
+			}
+
+			throughput /= Vec3d(p);
+		}
+	}
+
+	return L;
+}
+
+Vec3d BPTRenderer::Connect( BPT_Thread_SharedData& shared, int s, int t, Vec2d& rasterPos )
+{
+	auto& lightSubpath = shared.lightSubpath;
+	auto& cameraSubpath = shared.cameraSubpath;
+
+	// Vertices with only delta components cannot be connected
+	auto connectible = [](const PathVertex& v)
+	{
+		return v.type != PathVertexType::Surface || (v.isect.bsdf->Type() & ~BSDFType::Delta) != 0;
+	};
+
+	Vec3d C;
+
+	if (s == 0)
+	{
+		// Camera subpath hits a light
+		auto& pt = cameraSubpath[t-1];
+
+		if (pt.type != PathVertexType::Surface || pt.isect.light == nullptr)
+		{
+			return Vec3d();
+		}
+
+		C = pt.throughput * pt.isect.light->Evaluate(pt.wi, pt.isect.gn);
+	}
+	else if (t == 1)
+	{
+		// Light subpath connected to the camera
+		auto& qs = lightSubpath[s-1];
+		auto& z0 = cameraSubpath[0];
+
+		if (!connectible(qs))
+		{
+			return Vec3d();
+		}
+
+		double _;
+		auto We = scene->Camera()->SampleAndEvaluate(qs.isect.p, rasterPos, _);
+
+		if (We == Vec3d())
+		{
+			return Vec3d();
+		}
+
+		C = qs.throughput * EvaluateConnection(qs, z0.isect.p, true) * We;
+
+		if (C == Vec3d() || !Visible(qs, z0))
+		{
+			return Vec3d();
+		}
+	}
+	else
+	{
+		// Connect the end points of the subpaths
+		auto& qs = lightSubpath[s-1];
+		auto& pt = cameraSubpath[t-1];
+
+		if (!connectible(qs) || !connectible(pt))
+		{
+			return Vec3d();
+		}
+
+		double dist2 = Math::Length2(qs.isect.p - pt.isect.p);
+
+		if (dist2 == 0)
+		{
+			return Vec3d();
+		}
+
+		C =
+			qs.throughput * EvaluateConnection(qs, pt.isect.p, true) *
+			EvaluateConnection(pt, qs.isect.p, false) * pt.throughput / dist2;
+
+		if (C == Vec3d() || !Visible(pt, qs))
+		{
+			return Vec3d();
+		}
+	}
+
+	return C * MISWeight(shared, s, t);
+}
+
+double BPTRenderer::MISWeight( BPT_Thread_SharedData& shared, int s, int t )
+{
+	auto& lightSubpath = shared.lightSubpath;
+	auto& cameraSubpath = shared.cameraSubpath;
+
+	// End points of the subpaths and their predecessors
+	auto* qs = s > 0 ? &lightSubpath[s-1] : nullptr;
+	auto* pt = &cameraSubpath[t-1];
+	auto* qsMinus = s > 1 ? &lightSubpath[s-2] : nullptr;
+	auto* ptMinus = t > 1 ? &cameraSubpath[t-2] : nullptr;
+
+	// Keep the values to be restored
+	double qsPdfRev = qs ? qs->pdfRev : 0;
+	double ptPdfRev = pt->pdfRev;
+	double qsMinusPdfRev = qsMinus ? qsMinus->pdfRev : 0;
+	double ptMinusPdfRev = ptMinus ? ptMinus->pdfRev : 0;
+	bool qsDelta = qs ? qs->delta : false;
+	bool ptDelta = pt->delta;
+
+	// The connected vertices are not sampled with delta components
+	pt->delta = false;
+
+	if (qs)
+	{
+		qs->delta = false;
+	}
+
+	// Reverse PDFs of the end points and their predecessors
+	// if the vertices were sampled from the other subpath
+	if (s > 0)
+	{
+		qs->pdfRev = Pdf(*pt, ptMinus, *qs);
+		pt->pdfRev = Pdf(*qs, qsMinus, *pt);
+
+		if (qsMinus)
+		{
+			qsMinus->pdfRev = Pdf(*qs, pt, *qsMinus);
+		}
+
+		if (ptMinus)
+		{
+			ptMinus->pdfRev = Pdf(*pt, qs, *ptMinus);
+		}
+	}
+	else
+	{
+		// pt would be the origin of the light subpath
+		auto* light = pt->isect.light;
+		pt->pdfRev = scene->LightSelectionPdf(light) * light->PdfPosition();
+		ptMinus->pdfRev = ConvertDensity(light->PdfDirection(Math::Normalize(ptMinus->isect.p - pt->isect.p), pt->isect.gn), *pt, *ptMinus);
+	}
+
+	// Sum of the ratios of the PDFs of the other strategies to the current one.
+	// The strategies connecting at delta vertices are skipped.
+	double sumRi = 0;
+
+	double ri = 1;
+	for (int i = t - 1; i > 0; i--)
+	{
+		ri *= Remap0(cameraSubpath[i].pdfRev) / Remap0(cameraSubpath[i].pdfFwd);
+
+		if (!cameraSubpath[i].delta && !cameraSubpath[i-1].delta)
+		{
+			sumRi += ri;
+		}
+	}
+
+	ri = 1;
+	for (int i = s - 1; i >= 0; i--)
+	{
+		ri *= Remap0(lightSubpath[i].pdfRev) / Remap0(lightSubpath[i].pdfFwd);
+
+		// Area lights are not delta lights
+		bool deltaPrev = i > 0 ? lightSubpath[i-1].delta : false;
+
+		if (!lightSubpath[i].delta && !deltaPrev)
+		{
+			sumRi += ri;
+		}
+	}
+
+	// Restore
+	if (qs)
+	{
+		qs->pdfRev = qsPdfRev;
+		qs->delta = qsDelta;
+	}
+
+	if (qsMinus)
+	{
+		qsMinus->pdfRev = qsMinusPdfRev;
+	}
+
+	if (ptMinus)
+	{
+		ptMinus->pdfRev = ptMinusPdfRev;
+	}
+
+	pt->pdfRev = ptPdfRev;
+	pt->delta = ptDelta;
+
+	// Balance heuristic
+	return 1.0 / (1.0 + sumRi);
+}
+
+Vec3d BPTRenderer::EvaluateConnection( PathVertex& v, const Vec3d& target, bool adjoint )
+{
+	auto d = Math::Normalize(target - v.isect.p);
+
+	if (v.type == PathVertexType::Light)
+	{
+		return v.isect.light->Evaluate(d, v.isect.gn) * Math::Max(0.0, Math::Dot(d, v.isect.gn));
+	}
+
+	if (v.type == PathVertexType::Surface)
+	{
+		BSDFRecord record;
+		record.type = BSDFType::All;
+		record.adjoint = adjoint;
+		record.wi = Math::Normalize(v.isect.worldToShading * v.wi);
+		record.wo = Math::Normalize(v.isect.worldToShading * d);
+
+		// Evaluate BSDF (with cosine term)
+		return v.isect.bsdf->Evaluate(record, v.isect);
+	}
+
+	// The camera is connected with SampleAndEvaluate
+	return Vec3d();
+}
+
+double BPTRenderer::Pdf( PathVertex& v, const PathVertex* prev, const PathVertex& next )
+{
+	auto d = Math::Normalize(next.isect.p - v.isect.p);
+	double pdf;
+
+	if (v.type == PathVertexType::Camera)
+	{
+		pdf = scene->Camera()->PdfDirection(d);
+	}
+	else if (v.type == PathVertexType::Light)
+	{
+		pdf = v.isect.light->PdfDirection(d, v.isect.gn);
+	}
+	else
+	{
+		BSDFRecord record;
+		record.type = BSDFType::All;
+		record.adjoint = false;
+		record.wi = Math::Normalize(v.isect.worldToShading * Math::Normalize(prev->isect.p - v.isect.p));
+		record.wo = Math::Normalize(v.isect.worldToShading * d);
+		pdf = v.isect.bsdf->Pdf(record);
+	}
+
+	return ConvertDensity(pdf, v, next);
+}
+
+double BPTRenderer::ConvertDensity( double pdf, const PathVertex& from, const PathVertex& to )
+{
+	auto d = to.isect.p - from.isect.p;
+	double dist2 = Math::Length2(d);
+
+	if (dist2 == 0)
+	{
+		return 0;
+	}
+
+	// The camera has no surface, so there is no cosine term
+	if (to.type != PathVertexType::Camera)
+	{
+		pdf *= Math::Abs(Math::Dot(to.isect.gn, d)) / std::sqrt(dist2);
+	}
+
+	return pdf / dist2;
+}
+
+bool BPTRenderer::Visible( const PathVertex& v1, const PathVertex& v2 )
+{
+	auto d = v2.isect.p - v1.isect.p;
+	double dist = Math::Length(d);
+
+	Ray shadowRay;
+	shadowRay.o = v1.isect.p;
+	shadowRay.d = d / dist;
+	shadowRay.minT = v1.isect.rayEpsilon;
+	shadowRay.maxT = dist * (1.0 - Eps);
+
+	return !scene->Occluded(shadowRay);
+}
+
+HINATA_NAMESPACE_END
\ No newline at end of file
@@ -0,0 +1,560 @@
+#include "pch.h"
+#include <hinatacore/bvh.h>
+#include <hinatacore/taskscheduler.h>
+
+HINATA_NAMESPACE_BEGIN
+
+struct BVHBuildData
+{
+	std::vector<AABB> primitiveBounds;				// Bounds of the primitives
+	std::vector<Vec3d> primitiveBoundCentroids;		// Centroid of the bounds of the primitives
+	std::vector<int> primitiveIndices;				// Indices of the primitives, partitioned in place into the leaf order
+	TaskScheduler* scheduler;						// Thread pool processing the build
+};
+
+// Bucket used for binned SAH
+struct BVHBucket
+{
+
+	BVHBucket()
+		: count(0)
+	{}
+
+	void Add(const AABB& primitiveBound, const Vec3d& centroid)
+	{
+		count++;
+		bound = bound.Union(primitiveBound);
+		centroidBound = centroidBound.Union(centroid);
+	}
+
+	void Merge(const BVHBucket& o)
+	{
+		count += o.count;
+		bound = bound.Union(o.bound);
+		centroidBound = centroidBound.Union(o.centroidBound);
+	}
+
+	int count;				// Number of primitives in the bucket
+	AABB bound;				// Bound of the primitives in the bucket
+	AABB centroidBound;		// Bound of the centroids in the bucket
+
+};
+
+namespace
+{
+
+	// Number of buckets for binned SAH
+	const int NumBuckets = 12;
+
+	// Minimum number of primitives to process binning with multiple threads
+	const int ParallelBinningThreshold = 1 << 16;
+
+	// Minimum number of primitives to build subtrees as separated tasks
+	const int ParallelSubtreeThreshold = 1 << 12;
+
+	HINATA_FORCE_INLINE int BucketIndex(double centroid, double min, double invExtent)
+	{
+		return Math::Clamp((int)((double)NumBuckets * (centroid - min) * invExtent), 0, NumBuckets - 1);
+	}
+
+}
+
+// --------------------------------------------------------------------------------
+
+BVH::BVH()
+	: maxPrimitivesInNode(255)
+	, numBuildThreads(1)
+	, numBuildNodes(0)
+	, sahCost(0.0)
+{
+
+}
+
+void BVH::Build( const std::vector<AABB>& bounds, TaskScheduler& scheduler )
+{
+	numBuildThreads = scheduler.NumThreads();
+
+	// Temporary data for building
+	int numPrimitives = (int)bounds.size();
+
+	BVHBuildData data;
+	data.primitiveBounds = bounds;
+	data.primitiveBoundCentroids.resize(numPrimitives);
+	data.primitiveIndices.resize(numPrimitives);
+	data.scheduler = &scheduler;
+
+	// Bounds of the root node are reduced from the bounds computed for each chunk
+	int numChunks = numBuildThreads;
+	std::vector<AABB> chunkBounds(numChunks);
+	std::vector<AABB> chunkCentroidBounds(numChunks);
+
+	scheduler.ParallelFor(numChunks, 0, numPrimitives, [&](int chunkIndex, int begin, int end)
+	{
+		for (int i = begin; i < end; i++)
+		{
+			// Initial index
+			data.primitiveIndices[i] = i;
+
+			auto& primitiveBound = bounds[i];
+			auto centroid = (primitiveBound.min + primitiveBound.max) * 0.5;
+			data.primitiveBoundCentroids[i] = centroid;
+
+			chunkBounds[chunkIndex] = chunkBounds[chunkIndex].Union(primitiveBound);
+			chunkCentroidBounds[chunkIndex] = chunkCentroidBounds[chunkIndex].Union(centroid);
+		}
+	});
+
+	bound = AABB();
+	AABB centroidBound;
+
+	for (int i = 0; i < numChunks; i++)
+	{
+		bound = bound.Union(chunkBounds[i]);
+		centroidBound = centroidBound.Union(chunkCentroidBounds[i]);
+	}
+
+	// Build binary BVH
+	// Nodes are allocated in depth-first order, and the root node is the first one.
+	BVHNodeArray buildNodes;
+	buildNodes.reserve(2 * numPrimitives + 1);
+	Build(data, buildNodes, 0, numPrimitives, bound, centroidBound, 0);
+
+	numBuildNodes = (int)buildNodes.size();
+	sahCost = EvaluateSAHCost(buildNodes);
+
+	// Collapse into QBVH
+	QBVHNodeArray qbvhNodes;
+	qbvhNodes.reserve(buildNodes.size() / 3 + 1);
+	Collapse(buildNodes, 0, qbvhNodes);
+
+	nodes = ConstArray<QBVHNode, QBVHNodeAllocator>(std::move(qbvhNodes));
+	primitiveIndices = ConstArray<int>(std::move(data.primitiveIndices));
+}
+
+void BVH::Set( ConstArray<QBVHNode, QBVHNodeAllocator>&& nodes, ConstArray<int>&& primitiveIndices, const AABB& bound, int numBuildNodes, double sahCost )
+{
+	this->nodes = std::move(nodes);
+	this->primitiveIndices = std::move(primitiveIndices);
+	this->bound = bound;
+	this->numBuildNodes = numBuildNodes;
+	this->sahCost = sahCost;
+}
+
+bool BVH::Valid( int numBounds ) const
+{
+	if (nodes.empty() || (int)primitiveIndices.size() != numBounds)
+	{
+		return false;
+	}
+
+	for (int index : primitiveIndices)
+	{
+		if (index < 0 || index >= numBounds)
+		{
+			return false;
+		}
+	}
+
+	// Children are allocated after the parent, so the maximum depth of the nodes
+	// is obtained in one pass and the hierarchy cannot have cycles.
+	// The depth is limited as the builder does, which bounds the traversal stack.
+	std::vector<int> depths(nodes.size(), 0);
+
+	for (int i = 0; i < (int)nodes.size(); i++)
+	{
+		const auto& node = nodes[i];
+
+		if (depths[i] >= MaxBuildDepth)
+		{
+			return false;
+		}
+
+		for (int j = 0; j < 4; j++)
+		{
+			int child = node.child[j];
+			int numPrimitives = node.numPrimitives[j];
+
+			if (child < 0)
+			{
+				// Empty child
+				if (child != -1 || numPrimitives != 0)
+				{
+					return false;
+				}
+			}
+			else if (numPrimitives > 0)
+			{
+				// Leaf child
+				if (child > numBounds - numPrimitives)
+				{
+					return false;
+				}
+			}
+			else
+			{
+				// Internal child
+				if (numPrimitives < 0 || child <= i || child >= (int)nodes.size())
+				{
+					return false;
+				}
+
+				depths[child] = Math::Max(depths[child], depths[i] + 1);
+			}
+		}
+	}
+
+	return true;
+}
+
+int BVH::Build( BVHBuildData& data, BVHNodeArray& buildNodes, int begin, int end, const AABB& bound, const AABB& centroidBound, int depth )
+{
+	// Number of primitives in the node
+	int numPrimitives = end - begin;
+
+	// Nodes deeper than the limit are forced to be leaves,
+	// so that the traversal stack cannot overflow.
+	if (numPrimitives <= 1 || depth >= MaxBuildDepth)
+	{
+		// Leaf node
+		return CreateLeafNode(buildNodes, begin, end, bound);
+	}
+
+	// Choose the axis to split
+	int splitAxis = centroidBound.LongestAxis();
+
+	// If the centroid bound according to the split axis
+	// is degenerated, take the node as a leaf.
+	if (centroidBound.min[splitAxis] == centroidBound.max[splitAxis])
+	{
+		return CreateLeafNode(buildNodes, begin, end, bound);
+	}
+
+	// Split primitives using SAH, surface area heuristic.
+
+	// Considering all possible partitions is rather heavy in the computation cost,
+	// so in the application the primitives is separated to some buckets according to the split axis
+	// and reduce the combination of the partitions.
+
+	double centroidMin = centroidBound.min[splitAxis];
+	double invCentroidExtent = 1.0 / (centroidBound.max[splitAxis] - centroidMin);
+
+	// Number of threads available for the node.
+	// Subtrees in the same depth are processed in parallel,
+	// so the threads are divided among them.
+	int numNodeThreads = numBuildThreads >> Math::Min(depth, 30);
+
+	// Create buckets
+	BVHBucket buckets[NumBuckets];
+
+	if (numNodeThreads > 1 && numPrimitives >= ParallelBinningThreshold)
+	{
+		// Each chunk creates its own buckets and they are merged afterwards
+		int numChunks = numNodeThreads;
+		std::vector<BVHBucket> chunkBuckets(numChunks * NumBuckets);
+
+		data.scheduler->ParallelFor(numChunks, begin, end, [&](int chunkIndex, int chunkBegin, int chunkEnd)
+		{
+			auto* localBuckets = &chunkBuckets[chunkIndex * NumBuckets];
+			for (int i = chunkBegin; i < chunkEnd; i++)
+			{
+				int primitiveIndex = data.primitiveIndices[i];
+				auto& centroid = data.primitiveBoundCentroids[primitiveIndex];
+				localBuckets[BucketIndex(centroid[splitAxis], centroidMin, invCentroidExtent)].Add(data.primitiveBounds[primitiveIndex], centroid);
+			}
+		});
+
+		for (int i = 0; i < numChunks; i++)
+		{
+			for (int j = 0; j < NumBuckets; j++)
+			{
+				buckets[j].Merge(chunkBuckets[i * NumBuckets + j]);
+			}
+		}
+	}
+	else
+	{
+		for (int i = begin; i < end; i++)
+		{
+			int primitiveIndex = data.primitiveIndices[i];
+			auto& centroid = data.primitiveBoundCentroids[primitiveIndex];
+			buckets[BucketIndex(centroid[splitAxis], centroidMin, invCentroidExtent)].Add(data.primitiveBounds[primitiveIndex], centroid);
+		}
+	}
+
+	// Compute costs
+	// Note that the number of possible partitions is numBuckets - 1.
+	// The costs are computed with a prefix sweep for [0, i] and a suffix sweep for (i, numBuckets - 1].
+	double costs[NumBuckets - 1];
+	double invBoundArea = 1.0 / bound.SurfaceArea();
+
+	{
+		// Prefix sweep
+		AABB b;
+		int count = 0;
+
+		for (int i = 0; i < NumBuckets - 1; i++)
+		{
+			b = b.Union(buckets[i].bound);
+			count += buckets[i].count;
+			costs[i] = count > 0 ? (double)count * b.SurfaceArea() : 0.0;
+		}
+	}
+
+	{
+		// Suffix sweep
+		AABB b;
+		int count = 0;
+
+		for (int i = NumBuckets - 1; i > 0; i--)
+		{
+			b = b.Union(buckets[i].bound);
+			count += buckets[i].count;
+
+			// Assume the intersection cost is 1 and traversal cost is 1/8.
+			costs[i - 1] = 0.125 + (costs[i - 1] + (count > 0 ? (double)count * b.SurfaceArea() : 0.0)) * invBoundArea;
+		}
+	}
+
+	// Find minimum partition
+	int minCostIdx = 0;
+	double minCost = costs[0];
+
+	for (int i = 1; i < NumBuckets - 1; i++)
+	{
+		if (minCost > costs[i])
+		{
+			minCost = costs[i];
+			minCostIdx = i;
+		}
+	}
+
+	// Partition if the minimum cost is lower than the leaf cost (numPrimitives)
+	// or the current number of primitives is higher than the limit.
+	// Otherwise make leaf node.
+	if (minCost >= (double)numPrimitives && numPrimitives <= maxPrimitivesInNode)
+	{
+		return CreateLeafNode(buildNodes, begin, end, bound);
+	}
+
+	int mid = (int)(std::partition(
+		data.primitiveIndices.begin() + begin,
+		data.primitiveIndices.begin() + end,
+		[&](int i){ return BucketIndex(data.primitiveBoundCentroids[i][splitAxis], centroidMin, invCentroidExtent) <= minCostIdx; })
+		- data.primitiveIndices.begin());
+
+	// Bounds of the children can be obtained from the buckets
+	BVHBucket left, right;
+
+	for (int i = 0; i <= minCostIdx; i++)
+	{
+		left.Merge(buckets[i]);
+	}
+
+	for (int i = minCostIdx + 1; i < NumBuckets; i++)
+	{
+		right.Merge(buckets[i]);
+	}
+
+	// Allocate the internal node before the children
+	// in order to keep depth-first order of the nodes.
+	int nodeIndex = (int)buildNodes.size();
+	buildNodes.push_back(BVHNode());
+
+	int secondChildOffset;
+
+	if (numNodeThreads > 1 && numPrimitives >= ParallelSubtreeThreshold)
+	{
+		// Build the subtrees in parallel.
+		// Each subtree is built into its own node array,
+		// and the arrays are concatenated in depth-first order.
+		BVHNodeArray leftNodes;
+		BVHNodeArray rightNodes;
+
+		data.scheduler->ParallelFor(2, 0, 2, [&](int child, int, int)
+		{
+			if (child == 0)
+			{
+				Build(data, leftNodes, begin, mid, left.bound, left.centroidBound, depth + 1);
+			}
+			else
+			{
+				Build(data, rightNodes, mid, end, right.bound, right.centroidBound, depth + 1);
+			}
+		});
+
+		AppendNodes(buildNodes, leftNodes);
+		secondChildOffset = AppendNodes(buildNodes, rightNodes);
+	}
+	else
+	{
+		Build(data, buildNodes, begin, mid, left.bound, left.centroidBound, depth + 1);
+		secondChildOffset = Build(data, buildNodes, mid, end, right.bound, right.centroidBound, depth + 1);
+	}
+
+	// Note that the reference to the node must be taken after building children
+	// because the node array can be reallocated.
+	auto& node = buildNodes[nodeIndex];
+	node.type = BVHNode::NodeType::Internal;
+	node.bound = bound;
+	node.splitAxis = splitAxis;
+	node.secondChildOffset = secondChildOffset;
+	node.numPrimitives = 0;
+
+	return nodeIndex;
+}
+
+int BVH::CreateLeafNode( BVHNodeArray& buildNodes, int begin, int end, const AABB& bound )
+{
+	int nodeIndex = (int)buildNodes.size();
+	buildNodes.push_back(BVHNode());
+
+	auto& node = buildNodes[nodeIndex];
+	node.type = BVHNode::NodeType::Leaf;
+	node.bound = bound;
+	node.primitiveOffset = begin;
+	node.numPrimitives = end - begin;
+	node.splitAxis = 0;
+
+	return nodeIndex;
+}
+
+int BVH::AppendNodes( BVHNodeArray& buildNodes, const BVHNodeArray& subtreeNodes )
+{
+	// Offsets of the internal nodes are relative to the subtree
+	int base = (int)buildNodes.size();
+
+	for (auto node : subtreeNodes)
+	{
+		if (node.type == BVHNode::NodeType::Internal)
+		{
+			node.secondChildOffset += base;
+		}
+
+		buildNodes.push_back(node);
+	}
+
+	return base;
+}
+
+double BVH::EvaluateSAHCost( const BVHNodeArray& buildNodes )
+{
+	// SAH cost of the binary tree with the same cost model as the builder,
+	// i.e., the intersection cost is 1 and traversal cost is 1/8.
+	double rootArea = buildNodes[0].bound.SurfaceArea();
+	if (rootArea == 0.0)
+	{
+		return 0.0;
+	}
+
+	double invRootArea = 1.0 / rootArea;
+	double cost = 0.0;
+
+	for (auto& node : buildNodes)
+	{
+		double area = node.bound.SurfaceArea() * invRootArea;
+		cost += node.type == BVHNode::NodeType::Leaf
+			? (double)node.numPrimitives * area
+			: 0.125 * area;
+	}
+
+	return cost;
+}
+
+int BVH::Collapse( const BVHNodeArray& buildNodes, int buildNodeIndex, QBVHNodeArray& qbvhNodes )
+{
+	// Gather up to 4 children by repeatedly opening
+	// the internal child with the largest surface area.
+	int children[4];
+	int numChildren = 0;
+
+	const auto& buildNode = buildNodes[buildNodeIndex];
+	if (buildNode.type == BVHNode::NodeType::Leaf)
+	{
+		// Only happens if the root is a leaf
+		children[numChildren++] = buildNodeIndex;
+	}
+	else
+	{
+		children[numChildren++] = buildNodeIndex + 1;
+		children[numChildren++] = buildNode.secondChildOffset;
+
+		while (numChildren < 4)
+		{
+			int openIndex = -1;
+			double maxArea = -1.0;
+
+			for (int i = 0; i < numChildren; i++)
+			{
+				const auto& child = buildNodes[children[i]];
+				if (child.type == BVHNode::NodeType::Internal && child.bound.SurfaceArea() > maxArea)
+				{
+					maxArea = child.bound.SurfaceArea();
+					openIndex = i;
+				}
+			}
+
+			if (openIndex < 0)
+			{
+				break;
+			}
+
+			int opened = children[openIndex];
+			children[openIndex] = opened + 1;
+			children[numChildren++] = buildNodes[opened].secondChildOffset;
+		}
+	}
+
+	// Allocate the node before the children
+	int nodeIndex = (int)qbvhNodes.size();
+	qbvhNodes.push_back(QBVHNode());
+
+	for (int i = 0; i < 4; i++)
+	{
+		int childIndex = -1;
+		int numPrimitives = 0;
+
+		// Empty children have inverted infinite bounds so that they never intersect
+		float boundMin[3] = {  std::numeric_limits<float>::infinity(),  std::numeric_limits<float>::infinity(),  std::numeric_limits<float>::infinity() };
+		float boundMax[3] = { -std::numeric_limits<float>::infinity(), -std::numeric_limits<float>::infinity(), -std::numeric_limits<float>::infinity() };
+
+		if (i < numChildren)
+		{
+			const auto& child = buildNodes[children[i]];
+
+			for (int axis = 0; axis < 3; axis++)
+			{
+				boundMin[axis] = RoundDown(child.bound.min[axis]);
+				boundMax[axis] = RoundUp(child.bound.max[axis]);
+			}
+
+			if (child.type == BVHNode::NodeType::Leaf)
+			{
+				if (child.numPrimitives > 0)
+				{
+					childIndex = child.primitiveOffset;
+					numPrimitives = child.numPrimitives;
+				}
+			}
+			else
+			{
+				childIndex = Collapse(buildNodes, children[i], qbvhNodes);
+			}
+		}
+
+		// Note that the reference to the node must be taken after collapsing children
+		// because the node array can be reallocated.
+		auto& node = qbvhNodes[nodeIndex];
+		node.child[i] = childIndex;
+		node.numPrimitives[i] = numPrimitives;
+
+		for (int axis = 0; axis < 3; axis++)
+		{
+			node.boundMin[axis][i] = boundMin[axis];
+			node.boundMax[axis][i] = boundMax[axis];
+		}
+	}
+
+	return nodeIndex;
+}
+
+HINATA_NAMESPACE_END
\ No newline at end of file
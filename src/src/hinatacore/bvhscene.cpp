@@ -2,7 +2,6 @@
 #include <hinatacore/bvhscene.h>
 #include <hinatacore/ray.h>
 #include <hinatacore/intersection.h>
-#include <hinatacore/primitive.h>
 #include <hinatacore/triangle.h>
 #include <hinatacore/texture.h>
 #include <hinatacore/diffusebsdf.h>
@@ -13,390 +12,456 @@
 #include <hinatacore/environmentlight.h>
 #include <hinatacore/perspectivecamera.h>
 #include <hinatacore/scenedata.h>
+#include <hinatacore/scenefile.h>
+#include <hinatacore/taskscheduler.h>
 #include <boost/archive/binary_oarchive.hpp>
 #include <boost/archive/binary_iarchive.hpp>
 
 HINATA_NAMESPACE_BEGIN
 
-struct BVHNode
+namespace
 {
 
-	enum class NodeType
+	/*!
+		Ray-triangle intersection with the precomputed triangle.
+		Same as Triangle::Intersect but computes only the distance and barycentric coordinates.
+	*/
+	HINATA_FORCE_INLINE bool IntersectTriangle(const BVHTriangle& triangle, const Ray& ray, double& t, Vec2d& b)
 	{
-		Leaf,
-		Internal
-	};
+		// Note that the divisor is same as the dot product of
+		// the geometry normal and -ray.d, which determines the side.
+		auto s1 = Math::Cross(ray.d, triangle.e2);
+		double divisor = Math::Dot(s1, triangle.e1);
 
-	BVHNode(int begin, int end, const AABB& bound)
-		: type(NodeType::Leaf)
-		, begin(begin)
-		, end(end)
-		, bound(bound)
-	{
+		if (divisor == 0.0 || (triangle.oneSided && divisor < 0.0))
+		{
+			return false;
+		}
 
-	}
+		double invDivisor = 1.0 / divisor;
 
-	BVHNode(int splitAxis, const std::shared_ptr<BVHNode>& left, const std::shared_ptr<BVHNode>& right)
-		: type(NodeType::Internal)
-		, splitAxis(splitAxis)
-		, left(left)
-		, right(right)
-	{
-		bound = left->bound.Union(right->bound);
-	}
-
-	NodeType type;
-	AABB bound;
+		// First barycentric coordinate
+		auto d = ray.o - triangle.p1;
+		double b1 = Math::Dot(d, s1) * invDivisor;
 
-	// Leaf node data
-	// Primitives index in [begin, end)
-	int begin, end;
+		if (b1 < 0.0 || b1 > 1.0)
+		{
+			return false;
+		}
 
-	// Internal node data
-	std::shared_ptr<BVHNode> left, right;
-	int splitAxis;
+		// Second barycentric coordinate
+		auto s2 = Math::Cross(d, triangle.e1);
+		double b2 = Math::Dot(ray.d, s2) * invDivisor;
 
-};
+		if (b2 < 0.0 || b1 + b2 > 1.0)
+		{
+			return false;
+		}
 
-struct BVHBuildData
-{
-	std::vector<AABB> primitiveBounds;				// Bounds of the primitives
-	std::vector<Vec3d> primitiveBoundCentroids;		// Centroid of the bounds of the primitives
-};
+		// Intersection point
+		t = Math::Dot(triangle.e2, s2) * invDivisor;
 
-class CompareToBucket
-{
-public:
+		if (t < ray.minT || t > ray.maxT)
+		{
+			return false;
+		}
 
-	CompareToBucket(int splitAxis, int numBuckets, int minCostIdx, const BVHBuildData& data, const AABB& centroidBound)
-		: splitAxis(splitAxis)
-		, numBuckets(numBuckets)
-		, minCostIdx(minCostIdx)
-		, data(data)
-		, centroidBound(centroidBound)
-	{}
+		b = Vec2d(b1, b2);
+		return true;
+	}
 
-	bool operator()(int i) const
+	/*!
+		Transform the ray to the mesh space of the instance.
+		The direction is not normalized, so that the distance to the hit point
+		and the barycentric coordinates are same in both spaces.
+	*/
+	HINATA_FORCE_INLINE Ray TransformRay(const Ray& ray, const Mat4d& worldToLocal)
 	{
-		int bucketIdx = 
-			(int)((double)numBuckets * 
-			((data.primitiveBoundCentroids[i][splitAxis] - centroidBound.min[splitAxis]) /
-			(centroidBound.max[splitAxis] - centroidBound.min[splitAxis])));
-
-		bucketIdx = Math::Min(bucketIdx, numBuckets - 1);
-		return bucketIdx <= minCostIdx;
+		Ray localRay(ray);
+		localRay.o = Vec3d(worldToLocal * Vec4d(ray.o, 1.0));
+		localRay.d = Vec3d(worldToLocal * Vec4d(ray.d, 0.0));
+		return localRay;
 	}
 
-private:
-
-	int splitAxis;
-	int numBuckets;
-	int minCostIdx;
-	const BVHBuildData& data;
-	const AABB& centroidBound;
-
-};
-
-struct BVHTraversalData
-{
-
-	BVHTraversalData(Ray& ray)
-		: ray(ray)
+	/*!
+		Transform the surface information of the hit point from the mesh space of the instance to world space.
+	*/
+	HINATA_FORCE_INLINE void TransformIntersection(const BVHInstance& instance, Intersection& isect)
 	{
-		invRayDir = Vec3d(1.0 / ray.d.x, 1.0 / ray.d.y, 1.0 / ray.d.z);
-		rayDirNegative = Vec3i(ray.d.x < 0.0, ray.d.y < 0.0, ray.d.z < 0.0);
+		if (instance.localToWorld != Mat4d(1.0))
+		{
+			isect.p = Vec3d(instance.localToWorld * Vec4d(isect.p, 1.0));
+			isect.sn = Math::Normalize(instance.normalLocalToWorld * isect.sn);
+			isect.gn = Math::Normalize(instance.normalLocalToWorld * isect.gn);
+			isect.ss = Math::Normalize(Vec3d(instance.localToWorld * Vec4d(isect.ss, 0.0)));
+			isect.st = Math::Normalize(Vec3d(instance.localToWorld * Vec4d(isect.st, 0.0)));
+		}
 	}
 
-	Ray& ray;
-	Vec3i rayDirNegative;	// Each component of the rayDir is negative
-	Vec3d invRayDir;		// Inverse of the rayDir
-
-};
+}
 
 // --------------------------------------------------------------------------------
 
-BVHScene::BVHScene( const std::string& scenePath )
-	: maxPrimitivesInNode(255)
+BVHScene::BVHScene( const std::string& scenePath, TaskScheduler& scheduler )
+	: scheduler(scheduler)
 {
 	LoadPrimitives(scenePath);
 
-	BVHBuildData data;
+	auto buildStart = std::chrono::high_resolution_clock::now();
 
-	for (size_t i = 0; i < primitives.size(); i++)
+	// Build bottom level BVHs
+	// Meshes are shared by the instances, so each BVH is built only once.
+	// BVHs loaded from the BVH cache already have nodes.
+	int numCachedMeshes = 0;
+	for (int i = 0; i < (int)meshes.size(); i++)
 	{
-		// Initial index
-		bvhPrimitiveIndices.push_back((int)i);
-
-		// Temporary data for building
-		AABB& primitiveBound = primitives[i]->Bound();
+		auto& meshBVH = meshBVHs[i];
+		if (meshBVH.bvh.NumNodes() > 0)
+		{
+			numCachedMeshes++;
+		}
+		else
+		{
+			BuildMeshBVH(meshes[i]->positions, meshes[i]->faces, meshBVH.bvh, scheduler);
+		}
 
-		data.primitiveBounds.push_back(primitiveBound);
-		data.primitiveBoundCentroids.push_back((primitiveBound.min + primitiveBound.max) * 0.5);
+		CreateMeshTriangles(i);
 	}
 
-	// Build BVH
-	root = Build(data, 0, (int)primitives.size());
-}
+	// Build top level BVH
+	BuildInstanceBVH();
 
-bool BVHScene::Intersect( Ray& ray, Intersection& isect )
-{
-	BVHTraversalData data(ray);
+	auto buildEnd = std::chrono::high_resolution_clock::now();
+	double buildTime = std::chrono::duration_cast<std::chrono::milliseconds>(buildEnd - buildStart).count() / 1000.0;
+
+	int numTriangles = 0;
+	int numInstancedTriangles = 0;
+	int numMeshNodes = 0;
+	double meshSAHCost = 0.0;
 
-	if (Intersect(root, data, isect))
+	for (auto& meshBVH : meshBVHs)
 	{
-		// Fill in the information in isect
-		// Compute conversion to/from shading coordinates
-		isect.worldToShading = Math::Transpose(Mat3d(isect.ss, isect.st, isect.sn));
-		isect.shadingToWorld = Math::Inverse(isect.worldToShading);
+		numTriangles += meshBVH.bvh.NumPrimitives();
+		numMeshNodes += meshBVH.bvh.NumNodes();
+		meshSAHCost += meshBVH.bvh.SAHCost() * meshBVH.bvh.NumPrimitives();
+	}
 
-		return true;
+	for (auto& instance : instances)
+	{
+		numInstancedTriangles += meshBVHs[instance.meshIndex].bvh.NumPrimitives();
 	}
 
-	return false;
+	std::cerr << (boost::format("BVH build : %.3lf seconds (%d threads), %d meshes (%d from cache, %d triangles, %d QBVH nodes, average SAH cost %.4lf), %d instances (%d instanced triangles, %d QBVH nodes, SAH cost %.4lf)")
+		% buildTime % scheduler.NumThreads()
+		% meshes.size() % numCachedMeshes % numTriangles % numMeshNodes % (numTriangles > 0 ? meshSAHCost / numTriangles : 0.0)
+		% instances.size() % numInstancedTriangles % instanceBVH.NumNodes() % instanceBVH.SAHCost()).str() << std::endl;
 }
 
-bool BVHScene::Intersect( const std::shared_ptr<BVHNode>& node, BVHTraversalData& data, Intersection& isect )
+bool BVHScene::Intersect( Ray& ray, Intersection& isect )
 {
-	bool intersected = false;
+	int hitInstanceIndex = -1;
+	int hitTriangleIndex = -1;
+	Vec2d hitB;
 
-	// Check intersection to the node bound
-	if (Intersect(node->bound, data))
+	// Traverse top level BVH and then bottom level BVH of the intersected instances
+	bool intersected = instanceBVH.Intersect(ray, [&](Ray& ray, int i)
 	{
-		if (node->type == BVHNode::NodeType::Leaf)
+		int instanceIndex = instanceBVH.PrimitiveIndex(i);
+		const auto& instance = instances[instanceIndex];
+		const auto& meshBVH = meshBVHs[instance.meshIndex];
+
+		auto localRay = TransformRay(ray, instance.worldToLocal);
+
+		bool instanceIntersected = meshBVH.bvh.Intersect(localRay, [&](Ray& localRay, int j)
 		{
-			// Leaf node
-			// Intersection with the primitives hold in the node
-			for (int i = node->begin; i < node->end; i++)
+			double t;
+			Vec2d b;
+
+			if (!IntersectTriangle(meshBVH.triangles[j], localRay, t, b))
 			{
-				std::shared_ptr<Primitive>& primitive = primitives[bvhPrimitiveIndices[i]];
-				if (primitive->Intersect(data.ray, isect))
-				{
-					intersected = true;
-					isect.primitive = primitive;
-				}
+				return false;
 			}
-		}
-		else
+
+			hitInstanceIndex = instanceIndex;
+			hitTriangleIndex = j;
+			hitB = b;
+			localRay.maxT = t;
+
+			return true;
+		});
+
+		if (instanceIntersected)
 		{
-			// Internal node
-			// Traverse the right node first if the ray direction according to the
-			// split axis is negative.
-			if (data.rayDirNegative[node->splitAxis])
-			{
-				intersected |= Intersect(node->right, data, isect);
-				intersected |= Intersect(node->left, data, isect);
-			}
-			else
-			{
-				intersected |= Intersect(node->left, data, isect);
-				intersected |= Intersect(node->right, data, isect);
-			}
+			ray.maxT = localRay.maxT;
 		}
+
+		return instanceIntersected;
+	});
+
+	if (!intersected)
+	{
+		return false;
 	}
 
-	return intersected;
+	// Fill in the information in isect only for the closest hit
+	// Distance and barycentric coordinates are same in mesh space.
+	const auto& instance = instances[hitInstanceIndex];
+	const auto& meshBVH = meshBVHs[instance.meshIndex];
+	const auto& mesh = *meshes[instance.meshIndex];
+
+	auto localRay = TransformRay(ray, instance.worldToLocal);
+	Triangle::FillIntersection(mesh, mesh.faces[meshBVH.bvh.PrimitiveIndex(hitTriangleIndex)], localRay, ray.maxT, hitB, isect);
+	TransformIntersection(instance, isect);
+
+	const auto& material = materials[meshBVH.materialIndex];
+	isect.bsdf = std::get<0>(material).get();
+	isect.light = std::get<1>(material).get();
+	isect.lightTriangle = instance.lightTriangleOffset + meshBVH.bvh.PrimitiveIndex(hitTriangleIndex);
+
+	// Compute conversion to/from shading coordinates
+	isect.worldToShading = Math::Transpose(Mat3d(isect.ss, isect.st, isect.sn));
+	isect.shadingToWorld = Math::Inverse(isect.worldToShading);
+
+	return true;
 }
 
-bool BVHScene::Intersect( const AABB& bound, BVHTraversalData& data )
+bool BVHScene::Occluded( const Ray& ray )
 {
-	auto& rayDirNegative = data.rayDirNegative;
-	auto& invRayDir = data.invRayDir;
-	auto& ray = data.ray;
+	return instanceBVH.Occluded(ray, [&](const Ray& ray, int i)
+	{
+		const auto& instance = instances[instanceBVH.PrimitiveIndex(i)];
+		const auto& meshBVH = meshBVHs[instance.meshIndex];
 
-	double tmin =  (bound[    rayDirNegative[0]].x - ray.o.x) * invRayDir.x;
-	double tmax =  (bound[1 - rayDirNegative[0]].x - ray.o.x) * invRayDir.x;
-	double tymin = (bound[    rayDirNegative[1]].y - ray.o.y) * invRayDir.y;
-	double tymax = (bound[1 - rayDirNegative[1]].y - ray.o.y) * invRayDir.y;
+		auto localRay = TransformRay(ray, instance.worldToLocal);
 
-	if ((tmin > tymax) || (tymin > tmax)) return false;
-	if (tymin > tmin) tmin = tymin;
-	if (tymax < tmax) tmax = tymax;
+		return meshBVH.bvh.Occluded(localRay, [&](const Ray& localRay, int j)
+		{
+			double t;
+			Vec2d b;
+			return IntersectTriangle(meshBVH.triangles[j], localRay, t, b);
+		});
+	});
+}
 
-	// Check for ray intersection against z slab
-	double tzmin = (bound[    rayDirNegative[2]].z - ray.o.z) * invRayDir.z;
-	double tzmax = (bound[1 - rayDirNegative[2]].z - ray.o.z) * invRayDir.z;
+void BVHScene::BuildMeshBVH( const ConstArray<Vec3d>& positions, const ConstArray<Vec3i>& faces, BVH& bvh, TaskScheduler& scheduler )
+{
+	// Bounds of the faces in mesh space
+	int numFaces = (int)faces.size();
+	std::vector<AABB> bounds(numFaces);
 
-	if ((tmin > tzmax) || (tzmin > tmax)) return false;
-	if (tzmin > tmin) tmin = tzmin;
-	if (tzmax < tmax) tmax = tzmax;
+	scheduler.ParallelFor(scheduler.NumThreads(), 0, numFaces, [&](int, int begin, int end)
+	{
+		for (int i = begin; i < end; i++)
+		{
+			auto& face = faces[i];
+			bounds[i] = AABB(positions[face[0]], positions[face[1]]).Union(positions[face[2]]);
+		}
+	});
 
-	return (tmin < ray.maxT) && (tmax > ray.minT);
+	bvh.Build(bounds, scheduler);
 }
 
-std::shared_ptr<BVHNode> BVHScene::Build( const BVHBuildData& data, int begin, int end )
+void BVHScene::CreateMeshTriangles( int meshIndex )
 {
-	std::shared_ptr<BVHNode> node;	
+	auto& mesh = meshes[meshIndex];
+	auto& meshBVH = meshBVHs[meshIndex];
+	int numFaces = (int)mesh->faces.size();
 
-	// Bound of the primitive [begin, end)
-	AABB bound;
+	// Bake triangles in the leaf order
+	meshBVH.triangles.resize(numFaces);
 
-	for (int i = begin; i < end; i++)
+	scheduler.ParallelFor(scheduler.NumThreads(), 0, numFaces, [&](int, int begin, int end)
 	{
-		bound = bound.Union(data.primitiveBounds[bvhPrimitiveIndices[i]]);
-	}
+		for (int i = begin; i < end; i++)
+		{
+			auto& face = mesh->faces[meshBVH.bvh.PrimitiveIndex(i)];
 
-	// Number of primitives in the node
-	int numPrimitives = end - begin;
+			auto& p1 = mesh->positions[face[0]];
+			auto& p2 = mesh->positions[face[1]];
+			auto& p3 = mesh->positions[face[2]];
 
-	if (numPrimitives == 1)
-	{
-		// Leaf node
-		node = std::make_shared<BVHNode>(begin, end, bound);
-	}
-	else
-	{
-		// Internal node
+			auto& triangle = meshBVH.triangles[i];
+			triangle.p1 = p1;
+			triangle.e1 = p2 - p1;
+			triangle.e2 = p3 - p1;
+			triangle.oneSided = mesh->oneSided;
+		}
+	});
+}
 
-		// Choose the axis to split
-		AABB centroidBound;
+void BVHScene::BuildInstanceBVH()
+{
+	// Bounds of the instances in world space,
+	// computed by transforming the corners of the bound of the mesh.
+	int numInstances = (int)instances.size();
+	std::vector<AABB> bounds(numInstances);
 
-		for (int i = begin; i < end; i++)
+	for (int i = 0; i < numInstances; i++)
+	{
+		auto& instance = instances[i];
+		auto& meshBVH = meshBVHs[instance.meshIndex];
+		if (meshBVH.bvh.NumPrimitives() == 0)
 		{
-			centroidBound = centroidBound.Union(data.primitiveBoundCentroids[bvhPrimitiveIndices[i]]);
+			continue;
 		}
 
-		int splitAxis = centroidBound.LongestAxis();
+		auto meshBound = meshBVH.bvh.Bound();
 
-		// If the centroid bound according to the split axis
-		// is degenerated, take the node as a leaf.
-		if (centroidBound.min[splitAxis] == centroidBound.max[splitAxis])
+		for (int j = 0; j < 8; j++)
 		{
-			node = std::make_shared<BVHNode>(begin, end, bound);
+			Vec3d corner(meshBound[j & 1].x, meshBound[(j >> 1) & 1].y, meshBound[(j >> 2) & 1].z);
+			bounds[i] = bounds[i].Union(Vec3d(instance.localToWorld * Vec4d(corner, 1.0)));
 		}
-		else
-		{
-			// Split primitives using SAH, surface area heuristic.
+	}
 
-			// Considering all possible partitions is rather heavy in the computation cost,
-			// so in the application the primitives is separated to some buckets according to the split axis
-			// and reduce the combination of the partitions.
+	instanceBVH.Build(bounds, scheduler);
+}
 
-			const int numBuckets = 12;
+void BVHScene::BuildBVHCache( SceneData& sceneData, TaskScheduler& scheduler )
+{
+	sceneData.meshBVHs.clear();
 
-			AABB bucketPrimitiveBound[numBuckets];
-			int bucketPrimitiveCount[numBuckets] = {0};
+	for (auto& meshData : sceneData.meshes)
+	{
+		auto meshBVH = boost::make_shared<SceneDataElement_MeshBVH>();
+		auto positions = MakeConstArrayView(meshData->positions);
+		auto faces = MakeConstArrayView(meshData->faces);
+		meshBVH->hash = MeshHash(positions, faces);
+		BuildMeshBVH(positions, faces, meshBVH->bvh, scheduler);
+		sceneData.meshBVHs.push_back(meshBVH);
+	}
+}
 
-			// Create buckets
-			for (int i = begin; i < end; i++)
-			{
-				int bucketIdx =
-					(int)((double)numBuckets * 
-						((data.primitiveBoundCentroids[bvhPrimitiveIndices[i]][splitAxis] - centroidBound.min[splitAxis]) /
-						(centroidBound.max[splitAxis] - centroidBound.min[splitAxis])));
+unsigned long long BVHScene::MeshHash( const ConstArray<Vec3d>& positions, const ConstArray<Vec3i>& faces )
+{
+	// FNV-1a hash over the raw memory of the positions and faces, processed in 32-bit words.
+	// Both Vec3d and Vec3i consist of 32-bit aligned elements.
+	const unsigned long long FNVPrime = 1099511628211ULL;
+	unsigned long long hash = 14695981039346656037ULL;
 
-				bucketIdx = Math::Min(bucketIdx, numBuckets - 1);
+	auto update = [&](const void* data, size_t size)
+	{
+		const unsigned int* words = static_cast<const unsigned int*>(data);
+		for (size_t i = 0; i < size / sizeof(unsigned int); i++)
+		{
+			hash ^= words[i];
+			hash *= FNVPrime;
+		}
+	};
 
-				bucketPrimitiveCount[bucketIdx]++;
-				bucketPrimitiveBound[bucketIdx] = bucketPrimitiveBound[bucketIdx].Union(data.primitiveBounds[bvhPrimitiveIndices[i]]);
-			}
+	unsigned long long numPositions = positions.size();
+	unsigned long long numFaces = faces.size();
 
-			// Compute costs
-			// Note that the number of possible partitions is numBuckets - 1.
-			double costs[numBuckets - 1];
+	// Copied since the in-class constant has no definition to take the address of
+	unsigned long long version = BVHCacheVersion;
 
-			// For each partition compute the cost
-			for (int i = 0; i < numBuckets - 1; i++)
-			{
-				AABB b1;
-				AABB b2;
-				int count1 = 0;
-				int count2 = 0;
+	update(&version, sizeof(version));
+	update(&numPositions, sizeof(numPositions));
+	update(&numFaces, sizeof(numFaces));
 
-				// [0, i]
-				for (int j = 0; j <= i; j++)
-				{
-					b1 = b1.Union(bucketPrimitiveBound[j]);
-					count1 += bucketPrimitiveCount[j];
-				}
+	update(positions.data(), sizeof(Vec3d) * positions.size());
+	update(faces.data(), sizeof(Vec3i) * faces.size());
 
-				// (i, numBuckets - 1]
-				for (int j = i + 1; j < numBuckets; j++)
-				{
-					b2 = b2.Union(bucketPrimitiveBound[j]);
-					count2 += bucketPrimitiveCount[j];
-				}
-
-				// Assume the intersection cost is 1 and traversal cost is 1/8.
-				costs[i] = 0.125 + ((double)count1 * b1.SurfaceArea() + (double)count2 * b2.SurfaceArea()) / bound.SurfaceArea();
-			}
+	return hash;
+}
 
-			// Find minimum partition
-			int minCostIdx = 0;
-			double minCost = costs[0];
+void BVHScene::LoadPrimitives( const std::string& scenePath )
+{
+	boost::shared_ptr<SceneData> sceneData;
 
-			for (int i = 1; i < numBuckets - 1; i++)
-			{
-				if (minCost > costs[i])
-				{
-					minCost = costs[i];
-					minCostIdx = i;
-				}
-			}
+	if (SceneFile::IsSceneFile(scenePath))
+	{
+		// Map scene file
+		// Mesh attributes refer to the mapped memory.
+		sceneFile = std::make_shared<SceneFile>(scenePath);
+		sceneData = sceneFile->Data();
 
-			// Partition if the minimum cost is lower than the leaf cost (numPrimitives)
-			// or the current number of primitives is higher than the limit.
-			if (minCost < (double)numPrimitives || numPrimitives > maxPrimitivesInNode)
-			{
-				int mid = (int)(std::partition(&bvhPrimitiveIndices[begin],
-					&bvhPrimitiveIndices[end - 1] + 1, CompareToBucket(splitAxis, numBuckets, minCostIdx, data, centroidBound))
-					- &bvhPrimitiveIndices[0]);
-
-				node = std::make_shared<BVHNode>(
-					splitAxis,
-					Build(data, begin, mid),
-					Build(data, mid, end));
-			}
-			else
-			{
-				// Otherwise make leaf node
-				node = std::make_shared<BVHNode>(begin, end, bound);
-			}
+		for (int i = 0; i < (int)sceneData->meshes.size(); i++)
+		{
+			// Faces are read in parallel, since the check touches all pages of the faces
+			sceneFile->CheckFaces(i, scheduler);
+
+			auto mesh = std::make_shared<TriangleMesh>();
+			mesh->positions = sceneFile->Positions(i);
+			mesh->normals = sceneFile->Normals(i);
+			mesh->texcoords = sceneFile->Texcoords(i);
+			mesh->faces = sceneFile->Faces(i);
+			mesh->oneSided = sceneData->meshes[i]->oneSided;
+			meshes.push_back(mesh);
 		}
 	}
+	else
+	{
+		// Deserialize scene
+		// Old scene files are serialized directly with boost archive.
+		std::ifstream ifs(scenePath, std::ifstream::in | std::ifstream::binary);
 
-	return node;
-}
+		if (!ifs)
+		{
+			throw std::exception(boost::str(
+				boost::format("std::ifstream : %s") % boost::filesystem::path(scenePath).string()).c_str());
+		}
 
-void BVHScene::LoadPrimitives( const std::string& scenePath )
-{
-	// Deserialize scene
-	std::ifstream ifs(scenePath, std::ifstream::in | std::ifstream::binary);
+		try
+		{
+			boost::archive::binary_iarchive ia(ifs);
+			ia & boost::serialization::make_nvp("HinataScene", sceneData);
+		}
+		catch (boost::archive::archive_exception& e)
+		{
+			throw std::exception(boost::str(
+				boost::format("boost::archive::archive_exception : %s") % e.what()).c_str());
+		}
 
-	if (!ifs)
-	{
-		throw std::exception(boost::str(
-			boost::format("std::ifstream : %s") % boost::filesystem::path(scenePath).string()).c_str());
-	}
+		for (auto& meshData : sceneData->meshes)
+		{
+			auto mesh = std::make_shared<TriangleMesh>();
 
-	boost::shared_ptr<SceneData> sceneData;
+			// Move attributes
+			mesh->positions = ConstArray<Vec3d>(std::move(meshData->positions));
+			mesh->normals = ConstArray<Vec3d>(std::move(meshData->normals));
+			mesh->texcoords = ConstArray<Vec2d>(std::move(meshData->texcoords));
+			mesh->faces = ConstArray<Vec3i>(std::move(meshData->faces));
 
-	try
-	{
-		boost::archive::binary_iarchive ia(ifs);
-		ia & boost::serialization::make_nvp("HinataScene", sceneData);
-	}
-	catch (boost::archive::archive_exception& e)
-	{
-		throw std::exception(boost::str(
-			boost::format("boost::archive::archive_exception : %s") % e.what()).c_str());
+			// One-sided?
+			mesh->oneSided = meshData->oneSided;
+
+			meshes.push_back(mesh);
+		}
 	}
 
 	// --------------------------------------------------------------------------------
 
-	// Meshes
-	for (auto& meshData : sceneData->meshes)
-	{
-		auto mesh = std::make_shared<TriangleMesh>();
+	// Material of each mesh
+	meshBVHs.resize(meshes.size());
 
-		// Move attributes
-		mesh->positions = std::move(meshData->positions);
-		mesh->normals = std::move(meshData->normals);
-		mesh->texcoords = std::move(meshData->texcoords);
-
-		// One-sided?
-		mesh->oneSided = meshData->oneSided;
+	for (int i = 0; i < (int)meshes.size(); i++)
+	{
+		meshBVHs[i].materialIndex = sceneData->meshes[i]->materialIndex;
+	}
 
-		meshes.push_back(mesh);
+	// BVH cache
+	// Use the cached BVH only if the mesh is not changed after the cache is built.
+	// The scene file compares the stored hashes and the version of the builder,
+	// and the BVHs refer to the mapped memory.
+	// Old scene files are entirely deserialized, so the hash is computed from the mesh.
+	if (sceneFile != nullptr)
+	{
+		for (int i = 0; i < (int)meshes.size(); i++)
+		{
+			sceneFile->MeshBVH(i, meshBVHs[i].bvh);
+		}
+	}
+	else if (sceneData->meshBVHs.size() == meshes.size())
+	{
+		for (int i = 0; i < (int)meshes.size(); i++)
+		{
+			auto& cache = sceneData->meshBVHs[i];
+			if (cache->hash == MeshHash(meshes[i]->positions, meshes[i]->faces) && cache->bvh.Valid((int)meshes[i]->faces.size()))
+			{
+				meshBVHs[i].bvh = std::move(cache->bvh);
+			}
+		}
 	}
 
 	// Materials
@@ -467,38 +532,40 @@ void BVHScene::LoadPrimitives( const std::string& scenePath )
 		sceneData->camera.viewMatrix,
 		sceneData->camera.projectionMatrix);
 
-	// Primitives
+	// Instances
+	// Each pair of the primitive data and its mesh is an instance of the mesh.
+	// Faces are referred through the mesh, so no objects are created per face.
 	for (auto& primitiveData : sceneData->primitives)
 	{
+		auto worldToLocal = Math::Inverse(primitiveData->transform);
+
 		for (int meshIndex : primitiveData->meshIndices)
 		{
-			auto& meshData = sceneData->meshes[meshIndex];
-			auto& material = materials[meshData->materialIndex];
-
-			auto& bsdf = std::get<0>(material);
-			auto& light = std::get<1>(material);
-
-			for (auto& face : meshData->faces)
+			BVHInstance instance;
+			instance.meshIndex = meshIndex;
+			instance.worldToLocal = worldToLocal;
+			instance.localToWorld = primitiveData->transform;
+			instance.normalLocalToWorld = Mat3d(Math::Transpose(worldToLocal));
+			instance.lightTriangleOffset = 0;
+
+			// Register the faces of emissive meshes to the light in world space
+			// The faces are added in order, so the face index is the offset in the light.
+			auto& light = std::get<1>(materials[meshBVHs[meshIndex].materialIndex]);
+
+			if (light != nullptr)
 			{
-				// Shape
-				auto triangle = std::make_shared<Triangle>(
-					meshes[meshIndex], face[0], face[1], face[2]);
-
-				// Primitive
-				std::shared_ptr<Primitive> primitive;
-
-				if (light != nullptr)
+				instance.lightTriangleOffset = light->NumTriangles();
+				auto& mesh = meshes[meshIndex];
+				for (auto& face : mesh->faces)
 				{
-					primitive = std::make_shared<Primitive>(primitiveData->transform, triangle, bsdf, light);
-					light->AddPrimitive(primitive);
+					light->AddTriangle(
+						Vec3d(instance.localToWorld * Vec4d(mesh->positions[face[0]], 1.0)),
+						Vec3d(instance.localToWorld * Vec4d(mesh->positions[face[1]], 1.0)),
+						Vec3d(instance.localToWorld * Vec4d(mesh->positions[face[2]], 1.0)));
 				}
-				else
-				{
-					primitive = std::make_shared<Primitive>(primitiveData->transform, triangle, bsdf);
-				}
-
-				primitives.push_back(primitive);
 			}
+
+			instances.push_back(instance);
 		}
 	}
 
@@ -513,6 +580,8 @@ void BVHScene::LoadPrimitives( const std::string& scenePath )
 		}
 	}
 
+	InitializeLightDistribution();
+
 	// Setup the environment light
 	// If the path to the environment map is not specified, use constant environment light.
 	auto& envMapData = sceneData->envMap;
@@ -71,40 +71,58 @@ CornellBoxScene::CornellBoxScene( double aspect )
 	//		std::make_shared<DiffuseBSDF>(Vec3d(0.75)),
 	//		light);
 
+	std::vector<Vec3d> positions;
+	positions.push_back(Vec3d( 0.2, 0.9,  0.2));
+	positions.push_back(Vec3d(-0.2, 0.9,  0.2));
+	positions.push_back(Vec3d(-0.2, 0.9, -0.2));
+	positions.push_back(Vec3d( 0.2, 0.9, -0.2));
+
+	std::vector<Vec3d> normals;
+	normals.push_back(Vec3d(0, -1, 0));
+	normals.push_back(Vec3d(0, -1, 0));
+	normals.push_back(Vec3d(0, -1, 0));
+	normals.push_back(Vec3d(0, -1, 0));
+
 	auto mesh = std::make_shared<TriangleMesh>();
-	mesh->positions.push_back(Vec3d( 0.2, 0.9,  0.2));
-	mesh->positions.push_back(Vec3d(-0.2, 0.9,  0.2));
-	mesh->positions.push_back(Vec3d(-0.2, 0.9, -0.2));
-	mesh->positions.push_back(Vec3d( 0.2, 0.9, -0.2));
-	mesh->normals.push_back(Vec3d(0, -1, 0));
-	mesh->normals.push_back(Vec3d(0, -1, 0));
-	mesh->normals.push_back(Vec3d(0, -1, 0));
-	mesh->normals.push_back(Vec3d(0, -1, 0));
+	mesh->positions = ConstArray<Vec3d>(std::move(positions));
+	mesh->normals = ConstArray<Vec3d>(std::move(normals));
+
+	auto lightTransform = Math::Rotate(30.0, Vec3d(0, 0, 1));
 
 	auto lp1 =
 		std::make_shared<Primitive>(
-			Math::Rotate(30.0, Vec3d(0, 0, 1)),
+			lightTransform,
 			std::make_shared<Triangle>(mesh, 0, 1, 3),
 			std::make_shared<DiffuseBSDF>(Vec3d(0.75)),
 			//std::make_shared<DiffuseBSDF>(Vec3d()),
 			light);
 
 	primitives.push_back(lp1);
-	light->AddPrimitive(lp1);
 
 	auto lp2 =
 		std::make_shared<Primitive>(
-			Math::Rotate(30.0, Vec3d(0, 0, 1)),
+			lightTransform,
 			std::make_shared<Triangle>(mesh, 1, 2, 3),
 			std::make_shared<DiffuseBSDF>(Vec3d(0.75)),
 			//std::make_shared<DiffuseBSDF>(Vec3d()),
 			light);
 
+	lp2->SetLightTriangle(1);
 	primitives.push_back(lp2);
-	light->AddPrimitive(lp2);
+
+	// Light keeps the transformed positions of the triangles
+	light->AddTriangle(
+		Vec3d(lightTransform * Vec4d(mesh->positions[0], 1.0)),
+		Vec3d(lightTransform * Vec4d(mesh->positions[1], 1.0)),
+		Vec3d(lightTransform * Vec4d(mesh->positions[3], 1.0)));
+	light->AddTriangle(
+		Vec3d(lightTransform * Vec4d(mesh->positions[1], 1.0)),
+		Vec3d(lightTransform * Vec4d(mesh->positions[2], 1.0)),
+		Vec3d(lightTransform * Vec4d(mesh->positions[3], 1.0)));
 
 	light->Initialize();
 	lights.push_back(light);
+	InitializeLightDistribution();
 
 	// Ball 1
 	primitives.push_back(
@@ -137,7 +155,9 @@ bool CornellBoxScene::Intersect( Ray& ray, Intersection& isect )
 		if (primitive->Intersect(ray, isect))
 		{
 			intersected = true;
-			isect.primitive = primitive;
+			isect.bsdf = primitive->Bsdf().get();
+			isect.light = primitive->Light().get();
+			isect.lightTriangle = primitive->LightTriangle();
 		}
 	}
 
@@ -152,4 +172,17 @@ bool CornellBoxScene::Intersect( Ray& ray, Intersection& isect )
 	return intersected;
 }
 
+bool CornellBoxScene::Occluded( const Ray& ray )
+{
+	for (auto& primitive : primitives)
+	{
+		if (primitive->Intersect(ray))
+		{
+			return true;
+		}
+	}
+
+	return false;
+}
+
 HINATA_NAMESPACE_END
\ No newline at end of file
@@ -0,0 +1,167 @@
+#include "pch.h"
+#include <hinatacore/distribution.h>
+#include <hinatacore/math.h>
+
+HINATA_NAMESPACE_BEGIN
+
+void AliasTable::Build( const std::vector<double>& weights )
+{
+	int n = (int)weights.size();
+
+	bins.assign(n, Bin());
+	pdfs.assign(n, 0.0);
+
+	if (n == 0)
+	{
+		return;
+	}
+
+	double sum = 0;
+	for (double w : weights)
+	{
+		sum += w;
+	}
+
+	for (int i = 0; i < n; i++)
+	{
+		pdfs[i] = sum > 0 ? weights[i] / sum : 1.0 / n;
+	}
+
+	// Scaled probabilities (mean 1) are split into the bins smaller and larger than 1.
+	// A small bin is filled with the excess of a large one.
+	std::vector<double> scaled(n);
+	std::vector<int> small, large;
+
+	for (int i = 0; i < n; i++)
+	{
+		scaled[i] = pdfs[i] * n;
+		(scaled[i] < 1.0 ? small : large).push_back(i);
+	}
+
+	while (!small.empty() && !large.empty())
+	{
+		int s = small.back(); small.pop_back();
+		int l = large.back(); large.pop_back();
+
+		bins[s].q = scaled[s];
+		bins[s].alias = l;
+
+		scaled[l] = (scaled[l] + scaled[s]) - 1.0;
+		(scaled[l] < 1.0 ? small : large).push_back(l);
+	}
+
+	// Remaining bins are full up to the numerical error
+	for (int i : large)
+	{
+		bins[i].q = 1.0;
+		bins[i].alias = i;
+	}
+
+	for (int i : small)
+	{
+		bins[i].q = 1.0;
+		bins[i].alias = i;
+	}
+}
+
+int AliasTable::Sample( double& u ) const
+{
+	int n = (int)bins.size();
+	double x = u * n;
+	int i = std::min((int)x, n - 1);
+	double v = x - i;
+
+	const auto& bin = bins[i];
+
+	if (v < bin.q)
+	{
+		u = std::min(v / bin.q, 1.0 - Eps);
+		return i;
+	}
+
+	u = std::min((v - bin.q) / (1.0 - bin.q), 1.0 - Eps);
+	return bin.alias;
+}
+
+// --------------------------------------------------------------------------------
+
+void PiecewiseConstant1D::Build( const double* f, int n )
+{
+	func.assign(f, f + n);
+	cdf.assign(n + 1, 0.0);
+
+	for (int i = 0; i < n; i++)
+	{
+		cdf[i+1] = cdf[i] + func[i] / n;
+	}
+
+	integral = cdf[n];
+
+	// Normalize
+	for (int i = 1; i <= n; i++)
+	{
+		cdf[i] = integral > 0 ? cdf[i] / integral : (double)i / n;
+	}
+}
+
+double PiecewiseConstant1D::Sample( double u, double& pdf, int& offset ) const
+{
+	int n = (int)func.size();
+
+	// Segment i satisfying cdf[i] <= u < cdf[i+1]
+	// Segments with zero probability are never chosen.
+	int i = Math::Clamp((int)(std::upper_bound(cdf.begin(), cdf.end(), u) - cdf.begin()) - 1, 0, n - 1);
+
+	double du = u - cdf[i];
+	if (cdf[i+1] > cdf[i])
+	{
+		du /= cdf[i+1] - cdf[i];
+	}
+
+	pdf = integral > 0 ? func[i] / integral : 1.0;
+	offset = i;
+
+	return (i + du) / n;
+}
+
+double PiecewiseConstant1D::Pdf( double x ) const
+{
+	int n = (int)func.size();
+	int i = Math::Clamp((int)(x * n), 0, n - 1);
+	return integral > 0 ? func[i] / integral : 1.0;
+}
+
+// --------------------------------------------------------------------------------
+
+void PiecewiseConstant2D::Build( const std::vector<double>& f, int nu, int nv )
+{
+	conditionals.assign(nv, PiecewiseConstant1D());
+	std::vector<double> rowIntegrals(nv);
+
+	for (int v = 0; v < nv; v++)
+	{
+		conditionals[v].Build(&f[v * nu], nu);
+		rowIntegrals[v] = conditionals[v].Integral();
+	}
+
+	marginal.Build(&rowIntegrals[0], nv);
+}
+
+Vec2d PiecewiseConstant2D::Sample( const Vec2d& u, double& pdf ) const
+{
+	int v, _;
+	double pdfV, pdfU;
+	double y = marginal.Sample(u.y, pdfV, v);
+	double x = conditionals[v].Sample(u.x, pdfU, _);
+	pdf = pdfU * pdfV;
+	return Vec2d(x, y);
+}
+
+double PiecewiseConstant2D::Pdf( const Vec2d& p ) const
+{
+	int nv = (int)conditionals.size();
+	int v = Math::Clamp((int)(p.y * nv), 0, nv - 1);
+	return conditionals[v].Pdf(p.x) * marginal.Pdf(p.y);
+}
+
+HINATA_NAMESPACE_END
@@ -1,6 +1,7 @@
 #include "pch.h"
 #include <hinatacore/environmentlight.h>
 #include <hinatacore/image.h>
+#include <hinatacore/renderutils.h>
 
 HINATA_NAMESPACE_BEGIN
 
@@ -10,6 +11,13 @@ ConstantEnvironmentLight::ConstantEnvironmentLight( const Vec3d& Le )
 	
 }
 
+Vec3d ConstantEnvironmentLight::Sample( const Vec2d& u, Vec3d& d, double& pdf )
+{
+	d = -RenderUtils::UniformSampleSphere(u);
+	pdf = Pdf(d);
+	return Le;
+}
+
 // ------------------------------------------------------------------------------------------
 
 BitmapEnvironmentLight::BitmapEnvironmentLight( const std::string& path, double offset, double scale )
@@ -17,16 +25,77 @@ BitmapEnvironmentLight::BitmapEnvironmentLight( const std::string& path, double
 	, scale(scale)
 {
 	image = std::make_shared<Image>(path, true);
+
+	// Distribution over the pixels
+	// Pixels near the poles are weighted less because of the smaller solid angle.
+	int width = image->Width();
+	int height = image->Height();
+	std::vector<double> weights(width * height);
+
+	for (int y = 0; y < height; y++)
+	{
+		double v = (y + 0.5) / height;
+		double sinTheta = std::sin(Pi * v);
+
+		for (int x = 0; x < width; x++)
+		{
+			double u = (x + 0.5) / width;
+			weights[y * width + x] = Math::Max(0.0, RenderUtils::Luminance(image->Evaluate(Vec2d(u, v)))) * sinTheta;
+		}
+	}
+
+	distribution.Build(weights, width, height);
 }
 
 Vec3d BitmapEnvironmentLight::Evaluate( const Vec3d& d )
+{
+	return image->Evaluate(DirectionToUV(d)) * scale;
+}
+
+Vec3d BitmapEnvironmentLight::Sample( const Vec2d& u, Vec3d& d, double& pdf )
+{
+	double uvPdf;
+	auto uv = distribution.Sample(u, uvPdf);
+
+	// Convert the latitude-longitude coordinates to the ray direction.
+	double theta = uv.y * Pi;
+	double phi = (uv.x - offset) * 2.0 * Pi;
+	double sinTheta = std::sin(theta);
+
+	if (uvPdf == 0 || sinTheta <= 0)
+	{
+		pdf = 0;
+		return Vec3d();
+	}
+
+	d = -Vec3d(sinTheta * std::sin(phi), std::cos(theta), -sinTheta * std::cos(phi));
+
+	// Convert to solid angle measure
+	// d\omega = 2\pi^2 \sin{(\theta)} du dv
+	pdf = uvPdf / (2.0 * Pi * Pi * sinTheta);
+
+	return image->Evaluate(uv) * scale;
+}
+
+double BitmapEnvironmentLight::Pdf( const Vec3d& d )
+{
+	double sinTheta = std::sqrt(Math::Max(0.0, 1.0 - d.y * d.y));
+
+	if (sinTheta <= 0)
+	{
+		return 0;
+	}
+
+	return distribution.Pdf(DirectionToUV(d)) / (2.0 * Pi * Pi * sinTheta);
+}
+
+Vec2d BitmapEnvironmentLight::DirectionToUV( const Vec3d& d )
 {
 	// Convert the ray direction to the latitude-longitude coordinates.
 	auto rd = -d;
-	Vec2d uv(
+	return Vec2d(
 		Math::Fract(std::atan2(rd.x, -rd.z) * InvTwoPi + offset),
 		std::acos(Math::Clamp(rd.y, -1.0, 1.0)) * InvPi);
-	return image->Evaluate(uv) * scale;
 }
 
 HINATA_NAMESPACE_END
\ No newline at end of file
@@ -192,6 +192,137 @@ namespace
 
 HINATA_NAMESPACE_BEGIN
 
+namespace
+{
+
+	/*
+		Float to half conversion with round-to-nearest-even.
+		Overflows are converted to infinity, NaNs to quiet NaN,
+		and small values to denormals or zero.
+		The values are assumed to be stored in little-endian.
+	*/
+
+	HINATA_FORCE_INLINE unsigned short FloatToHalf(float v)
+	{
+		const unsigned int F32Infinity = 255 << 23;
+		const unsigned int F16Max = (127 + 16) << 23;
+		const unsigned int DenormMagic = ((127 - 15) + (23 - 10) + 1) << 23;
+
+		unsigned int u;
+		memcpy(&u, &v, sizeof(float));
+
+		unsigned int sign = u & 0x80000000u;
+		u ^= sign;
+
+		unsigned int h;
+		if (u >= F16Max)
+		{
+			// Infinity or NaN
+			h = u > F32Infinity ? 0x7e00 : 0x7c00;
+		}
+		else if (u < (113 << 23))
+		{
+			// Denormal or zero.
+			// Adding the magic number aligns the 10-bit mantissa to the bottom of the float
+			// with the rounding of the floating-point addition.
+			float f, magic;
+			memcpy(&f, &u, sizeof(float));
+			memcpy(&magic, &DenormMagic, sizeof(float));
+			f += magic;
+			memcpy(&u, &f, sizeof(float));
+			h = u - DenormMagic;
+		}
+		else
+		{
+			// Normalized number.
+			// Rebias the exponent and round the mantissa.
+			unsigned int mantissaOdd = (u >> 13) & 1;
+			u += ((unsigned int)(15 - 127) << 23) + 0xfff + mantissaOdd;
+			h = u >> 13;
+		}
+
+		return static_cast<unsigned short>(h | (sign >> 16));
+	}
+
+#ifdef HINATA_USE_SSE
+
+	// Same as the scalar version with the branches replaced by selections
+	HINATA_FORCE_INLINE __m128i FloatToHalf(__m128 v)
+	{
+		const __m128i signMask = _mm_set1_epi32(0x80000000);
+		const __m128i f32Infinity = _mm_set1_epi32(255 << 23);
+		const __m128i f16Max = _mm_set1_epi32((127 + 16) << 23);
+		const __m128i denormMagic = _mm_set1_epi32(((127 - 15) + (23 - 10) + 1) << 23);
+		const __m128i normalMin = _mm_set1_epi32(113 << 23);
+		const __m128i rebias = _mm_set1_epi32((int)(((unsigned int)(15 - 127) << 23) + 0xfff));
+		const __m128i one = _mm_set1_epi32(1);
+
+		__m128i u = _mm_castps_si128(v);
+		__m128i sign = _mm_and_si128(u, signMask);
+		u = _mm_xor_si128(u, sign);
+
+		// The values without the sign can be compared as signed integers
+		__m128i isInfNaN = _mm_cmpgt_epi32(u, _mm_sub_epi32(f16Max, one));
+		__m128i isNaN = _mm_cmpgt_epi32(u, f32Infinity);
+		__m128i isDenorm = _mm_cmplt_epi32(u, normalMin);
+
+		__m128i infNaN = _mm_or_si128(_mm_set1_epi32(0x7c00), _mm_and_si128(isNaN, _mm_set1_epi32(0x200)));
+		__m128i denorm = _mm_sub_epi32(_mm_castps_si128(_mm_add_ps(_mm_castsi128_ps(u), _mm_castsi128_ps(denormMagic))), denormMagic);
+		__m128i mantissaOdd = _mm_and_si128(_mm_srli_epi32(u, 13), one);
+		__m128i normal = _mm_srli_epi32(_mm_add_epi32(_mm_add_epi32(u, rebias), mantissaOdd), 13);
+
+		__m128i h = _mm_or_si128(_mm_and_si128(isDenorm, denorm), _mm_andnot_si128(isDenorm, normal));
+		h = _mm_or_si128(_mm_and_si128(isInfNaN, infNaN), _mm_andnot_si128(isInfNaN, h));
+		h = _mm_or_si128(h, _mm_srli_epi32(sign, 16));
+
+		// Sign-extend the lower 16 bits so that the saturating pack keeps them as they are
+		return _mm_srai_epi32(_mm_slli_epi32(h, 16), 16);
+	}
+
+#endif
+
+	void FloatToHalf(const float* src, unsigned short* dst, int n)
+	{
+		int i = 0;
+
+#ifdef HINATA_USE_SSE
+		for (; i + 8 <= n; i += 8)
+		{
+			__m128i h0 = FloatToHalf(_mm_loadu_ps(src + i));
+			__m128i h1 = FloatToHalf(_mm_loadu_ps(src + i + 4));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_packs_epi32(h0, h1));
+		}
+#endif
+
+		for (; i < n; i++)
+		{
+			dst[i] = FloatToHalf(src[i]);
+		}
+	}
+
+	/*
+		Byte buffer for the OpenEXR header and tiles.
+		All values are stored in little-endian.
+	*/
+	struct ExrBuffer
+	{
+		std::vector<unsigned char> bytes;
+
+		void Append(const void* p, size_t size)
+		{
+			auto* b = reinterpret_cast<const unsigned char*>(p);
+			bytes.insert(bytes.end(), b, b + size);
+		}
+
+		void Byte(unsigned char v) { bytes.push_back(v); }
+		void Int(int v) { Append(&v, sizeof(int)); }
+		void Int64(unsigned long long v) { Append(&v, sizeof(unsigned long long)); }
+		void Float(float v) { Append(&v, sizeof(float)); }
+		void String(const char* s) { Append(s, strlen(s) + 1); }
+	};
+
+}
+
 Image::Image( int width, int height )
 	: width(width)
 	, height(height)
@@ -315,23 +446,63 @@ Vec3d Image::Evaluate(const Vec2d& uv)
 
 void Image::Accumulate(const Vec4i& rect, const std::vector<Vec3d>& v)
 {
-	std::unique_lock<std::mutex> lock(accumColorMutex);
-
 	for (int y = 0; y < rect[3]; y++)
 	{
 		for (int x = 0; x < rect[2]; x++)
 		{
 			int xx = x + rect[0];
 			int yy = y + rect[1];
-			int idx = yy * width + xx;
 
-			data[idx] += v[idx];
+			data[yy * width + xx] += v[y * rect[2] + x];
 		}
 	}
 }
 
+void Image::Accumulate(const std::vector<ImageSplat>& splats)
+{
+	std::unique_lock<std::mutex> lock(accumColorMutex);
+
+	for (auto& splat : splats)
+	{
+		data[splat.index] += splat.L;
+	}
+}
+
+void Image::Accumulate( const Image& src )
+{
+	assert(src.width == width && src.height == height);
+
+	for (size_t i = 0; i < data.size(); i++)
+	{
+		data[i] += src.data[i];
+	}
+}
+
+void Image::Clear()
+{
+	std::fill(data.begin(), data.end(), Vec3d());
+}
+
+void Image::CopyTo(Image& dst) const
+{
+	assert(dst.width == width && dst.height == height);
+	dst.data = data;
+}
+
+void Image::Scale( const std::vector<double>& weights )
+{
+	assert(weights.size() == data.size());
+
+	for (size_t i = 0; i < data.size(); i++)
+	{
+		data[i] *= Vec3d(weights[i]);
+	}
+}
+
 void Image::Save(const std::string& path, double weight)
 {
+	namespace fs = boost::filesystem;
+
 	FILE* fp;
 
 #ifdef HINATA_PLATFORM_WINDOWS
@@ -340,24 +511,242 @@ void Image::Save(const std::string& path, double weight)
 	fp = fopen(path.c_str(), "wb");
 #endif
 
+	if (!fp)
+	{
+		throw std::exception(("fopen : " + path).c_str());
+	}
+
+	auto ext = fs::path(path).extension().string();
+
+	if (ext == ".pfm")
+	{
+		SavePFM(fp, weight);
+	}
+	else if (ext == ".exr")
+	{
+		SaveEXR(fp, weight);
+	}
+	else
+	{
+		SavePPM(fp, weight);
+	}
+
+	fclose(fp);
+}
+
+void Image::SavePPM( FILE* fp, double weight )
+{
+	// Encode the whole image and write it at once
+	std::vector<unsigned char> bytes(width * height * 3);
+	double scale = weight * 255.0;
+
+	for (int y = height - 1; y >= 0; y--)
+	{
+		auto* row = &bytes[(height - 1 - y) * width * 3];
+		const auto* src = &data[y * width];
+
+		for (int x = 0; x < width; x++)
+		{
+			row[3*x  ] = (unsigned char)Math::Clamp(static_cast<int>(src[x].r * scale), 0, 255);
+			row[3*x+1] = (unsigned char)Math::Clamp(static_cast<int>(src[x].g * scale), 0, 255);
+			row[3*x+2] = (unsigned char)Math::Clamp(static_cast<int>(src[x].b * scale), 0, 255);
+		}
+	}
+
 	fprintf(fp, "P6\n");
 	fprintf(fp, "%d %d\n", width, height);
 	fprintf(fp, "255\n");
+	fwrite(&bytes[0], 1, bytes.size(), fp);
+}
+
+void Image::SavePFM( FILE* fp, double weight )
+{
+	// Negative scale means little-endian.
+	// PFM stores the rows from the bottom, which is the order of the image data.
+	fprintf(fp, "PF\n");
+	fprintf(fp, "%d %d\n", width, height);
+	fprintf(fp, "-1.0\n");
+
+	// Encode and write a block of rows at once
+	const int RowsPerBlock = 64;
+	std::vector<float> floats(width * RowsPerBlock * 3);
 
-	for (int y = width - 1; y >= 0; y--)
+	for (int y = 0; y < height; y += RowsPerBlock)
 	{
-		for (int x = 0; x < width; x++)
+		int numRows = Math::Min(RowsPerBlock, height - y);
+		const auto* src = &data[y * width];
+
+		for (int i = 0; i < width * numRows; i++)
 		{
-			int idx = y * width + x;
-			unsigned char color[3];
-			color[0] = Math::Clamp(static_cast<int>(data[idx].r * weight * 255.0), 0, 255);
-			color[1] = Math::Clamp(static_cast<int>(data[idx].g * weight * 255.0), 0, 255);
-			color[2] = Math::Clamp(static_cast<int>(data[idx].b * weight * 255.0), 0, 255);
-			fwrite(color, 1, 3, fp);
+			floats[3*i  ] = static_cast<float>(src[i].r * weight);
+			floats[3*i+1] = static_cast<float>(src[i].g * weight);
+			floats[3*i+2] = static_cast<float>(src[i].b * weight);
 		}
+
+		fwrite(&floats[0], sizeof(float), width * numRows * 3, fp);
 	}
+}
 
-	fclose(fp);
+void Image::SaveEXR( FILE* fp, double weight )
+{
+	// Single-part tiled OpenEXR with HALF channels, no compression, and one level.
+	// Since the tiles are not compressed, the offsets of the tiles are known in advance,
+	// so the header, offset table, and tiles are written in one pass.
+	const int TileSize = 64;
+	const int NumChannels = 3;
+	const char* ChannelNames[NumChannels] = { "B", "G", "R" };	// Sorted by name as required by the format
+	const int ChannelComponents[NumChannels] = { 2, 1, 0 };
+
+	int numTilesX = (width + TileSize - 1) / TileSize;
+	int numTilesY = (height + TileSize - 1) / TileSize;
+
+	// Header
+	ExrBuffer header;
+	header.Int(20000630);					// Magic number
+	header.Int(2 | 0x200);					// Version 2, tiled
+
+	header.String("channels"); header.String("chlist");
+	header.Int(NumChannels * (2 + 16) + 1);
+	for (int c = 0; c < NumChannels; c++)
+	{
+		header.String(ChannelNames[c]);
+		header.Int(1);						// HALF
+		header.Int(0);						// pLinear and reserved
+		header.Int(1);						// xSampling
+		header.Int(1);						// ySampling
+	}
+	header.Byte(0);
+
+	header.String("compression"); header.String("compression");
+	header.Int(1); header.Byte(0);			// NO_COMPRESSION
+
+	header.String("dataWindow"); header.String("box2i");
+	header.Int(16); header.Int(0); header.Int(0); header.Int(width - 1); header.Int(height - 1);
+
+	header.String("displayWindow"); header.String("box2i");
+	header.Int(16); header.Int(0); header.Int(0); header.Int(width - 1); header.Int(height - 1);
+
+	header.String("lineOrder"); header.String("lineOrder");
+	header.Int(1); header.Byte(0);			// INCREASING_Y
+
+	header.String("pixelAspectRatio"); header.String("float");
+	header.Int(4); header.Float(1.0f);
+
+	header.String("screenWindowCenter"); header.String("v2f");
+	header.Int(8); header.Float(0.0f); header.Float(0.0f);
+
+	header.String("screenWindowWidth"); header.String("float");
+	header.Int(4); header.Float(1.0f);
+
+	header.String("tiles"); header.String("tiledesc");
+	header.Int(9); header.Int(TileSize); header.Int(TileSize);
+	header.Byte(0);							// ONE_LEVEL, ROUND_DOWN
+
+	header.Byte(0);							// End of the header
+
+	// Offset table.
+	// Each tile consists of the tile coordinates, level, data size, and pixels.
+	unsigned long long offset = header.bytes.size() + sizeof(unsigned long long) * numTilesX * numTilesY;
+	for (int ty = 0; ty < numTilesY; ty++)
+	{
+		int tileHeight = Math::Min(TileSize, height - ty * TileSize);
+		for (int tx = 0; tx < numTilesX; tx++)
+		{
+			int tileWidth = Math::Min(TileSize, width - tx * TileSize);
+			header.Int64(offset);
+			offset += 5 * sizeof(int) + tileWidth * tileHeight * NumChannels * sizeof(unsigned short);
+		}
+	}
+
+	fwrite(&header.bytes[0], 1, header.bytes.size(), fp);
+
+	// Tiles.
+	// Convert a row of tiles to planar half floats and then write the tiles at once.
+	std::vector<float> floats(width);
+	std::vector<unsigned short> halfs(TileSize * NumChannels * width);
+	ExrBuffer tiles;
+
+	for (int ty = 0; ty < numTilesY; ty++)
+	{
+		int tileHeight = Math::Min(TileSize, height - ty * TileSize);
+
+		for (int i = 0; i < tileHeight; i++)
+		{
+			// Y axis of OpenEXR points downward
+			const auto* src = &data[(height - 1 - (ty * TileSize + i)) * width];
+
+			for (int c = 0; c < NumChannels; c++)
+			{
+				int component = ChannelComponents[c];
+				for (int x = 0; x < width; x++)
+				{
+					floats[x] = static_cast<float>(src[x][component] * weight);
+				}
+
+				FloatToHalf(&floats[0], &halfs[(i * NumChannels + c) * width], width);
+			}
+		}
+
+		tiles.bytes.clear();
+
+		for (int tx = 0; tx < numTilesX; tx++)
+		{
+			int tileWidth = Math::Min(TileSize, width - tx * TileSize);
+
+			tiles.Int(tx);
+			tiles.Int(ty);
+			tiles.Int(0);
+			tiles.Int(0);
+			tiles.Int(tileWidth * tileHeight * NumChannels * (int)sizeof(unsigned short));
+
+			for (int i = 0; i < tileHeight; i++)
+			{
+				for (int c = 0; c < NumChannels; c++)
+				{
+					tiles.Append(&halfs[(i * NumChannels + c) * width + tx * TileSize], tileWidth * sizeof(unsigned short));
+				}
+			}
+		}
+
+		fwrite(&tiles.bytes[0], 1, tiles.bytes.size(), fp);
+	}
+}
+
+// --------------------------------------------------------------------------------
+
+SplatBuffer::SplatBuffer( Image& image, int capacity )
+	: image(&image)
+	, capacity(Math::Max(1, capacity))
+{
+	splats.reserve(this->capacity);
+}
+
+void SplatBuffer::Splat( int x, int y, const Vec3d& L )
+{
+	ImageSplat splat;
+	splat.index = y * image->Width() + x;
+	splat.L = L;
+	splats.push_back(splat);
+
+	if ((int)splats.size() >= capacity)
+	{
+		Flush();
+	}
+}
+
+void SplatBuffer::Flush()
+{
+	if (!splats.empty())
+	{
+		image->Accumulate(splats);
+		splats.clear();
+	}
+}
+
+void SplatBuffer::SetImage( Image& image )
+{
+	Flush();
+	this->image = &image;
 }
 
 HINATA_NAMESPACE_END
\ No newline at end of file
@@ -0,0 +1,96 @@
+#include "pch.h"
+#include <hinatacore/imagewriter.h>
+#include <hinatacore/image.h>
+
+HINATA_NAMESPACE_BEGIN
+
+ImageWriter::ImageWriter( int width, int height )
+	: next(0)
+	, done(false)
+{
+	for (auto& snapshot : snapshots)
+	{
+		snapshot.image.reset(new Image(width, height));
+		snapshot.weight = 0;
+		snapshot.pending = false;
+	}
+
+	thread = std::thread(&ImageWriter::Process, this);
+}
+
+ImageWriter::~ImageWriter()
+{
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		done = true;
+		snapshotPending.notify_all();
+	}
+
+	thread.join();
+}
+
+void ImageWriter::Save( const Image& image, const std::string& path, double weight, const std::vector<double>& pixelWeights )
+{
+	std::unique_lock<std::mutex> lock(mutex);
+
+	// Snapshots are written in the order of the requests starting from snapshots[next].
+	// If it is pending, the other buffer is used unless it is also pending.
+	// If both are pending, snapshots[next] is the first to be written,
+	// and next is flipped to the other pending one, so the order is kept.
+	int index = snapshots[next].pending && !snapshots[1 - next].pending ? 1 - next : next;
+	snapshotWritten.wait(lock, [&]{ return !snapshots[index].pending; });
+
+	auto& snapshot = snapshots[index];
+	image.CopyTo(*snapshot.image);
+	snapshot.path = path;
+	snapshot.weight = weight;
+	snapshot.pixelWeights = pixelWeights;
+	snapshot.pending = true;
+
+	snapshotPending.notify_one();
+}
+
+void ImageWriter::Process()
+{
+	while (true)
+	{
+		Snapshot* snapshot;
+
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			snapshotPending.wait(lock, [this]{ return snapshots[next].pending || done; });
+
+			if (!snapshots[next].pending)
+			{
+				// Done and no pending snapshots
+				break;
+			}
+
+			snapshot = &snapshots[next];
+		}
+
+		// The pending snapshot is not modified until it is marked as written
+		try
+		{
+			if (!snapshot->pixelWeights.empty())
+			{
+				snapshot->image->Scale(snapshot->pixelWeights);
+			}
+
+			snapshot->image->Save(snapshot->path, snapshot->weight);
+		}
+		catch (const std::exception& e)
+		{
+			std::cerr << e.what() << std::endl;
+		}
+
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			snapshot->pending = false;
+			next = 1 - next;
+			snapshotWritten.notify_all();
+		}
+	}
+}
+
+HINATA_NAMESPACE_END
\ No newline at end of file
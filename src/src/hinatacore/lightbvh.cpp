@@ -0,0 +1,378 @@
+#include "pch.h"
+#include <hinatacore/lightbvh.h>
+#include <hinatacore/arealight.h>
+#include <hinatacore/renderutils.h>
+
+namespace
+{
+
+	// Number of buckets for binned SAOH
+	const int NumBuckets = 12;
+
+	// cos(max(0, a - b)) given the sines and cosines of a and b in [0, pi]
+	HINATA_FORCE_INLINE double CosSubClamped(double sinA, double cosA, double sinB, double cosB)
+	{
+		return cosA > cosB ? 1.0 : cosA * cosB + sinA * sinB;
+	}
+
+	// sin(max(0, a - b)) given the sines and cosines of a and b in [0, pi]
+	HINATA_FORCE_INLINE double SinSubClamped(double sinA, double cosA, double sinB, double cosB)
+	{
+		return cosA > cosB ? 0.0 : sinA * cosB - cosA * sinB;
+	}
+
+	HINATA_FORCE_INLINE double SinFromCos(double cosTheta)
+	{
+		return std::sqrt(std::max(0.0, 1.0 - cosTheta * cosTheta));
+	}
+
+}
+
+HINATA_NAMESPACE_BEGIN
+
+void LightBVH::LightBound::Merge( const LightBound& o )
+{
+	if (o.power == 0)
+	{
+		return;
+	}
+
+	if (power == 0)
+	{
+		*this = o;
+		return;
+	}
+
+	bound = bound.Union(o.bound);
+	power += o.power;
+
+	// Smallest cone containing both cones
+	double thetaA = std::acos(Math::Clamp(cosThetaO, -1.0, 1.0));
+	double thetaB = std::acos(Math::Clamp(o.cosThetaO, -1.0, 1.0));
+	double thetaD = std::acos(Math::Clamp(Math::Dot(axis, o.axis), -1.0, 1.0));
+
+	if (Math::Min(thetaD + thetaB, Pi) <= thetaA)
+	{
+		return;
+	}
+
+	if (Math::Min(thetaD + thetaA, Pi) <= thetaB)
+	{
+		axis = o.axis;
+		cosThetaO = o.cosThetaO;
+		return;
+	}
+
+	double thetaO = 0.5 * (thetaA + thetaD + thetaB);
+	auto k = Math::Cross(axis, o.axis);
+
+	if (thetaO >= Pi || Math::Length2(k) == 0)
+	{
+		// Whole sphere
+		cosThetaO = -1;
+		return;
+	}
+
+	// Rotate the axis toward the other one (Rodrigues' formula, k is perpendicular to the axis)
+	double thetaR = thetaO - thetaA;
+	k = Math::Normalize(k);
+	axis = Math::Normalize(axis * std::cos(thetaR) + Math::Cross(k, axis) * std::sin(thetaR));
+	cosThetaO = std::cos(thetaO);
+}
+
+double LightBVH::LightBound::Importance( const Vec3d& p, const Vec3d& n ) const
+{
+	// Bounding sphere of the bound
+	auto center = (bound.min + bound.max) * 0.5;
+	double radius2 = Math::Length2(bound.max - center);
+	double dist2 = Math::Length2(p - center);
+
+	if (dist2 <= radius2)
+	{
+		// The shading point is inside the bound, any direction is possible
+		return power / Math::Max(dist2, radius2);
+	}
+
+	// Angle between the axis and the direction to the shading point
+	auto wi = (p - center) / std::sqrt(dist2);
+	double cosThetaW = Math::Dot(axis, wi);
+	double sinThetaW = SinFromCos(cosThetaW);
+
+	// Half angle subtended by the bound
+	double cosThetaB = std::sqrt(1.0 - radius2 / dist2);
+	double sinThetaB = SinFromCos(cosThetaB);
+
+	// Minimum angle between the emitted directions and the direction to the shading point
+	double sinThetaO = SinFromCos(cosThetaO);
+	double cosThetaX = CosSubClamped(sinThetaW, cosThetaW, sinThetaO, cosThetaO);
+	double sinThetaX = SinSubClamped(sinThetaW, cosThetaW, sinThetaO, cosThetaO);
+	double cosThetaP = CosSubClamped(sinThetaX, cosThetaX, sinThetaB, cosThetaB);
+
+	// Emission of a diffuse light spreads pi/2 around the cone
+	if (cosThetaP <= 0)
+	{
+		return 0;
+	}
+
+	double importance = power * cosThetaP / Math::Max(dist2, radius2);
+
+	if (n != Vec3d())
+	{
+		// Maximum cosine at the receiver
+		// The absolute value is used because the BSDF may transmit.
+		double cosThetaI = Math::Abs(Math::Dot(wi, n));
+		double sinThetaI = SinFromCos(cosThetaI);
+		importance *= CosSubClamped(sinThetaI, cosThetaI, sinThetaB, cosThetaB);
+	}
+
+	return Math::Max(importance, 0.0);
+}
+
+double LightBVH::LightBound::OrientationCost() const
+{
+	// Measure of the solid angle of the emitted directions
+	double thetaO = std::acos(Math::Clamp(cosThetaO, -1.0, 1.0));
+	double thetaW = Math::Min(thetaO + 0.5 * Pi, Pi);
+	double sinThetaO = SinFromCos(cosThetaO);
+	return
+		2.0 * Pi * (1.0 - cosThetaO) +
+		0.5 * Pi * (2.0 * thetaW * sinThetaO - std::cos(thetaO - 2.0 * thetaW) - 2.0 * thetaO * sinThetaO + cosThetaO);
+}
+
+void LightBVH::Build( const std::vector<std::shared_ptr<AreaLight>>& lights )
+{
+	nodes.clear();
+	leafOffsets.assign(lights.size(), 0);
+	leaves.clear();
+
+	std::vector<LightPrimitive> primitives;
+
+	for (auto& light : lights)
+	{
+		leafOffsets[light->Index()] = (int)leaves.size();
+		double luminance = RenderUtils::Luminance(light->Radiance());
+
+		for (int i = 0; i < light->NumTriangles(); i++)
+		{
+			leaves.push_back(-1);
+
+			const auto& p1 = light->Position(i, 0);
+			const auto& p2 = light->Position(i, 1);
+			const auto& p3 = light->Position(i, 2);
+
+			auto cross = Math::Cross(p2 - p1, p3 - p1);
+			double power = luminance * Pi * 0.5 * Math::Length(cross);
+
+			if (power <= 0)
+			{
+				continue;
+			}
+
+			LightPrimitive primitive;
+			primitive.lightBound.bound = AABB(p1, p2).Union(p3);
+			primitive.lightBound.axis = Math::Normalize(cross);
+			primitive.lightBound.cosThetaO = 1;
+			primitive.lightBound.power = power;
+			primitive.centroid = (p1 + p2 + p3) / 3.0;
+			primitive.lightIndex = light->Index();
+			primitive.triangle = i;
+			primitives.push_back(primitive);
+		}
+	}
+
+	if (!primitives.empty())
+	{
+		nodes.reserve(2 * primitives.size() - 1);
+		Build(primitives, 0, (int)primitives.size(), -1);
+	}
+}
+
+int LightBVH::Build( std::vector<LightPrimitive>& primitives, int begin, int end, int parent )
+{
+	int index = (int)nodes.size();
+	nodes.push_back(Node());
+
+	LightBound lightBound;
+	AABB centroidBound;
+
+	for (int i = begin; i < end; i++)
+	{
+		lightBound.Merge(primitives[i].lightBound);
+		centroidBound = centroidBound.Union(primitives[i].centroid);
+	}
+
+	nodes[index].lightBound = lightBound;
+	nodes[index].parent = parent;
+
+	if (end - begin == 1)
+	{
+		// Leaf node
+		auto& primitive = primitives[begin];
+		nodes[index].lightIndex = primitive.lightIndex;
+		nodes[index].triangle = primitive.triangle;
+		leaves[leafOffsets[primitive.lightIndex] + primitive.triangle] = index;
+		return index;
+	}
+
+	// Find the split with the minimum surface area orientation heuristic (SAOH)
+	auto extent = lightBound.bound.max - lightBound.bound.min;
+	double maxExtent = Math::Max(extent.x, Math::Max(extent.y, extent.z));
+
+	int bestAxis = -1;
+	int bestSplit = 0;
+	double bestCost = Inf;
+
+	for (int axis = 0; axis < 3; axis++)
+	{
+		double centroidMin = centroidBound.min[axis];
+		double centroidExtent = centroidBound.max[axis] - centroidMin;
+
+		if (centroidExtent <= 0)
+		{
+			continue;
+		}
+
+		LightBound buckets[NumBuckets];
+
+		for (int i = begin; i < end; i++)
+		{
+			int bucket = Math::Clamp((int)(NumBuckets * (primitives[i].centroid[axis] - centroidMin) / centroidExtent), 0, NumBuckets - 1);
+			buckets[bucket].Merge(primitives[i].lightBound);
+		}
+
+		// Thin bounds are penalized when split along the shorter axes
+		double kr = maxExtent / extent[axis];
+
+		for (int split = 1; split < NumBuckets; split++)
+		{
+			LightBound b1, b2;
+
+			for (int i = 0; i < split; i++)
+			{
+				b1.Merge(buckets[i]);
+			}
+
+			for (int i = split; i < NumBuckets; i++)
+			{
+				b2.Merge(buckets[i]);
+			}
+
+			double cost = kr * (
+				b1.power * b1.OrientationCost() * b1.bound.SurfaceArea() +
+				b2.power * b2.OrientationCost() * b2.bound.SurfaceArea());
+
+			if (b1.power > 0 && b2.power > 0 && cost < bestCost)
+			{
+				bestAxis = axis;
+				bestSplit = split;
+				bestCost = cost;
+			}
+		}
+	}
+
+	int mid;
+
+	if (bestAxis < 0)
+	{
+		// Centroids are not separable, split in the middle
+		mid = (begin + end) / 2;
+	}
+	else
+	{
+		double centroidMin = centroidBound.min[bestAxis];
+		double centroidExtent = centroidBound.max[bestAxis] - centroidMin;
+
+		mid = (int)(std::partition(primitives.begin() + begin, primitives.begin() + end, [&](const LightPrimitive& primitive)
+		{
+			int bucket = Math::Clamp((int)(NumBuckets * (primitive.centroid[bestAxis] - centroidMin) / centroidExtent), 0, NumBuckets - 1);
+			return bucket < bestSplit;
+		}) - primitives.begin());
+	}
+
+	// Interior node
+	// The nodes may be reallocated while building the children, so refer by index.
+	int child1 = Build(primitives, begin, mid, index);
+	int child2 = Build(primitives, mid, end, index);
+	nodes[index].children[0] = child1;
+	nodes[index].children[1] = child2;
+	nodes[index].lightIndex = -1;
+	nodes[index].triangle = -1;
+
+	return index;
+}
+
+bool LightBVH::Sample( const Vec3d& p, const Vec3d& n, double& u, int& lightIndex, int& triangle, double& pdf ) const
+{
+	if (nodes.empty())
+	{
+		return false;
+	}
+
+	int index = 0;
+	pdf = 1;
+
+	while (nodes[index].lightIndex < 0)
+	{
+		const auto& node = nodes[index];
+		double importance1 = nodes[node.children[0]].lightBound.Importance(p, n);
+		double importance2 = nodes[node.children[1]].lightBound.Importance(p, n);
+
+		if (importance1 == 0 && importance2 == 0)
+		{
+			return false;
+		}
+
+		// Choose a child and reuse the sample
+		double p1 = importance1 / (importance1 + importance2);
+
+		if (u < p1)
+		{
+			u = Math::Min(u / p1, 1.0 - Eps);
+			pdf *= p1;
+			index = node.children[0];
+		}
+		else
+		{
+			u = Math::Min((u - p1) / (1.0 - p1), 1.0 - Eps);
+			pdf *= importance2 / (importance1 + importance2);
+			index = node.children[1];
+		}
+	}
+
+	lightIndex = nodes[index].lightIndex;
+	triangle = nodes[index].triangle;
+
+	return true;
+}
+
+double LightBVH::Pdf( const Vec3d& p, const Vec3d& n, int lightIndex, int triangle ) const
+{
+	int index = leaves[leafOffsets[lightIndex] + triangle];
+
+	if (index < 0)
+	{
+		return 0;
+	}
+
+	// Product of the probabilities of the choices from the root to the leaf
+	double pdf = 1;
+
+	for (int parent = nodes[index].parent; parent >= 0; index = parent, parent = nodes[index].parent)
+	{
+		const auto& node = nodes[parent];
+		double importance1 = nodes[node.children[0]].lightBound.Importance(p, n);
+		double importance2 = nodes[node.children[1]].lightBound.Importance(p, n);
+		double importance = node.children[0] == index ? importance1 : importance2;
+
+		if (importance == 0)
+		{
+			return 0;
+		}
+
+		pdf *= importance / (importance1 + importance2);
+	}
+
+	return pdf;
+}
+
+HINATA_NAMESPACE_END
\ No newline at end of file
@@ -0,0 +1,265 @@
+#include "pch.h"
+#include <hinatacore/lowdiscrepancysampler.h>
+#include <hinatacore/random.h>
+
+namespace
+{
+
+	// Largest double less than 1
+	const double OneMinusEpsilon = 1.0 - DBL_EPSILON / 2;
+
+	HINATA_FORCE_INLINE unsigned int Hash(unsigned int v)
+	{
+		v ^= v >> 16;
+		v *= 0x7feb352d;
+		v ^= v >> 15;
+		v *= 0x846ca68b;
+		v ^= v >> 16;
+		return v;
+	}
+
+	HINATA_FORCE_INLINE unsigned int ReverseBits(unsigned int v)
+	{
+		v = ((v >> 1) & 0x55555555) | ((v & 0x55555555) << 1);
+		v = ((v >> 2) & 0x33333333) | ((v & 0x33333333) << 2);
+		v = ((v >> 4) & 0x0f0f0f0f) | ((v & 0x0f0f0f0f) << 4);
+		v = ((v >> 8) & 0x00ff00ff) | ((v & 0x00ff00ff) << 8);
+		return (v >> 16) | (v << 16);
+	}
+
+	// Owen scrambling of the 32-bit fixed-point value
+	// with Laine-Karras style hash on the reversed bits
+	HINATA_FORCE_INLINE unsigned int OwenScramble(unsigned int v, unsigned int seed)
+	{
+		v = ReverseBits(v);
+		v += seed;
+		v ^= v * 0x6c50b47c;
+		v ^= v * 0xb82f1e52;
+		v ^= v * 0xc7afe638;
+		v ^= v * 0x8d22f6e6;
+		return ReverseBits(v);
+	}
+
+	// --------------------------------------------------------------------------------
+
+	/*
+		Generator matrices of the Sobol sequence.
+		The first dimension is the van der Corput sequence, and the others are made from
+		the primitive polynomials and the initial direction numbers by Joe and Kuo (new-joe-kuo-6).
+	*/
+	struct SobolMatrices
+	{
+		SobolMatrices()
+		{
+			// Degree, coefficients, and initial direction numbers of the dimensions 2, 3, ...
+			struct DirectionNumbers
+			{
+				int s;
+				int a;
+				int m[7];
+			};
+
+			const DirectionNumbers directionNumbers[hinata::SobolSampler::NumDimensions - 1] =
+			{
+				{ 1,  0, { 1 } },
+				{ 2,  1, { 1, 3 } },
+				{ 3,  1, { 1, 3, 1 } },
+				{ 3,  2, { 1, 1, 1 } },
+				{ 4,  1, { 1, 1, 3, 3 } },
+				{ 4,  4, { 1, 3, 5, 13 } },
+				{ 5,  2, { 1, 1, 5, 5, 17 } },
+				{ 5,  4, { 1, 1, 5, 5, 5 } },
+				{ 5,  7, { 1, 1, 7, 11, 19 } },
+				{ 5, 11, { 1, 1, 5, 1, 1 } },
+				{ 5, 13, { 1, 1, 1, 3, 11 } },
+				{ 5, 14, { 1, 3, 5, 5, 31 } },
+				{ 6,  1, { 1, 3, 3, 9, 7, 49 } },
+				{ 6, 13, { 1, 1, 1, 15, 21, 21 } },
+				{ 6, 16, { 1, 3, 1, 13, 27, 49 } },
+				{ 6, 19, { 1, 1, 1, 15, 7, 5 } },
+				{ 6, 22, { 1, 3, 1, 15, 13, 25 } },
+				{ 6, 25, { 1, 1, 5, 5, 19, 61 } },
+				{ 7,  1, { 1, 3, 7, 11, 23, 15, 103 } },
+				{ 7,  4, { 1, 3, 7, 13, 13, 15, 69 } },
+			};
+
+			for (int i = 0; i < 32; i++)
+			{
+				matrices[0][i] = 1u << (31 - i);
+			}
+
+			for (int d = 1; d < hinata::SobolSampler::NumDimensions; d++)
+			{
+				const auto& dn = directionNumbers[d - 1];
+				unsigned int* v = matrices[d];
+
+				for (int i = 0; i < dn.s; i++)
+				{
+					v[i] = (unsigned int)dn.m[i] << (31 - i);
+				}
+
+				for (int i = dn.s; i < 32; i++)
+				{
+					v[i] = v[i - dn.s] ^ (v[i - dn.s] >> dn.s);
+					for (int k = 1; k < dn.s; k++)
+					{
+						v[i] ^= ((dn.a >> (dn.s - 1 - k)) & 1) * v[i - k];
+					}
+				}
+			}
+		}
+
+		unsigned int matrices[hinata::SobolSampler::NumDimensions][32];
+	};
+
+	const SobolMatrices sobolMatrices;
+
+	// --------------------------------------------------------------------------------
+
+	const int Primes[hinata::HaltonSampler::NumDimensions] =
+	{
+		2, 3, 5, 7, 11, 13, 17, 19, 23, 29, 31, 37, 41, 43, 47, 53,
+		59, 61, 67, 71, 73, 79, 83, 89, 97, 101, 103, 107, 109, 113, 127, 131,
+		137, 139, 149, 151, 157, 163, 167, 173, 179, 181, 191, 193, 197, 199, 211, 223,
+		227, 229, 233, 239, 241, 251, 257, 263, 269, 271, 277, 281, 283, 293, 307, 311
+	};
+
+	// i-th element of the random permutation of [0, l) chosen by p (Kensler 2013)
+	unsigned int PermutationElement(unsigned int i, unsigned int l, unsigned int p)
+	{
+		unsigned int w = l - 1;
+		w |= w >> 1;
+		w |= w >> 2;
+		w |= w >> 4;
+		w |= w >> 8;
+		w |= w >> 16;
+
+		// Permutation of [0, w] repeated until the element falls into [0, l)
+		do
+		{
+			i ^= p;
+			i *= 0xe170893d;
+			i ^= p >> 16;
+			i ^= (i & w) >> 4;
+			i ^= p >> 8;
+			i *= 0x0929eb3f;
+			i ^= p >> 23;
+			i ^= (i & w) >> 1;
+			i *= 1 | p >> 27;
+			i *= 0x6935fa69;
+			i ^= (i & w) >> 11;
+			i *= 0x74dcb303;
+			i ^= (i & w) >> 2;
+			i *= 0x9e501cc3;
+			i ^= (i & w) >> 2;
+			i *= 0xc860a3df;
+			i &= w;
+			i ^= i >> 5;
+		} while (i >= l);
+
+		return (i + p) % l;
+	}
+
+	// Radical inverse with the digits permuted by the hash of the preceding digits.
+	// The trailing zero digits are also scrambled until the precision is exhausted.
+	double ScrambledRadicalInverse(int base, unsigned long long a, unsigned int seed)
+	{
+		double invBase = 1.0 / base;
+		double invBaseM = 1.0;
+		unsigned long long reversedDigits = 0;
+		unsigned int digitIndex = 0;
+
+		while (1.0 - invBaseM < 1.0)
+		{
+			unsigned long long next = a / base;
+			unsigned int digit = (unsigned int)(a - next * base);
+
+			unsigned int digitHash = Hash(seed ^ Hash((unsigned int)reversedDigits ^ (unsigned int)(reversedDigits >> 32) ^ (digitIndex << 24)));
+			digit = PermutationElement(digit, base, digitHash);
+
+			reversedDigits = reversedDigits * base + digit;
+			invBaseM *= invBase;
+			digitIndex++;
+			a = next;
+		}
+
+		return std::min(reversedDigits * invBaseM, OneMinusEpsilon);
+	}
+
+}
+
+HINATA_NAMESPACE_BEGIN
+
+SobolSampler::SobolSampler( const std::shared_ptr<Random>& rng, unsigned int seed )
+	: rng(rng)
+	, seed(seed)
+	, pixelSeed(0)
+	, index(0)
+	, dimension(0)
+{
+
+}
+
+double SobolSampler::Next()
+{
+	int d = dimension++;
+
+	if (d >= NumDimensions)
+	{
+		return rng->Next();
+	}
+
+	unsigned int v = 0;
+	const unsigned int* m = sobolMatrices.matrices[d];
+
+	for (unsigned int i = index; i != 0; i >>= 1, m++)
+	{
+		if (i & 1)
+		{
+			v ^= *m;
+		}
+	}
+
+	v = OwenScramble(v, Hash(pixelSeed ^ Hash(d)));
+	return std::min(v * (1.0 / 4294967296.0), OneMinusEpsilon);
+}
+
+void SobolSampler::StartSample( const Vec2i& pixel, long long index )
+{
+	pixelSeed = Hash(seed ^ Hash(pixel.x ^ Hash(pixel.y)));
+	this->index = (unsigned int)index;
+	dimension = 0;
+}
+
+// --------------------------------------------------------------------------------
+
+HaltonSampler::HaltonSampler( const std::shared_ptr<Random>& rng, unsigned int seed )
+	: rng(rng)
+	, seed(seed)
+	, pixelSeed(0)
+	, index(0)
+	, dimension(0)
+{
+
+}
+
+double HaltonSampler::Next()
+{
+	int d = dimension++;
+
+	if (d >= NumDimensions)
+	{
+		return rng->Next();
+	}
+
+	return ScrambledRadicalInverse(Primes[d], index, Hash(pixelSeed ^ Hash(d)));
+}
+
+void HaltonSampler::StartSample( const Vec2i& pixel, long long index )
+{
+	pixelSeed = Hash(seed ^ Hash(pixel.x ^ Hash(pixel.y)));
+	this->index = (unsigned long long)index;
+	dimension = 0;
+}
+
+HINATA_NAMESPACE_END
@@ -16,6 +16,7 @@
 #include <queue>
 #include <algorithm>
 #include <random>
+#include <limits>
 #include <tuple>
 #include <chrono>
 #include <locale>
@@ -26,6 +27,7 @@
 #include <cstdio>
 #include <cmath>
 #include <cstdlib>
+#include <cstring>
 #include <ctime>
 #include <cassert>
 
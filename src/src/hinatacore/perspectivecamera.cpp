@@ -93,6 +93,30 @@ Vec3d PerspectiveCamera::SampleAndEvaluate( const Vec3d& ref, Vec2d& rasterPos,
 	return Vec3d(We / dist2);
 }
 
+double PerspectiveCamera::PdfDirection( const Vec3d& d )
+{
+	// Direction in camera coordinates
+	auto dCam3 = Math::Normalize(Vec3d(viewMatrix * Vec4d(d, 0.0)));
+
+	if (-dCam3.z <= 0.0)
+	{
+		return 0.0;
+	}
+
+	// Raster position of the point along the direction
+	auto dNdc4 = projectionMatrix * Vec4d(dCam3, 1.0);
+	auto dNdc3 = Vec3d(dNdc4) / dNdc4.w;
+	auto rasterPos = (Vec2d(dNdc3.x, dNdc3.y) + 1.0) * 0.5;
+
+	if (rasterPos.x < 0 || rasterPos.x > 1 || rasterPos.y < 0 || rasterPos.y > 1)
+	{
+		return 0.0;
+	}
+
+	// p_\sigma(z_0\to z_1) = W_e(z_0\to z_1)
+	return EvaluateImportance(-dCam3.z);
+}
+
 double PerspectiveCamera::EvaluateImportance( double cosTheta )
 {
 	// Assume hypothetical sensor on z=-d in camera coordinates.
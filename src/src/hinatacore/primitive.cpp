@@ -12,6 +12,7 @@ Primitive::Primitive( const Mat4d& localToWorld, const std::shared_ptr<Shape>& s
 	: localToWorld(localToWorld)
 	, shape(shape)
 	, bsdf(bsdf)
+	, lightTriangle(0)
 {
 	InitializeTransform();
 }
@@ -21,6 +22,7 @@ Primitive::Primitive( const Mat4d& localToWorld, const std::shared_ptr<Shape>& s
 	, shape(shape)
 	, bsdf(bsdf)
 	, light(light)
+	, lightTriangle(0)
 {
 	InitializeTransform();
 }
@@ -40,18 +42,21 @@ bool Primitive::Intersect( Ray& ray, Intersection& isect )
 	ray.minT = localRay.minT;
 	ray.maxT = localRay.maxT;
 
-	if (localToWorld != Mat4d(1.0))
-	{
-		isect.p = Vec3d(localToWorld * Vec4d(isect.p, 1.0));
-		isect.sn = Math::Normalize(normalLocalToWorld * isect.sn);
-		isect.gn = Math::Normalize(normalLocalToWorld * isect.gn);
-		isect.ss = Math::Normalize(Vec3d(localToWorld * Vec4d(isect.ss, 0.0)));
-		isect.st = Math::Normalize(Vec3d(localToWorld * Vec4d(isect.st, 0.0)));
-	}
+	TransformIntersection(isect);
 
 	return true;
 }
 
+bool Primitive::Intersect( const Ray& ray )
+{
+	Ray localRay(ray);
+
+	localRay.o = Vec3d(worldToLocal * Vec4d(ray.o, 1.0));
+	localRay.d = Vec3d(worldToLocal * Vec4d(ray.d, 0.0));
+
+	return shape->Intersect(localRay);
+}
+
 void Primitive::SamplePosition( ShapePositionSampleRecord& record )
 {
 	shape->SamplePosition(record, localToWorld);
@@ -73,4 +78,16 @@ void Primitive::InitializeTransform()
 	normalLocalToWorld = Mat3d(Math::Transpose(worldToLocal));
 }
 
+void Primitive::TransformIntersection( Intersection& isect )
+{
+	if (localToWorld != Mat4d(1.0))
+	{
+		isect.p = Vec3d(localToWorld * Vec4d(isect.p, 1.0));
+		isect.sn = Math::Normalize(normalLocalToWorld * isect.sn);
+		isect.gn = Math::Normalize(normalLocalToWorld * isect.gn);
+		isect.ss = Math::Normalize(Vec3d(localToWorld * Vec4d(isect.ss, 0.0)));
+		isect.st = Math::Normalize(Vec3d(localToWorld * Vec4d(isect.st, 0.0)));
+	}
+}
+
 HINATA_NAMESPACE_END
\ No newline at end of file
@@ -4,13 +4,27 @@
 #include <hinatacore/random.h>
 #include <hinatacore/ray.h>
 #include <hinatacore/intersection.h>
-#include <hinatacore/primitive.h>
 #include <hinatacore/scene.h>
 #include <hinatacore/renderutils.h>
 #include <hinatacore/perspectivecamera.h>
 #include <hinatacore/arealight.h>
 #include <hinatacore/environmentlight.h>
 #include <hinatacore/bsdf.h>
+#include <hinatacore/image.h>
+#include <hinatacore/taskscheduler.h>
+
+namespace
+{
+
+	// Index of the random number sequence where the i-th seed path begins.
+	// Each seed path has its own range of the sequence,
+	// so the paths can be sampled in any order and restored from the index.
+	long long SeedPathIndex(int i)
+	{
+		return (long long)i << 32;
+	}
+
+}
 
 HINATA_NAMESPACE_BEGIN
 
@@ -25,6 +39,8 @@ PSSMLTRendererConfig::PSSMLTRendererConfig()
 	estimatorMode = PSSMLTEstimatorMode::MeanValueSubstitution_LargeStepMIS;
 	kernelSizeS1 = 4.0 / 1024.0;
 	kernelSizeS2 = 4.0 / 64.0;
+	splatBufferSize = 4096;
+	numChains = 0;
 }
 
 void PSSMLTRendererConfig::DefineOptions( boost::program_options::options_description& opt )
@@ -38,7 +54,9 @@ void PSSMLTRendererConfig::DefineOptions( boost::program_options::options_descri
 		("large-step-prob", po::value<double>(), "Large step mutation probability")
 		("estimator-mode", po::value<std::string>(), "Estimator mode (normal, mvs, mvs-mis")
 		("kernel-size-s1", po::value<double>(), "Minimum kernel size")
-		("kernel-size-s2", po::value<double>(), "Maximum kernel size");
+		("kernel-size-s2", po::value<double>(), "Maximum kernel size")
+		("splat-buffer-size", po::value<int>(), "Number of splats buffered per thread before accumulated to the image")
+		("num-chains", po::value<int>(), "Number of Markov chains (same as the number of render tasks if 0)");
 }
 
 void PSSMLTRendererConfig::ParseOptions( boost::program_options::variables_map& vm )
@@ -72,6 +90,10 @@ void PSSMLTRendererConfig::ParseOptions( boost::program_options::variables_map&
 		kernelSizeS1 = vm["kernel-size-s1"].as<double>();
 	if (vm.count("kernel-size-s2"))
 		kernelSizeS2 = vm["kernel-size-s2"].as<double>();
+	if (vm.count("splat-buffer-size"))
+		splatBufferSize = vm["splat-buffer-size"].as<int>();
+	if (vm.count("num-chains"))
+		numChains = Math::Max(0, vm["num-chains"].as<int>());
 }
 
 // ------------------------------------------------------------------------------------------
@@ -94,73 +116,165 @@ void PSSMLTRenderer::Preprocess()
 	// Generate seeds
 	// As well as seeds we compute the variable b,
 	// the integral of I over the sample space, using path tracing.
+	// The paths are sampled in parallel by the thread pool, each chunk with its own restorable sampler.
+	// Since a path uses its own range of the random number sequence,
+	// the candidates do not depend on the number of threads.
 
-	std::vector<PathSeed> candidates;
-	PathSampleRecord record;
-	double sumI = 0;
+	int numChunks = scheduler->NumThreads();
+	std::vector<std::vector<PathSeed>> chunkCandidates(numChunks);
+	std::atomic<int> processedSamples;
+	processedSamples = 0;
 
 	std::cerr << "Generating seeds ..." << std::endl;
 
-	for (int i = 0; i < config->numSeedSamples; i++)
+	scheduler->ParallelFor(numChunks, 0, config->numSeedSamples, [&](int chunkIndex, int begin, int end)
 	{
-		// Current index before sampling a path
-		int index = rSampler->Index();
+		RestorableSampler sampler(*rSampler);
+		auto& candidates = chunkCandidates[chunkIndex];
+		PathSampleRecord record;
 
-		// Sample the path and evaluate radiance
-		SampleAndEvaluatePath(rSampler, record);
+		for (int i = begin; i < end; i++)
+		{
+			// Sample the path and evaluate radiance
+			long long index = SeedPathIndex(i);
+			sampler.SetIndex(index);
+			SampleAndEvaluatePath(sampler, record);
 
-		sumI += record.I;
+			if (record.L != Vec3d())
+			{
+				candidates.push_back(PathSeed(index, record.I));
+			}
 
-		if (record.L != Vec3d())
-		{
-			candidates.push_back(PathSeed(index, record.I));
+			// Progress is printed while processing the first chunk
+			int processed = ++processedSamples;
+			if (chunkIndex == 0 && (i - begin) % 100 == 0)
+			{
+				std::cerr <<
+					(boost::format("\rProgress : %.2lf %%")
+					% ((double)processed / config->numSeedSamples * 100.0)).str();
+			}
 		}
+	});
 
-		if (i % 100 == 0 || i == config->numSeedSamples - 1)
-		{
-			std::cerr <<
-				(boost::format("\rProgress : %.2lf %%")
-				% ((double)(i + 1) / config->numSeedSamples * 100.0)).str();
-		}
+	std::cerr << "\rProgress : 100.00 %" << std::endl << std::endl;
+
+	// Candidates in the order of the paths
+	std::vector<PathSeed> candidates;
+	for (auto& c : chunkCandidates)
+	{
+		candidates.insert(candidates.end(), c.begin(), c.end());
 	}
 
-	b = sumI / config->numSeedSamples;
+	// --------------------------------------------------------------------------------
 
-	std::cerr << std::endl << std::endl;
+	// Create CDF
+	// Parallel prefix sum over fixed-size blocks of the candidates.
+	// The blocks do not depend on the number of threads, nor does the result.
+	// The paths without contributions have I = 0, so the sum of the candidates is the sum of I.
 
-	// --------------------------------------------------------------------------------
+	const int CdfBlockSize = 4096;
+	int numCandidates = (int)candidates.size();
+	int numBlocks = (numCandidates + CdfBlockSize - 1) / CdfBlockSize;
 
-	// Sample seeds according to I
+	// Sums of the blocks
+	std::vector<double> blockOffsets(numBlocks + 1, 0.0);
+	scheduler->ParallelFor(numChunks, 0, numBlocks, [&](int, int begin, int end)
+	{
+		for (int block = begin; block < end; block++)
+		{
+			int blockEnd = Math::Min((block + 1) * CdfBlockSize, numCandidates);
+			double sum = 0;
+			for (int i = block * CdfBlockSize; i < blockEnd; i++)
+			{
+				sum += candidates[i].I;
+			}
+			blockOffsets[block + 1] = sum;
+		}
+	});
 
-	// Create CDF
-	std::vector<double> cdf(1, 0.0);
-	for (auto& candidate : candidates)
+	// Offsets of the blocks
+	for (int block = 0; block < numBlocks; block++)
 	{
-		cdf.push_back(cdf.back() + candidate.I);
+		blockOffsets[block + 1] += blockOffsets[block];
 	}
 
-	// Normalize
-	double sum = cdf.back();
-	for (double& v : cdf)
+	double sumI = blockOffsets[numBlocks];
+	b = sumI / config->numSeedSamples;
+
+	// The chains are seeded only with the paths carrying energy
+	if (numCandidates == 0 || sumI == 0)
 	{
-		v /= sum;
+		throw std::exception(boost::str(
+			boost::format("No seed path carries energy in %d seed samples (light sources are not reachable?)") % config->numSeedSamples).c_str());
 	}
 
-	// Sample seeds
-	// #seeds = #threads
-	for (int i = 0; i < config->numThreads; i++)
+	// Normalized prefix sums in the blocks
+	std::vector<double> cdf(numCandidates + 1, 0.0);
+	scheduler->ParallelFor(numChunks, 0, numBlocks, [&](int, int begin, int end)
+	{
+		for (int block = begin; block < end; block++)
+		{
+			int blockEnd = Math::Min((block + 1) * CdfBlockSize, numCandidates);
+			double sum = blockOffsets[block];
+			for (int i = block * CdfBlockSize; i < blockEnd; i++)
+			{
+				sum += candidates[i].I;
+				cdf[i + 1] = sum / sumI;
+			}
+		}
+	});
+
+	// --------------------------------------------------------------------------------
+
+	// Sample seeds according to I
+	// The numbers for the selection follow the ranges of the seed paths.
+	// #seeds = #chains
+	int numChains = config->numChains > 0 ? config->numChains : config->numRenderTasks;
+	std::vector<PathSeed> seeds;
+	rSampler->SetIndex(SeedPathIndex(config->numSeedSamples));
+
+	for (int i = 0; i < numChains; i++)
 	{
 		double u = rSampler->Next();
 		int idx =
 			Math::Clamp(
 			std::upper_bound(cdf.begin(), cdf.end(), u) - cdf.begin() - 1,
-			0, (int)cdf.size() - 1);
+			0, numCandidates - 1);
 
 		seeds.push_back(candidates[idx]);
 	}
+
+	// --------------------------------------------------------------------------------
+
+	// Initialize the chains
+
+	// Replacing the random number generator of LazyPSSSampler with 
+	// that of RestorableSampler, LazyPSSSampler reproduces the seed samples and
+	// the samples are saved as an initial state of LazyPSSSampler.
+	// The generator for the mutations is set by the task processing the chain.
+
+	chains.assign(numChains, MarkovChain(config->kernelSizeS1, config->kernelSizeS2));
+
+	scheduler->ParallelFor(numChunks, 0, numChains, [&](int, int begin, int end)
+	{
+		RestorableSampler sampler(*rSampler);
+
+		for (int i = begin; i < end; i++)
+		{
+			auto& chain = chains[i];
+
+			sampler.SetIndex(seeds[i].index);
+			chain.sampler.SetRng(sampler.Rng());
+
+			SampleAndEvaluatePath(chain.sampler, chain.record[chain.current]);
+			assert(seeds[i].I == chain.record[chain.current].I);
+
+			chain.sampler.Accept();
+		}
+	});
 }
 
-void PSSMLTRenderer::SampleAndEvaluatePath( const std::shared_ptr<Sampler>& sampler, PathSampleRecord& record )
+void PSSMLTRenderer::SampleAndEvaluatePath( Sampler& sampler, PathSampleRecord& record )
 {
 	Ray ray;
 	Intersection isect;
@@ -169,7 +283,7 @@ void PSSMLTRenderer::SampleAndEvaluatePath( const std::shared_ptr<Sampler>& samp
 	Vec3d L;
 
 	// Raster position
-	Vec2d rasterPos(sampler->Next(), sampler->Next());
+	Vec2d rasterPos(sampler.Next(), sampler.Next());
 	
 	record.pixelPos.x = (int)(rasterPos.x * config->width);
 	record.pixelPos.y = (int)(rasterPos.y * config->height);
@@ -188,77 +302,74 @@ void PSSMLTRenderer::SampleAndEvaluatePath( const std::shared_ptr<Sampler>& samp
 		return;
 	}
 
-	if (isect.primitive->Light() != nullptr)
+	if (isect.light != nullptr)
 	{
-		auto& light = isect.primitive->Light();
-		L += light->Evaluate(-ray.d, isect.gn);
+		L += isect.light->Evaluate(-ray.d, isect.gn);
 	}
 
 	// ----------------------------------------------------------------------
 
 	while (true)
 	{
-		auto& bsdf = isect.primitive->Bsdf();
+		auto* bsdf = isect.bsdf;
 
 		// Explicit (direct) light sampling
 		// We do not handle the light path with length 1 (EL path)
 
-		if (isect.primitive != nullptr)
+		if (isect.bsdf != nullptr)
 		{
-			auto positionSample = Vec2d(sampler->Next(), sampler->Next());
+			auto positionSample = Vec2d(sampler.Next(), sampler.Next());
 
-			// Sample a light
-			std::shared_ptr<AreaLight> light;
+			// Sample a triangle of the lights for the shading point
+			AreaLight* light;
+			int lightTriangle;
 			double lightSelectionPdf;
-			scene->SampleLight(positionSample.x, light, lightSelectionPdf);
-
-			// Sample a position on the light
-			AreaLight::SampleRecord lightSampleRec;
-			lightSampleRec.positionSample = positionSample;
-			light->SamplePosition(lightSampleRec);
-
-			// Check visibility
-			Ray shadowRay;
-			auto d = lightSampleRec.p - isect.p;
-			shadowRay.d = Math::Normalize(d);
-			shadowRay.o = isect.p;
-			shadowRay.minT = isect.rayEpsilon;
-			shadowRay.maxT = Math::Length(d) * (1.0 - Eps);
 
-			Intersection shadowIsect;
-
-			if (!scene->Intersect(shadowRay, shadowIsect))
+			if (scene->SampleLight(isect.p, isect.sn, positionSample.x, light, lightTriangle, lightSelectionPdf))
 			{
-				// Evaluate Le (with cosine term)
-				auto Le = light->EvaluateCos(-shadowRay.d, lightSampleRec.n) / lightSelectionPdf;
+				// Sample a position on the triangle
+				AreaLight::SampleRecord lightSampleRec;
+				lightSampleRec.positionSample = positionSample;
+				light->SamplePosition(lightTriangle, lightSampleRec);
+
+				// Check visibility
+				Ray shadowRay;
+				auto d = lightSampleRec.p - isect.p;
+				shadowRay.d = Math::Normalize(d);
+				shadowRay.o = isect.p;
+				shadowRay.minT = isect.rayEpsilon;
+				shadowRay.maxT = Math::Length(d) * (1.0 - Eps);
+
+				double dDotN = Math::Dot(-shadowRay.d, lightSampleRec.n);
+
+				if (dDotN > 0 && !scene->Occluded(shadowRay))
+				{
+					// Evaluate Le (with cosine term)
+					// L_e(x_n\to x_{n-1}) \cos{(\theta_n)} / p_A(x_n)
+					auto Le = light->Evaluate(-shadowRay.d, lightSampleRec.n) * (dDotN / (lightSelectionPdf * lightSampleRec.pdf));
 
-				// Convert to Le / p_\sigma
-				auto dist2 = Math::Length2(d);
-				Le /= Vec3d(dist2);
+					// Convert to Le / p_\sigma
+					auto dist2 = Math::Length2(d);
+					Le /= Vec3d(dist2);
 
-				// Prepare for BSDF evaluation
-				BSDFRecord bsdfRec;
-				bsdfRec.type = BSDFType::All;
-				bsdfRec.adjoint = false;
-				bsdfRec.wi = isect.worldToShading * -ray.d;
-				bsdfRec.wo = isect.worldToShading * shadowRay.d;
+					// Prepare for BSDF evaluation
+					BSDFRecord bsdfRec;
+					bsdfRec.type = BSDFType::All;
+					bsdfRec.adjoint = false;
+					bsdfRec.wi = isect.worldToShading * -ray.d;
+					bsdfRec.wo = isect.worldToShading * shadowRay.d;
 
-				// Evaluate BSDF (with cosine term)
-				auto f = bsdf->Evaluate(bsdfRec, isect);
+					// Evaluate BSDF (with cosine term)
+					auto f = bsdf->Evaluate(bsdfRec, isect);
 
-				if (f != Vec3d())
-				{
-					// Calculate PDF for light and BSDF (in solid angle measure)
-					double dDotN = Math::Dot(-shadowRay.d, lightSampleRec.n);
-					double lightPdf =
-						dDotN <= 0
-							? 0.0
-							: lightSelectionPdf *		// Selection
-								lightSampleRec.pdf *	// p_A(x_n)
-								dist2 / dDotN;			// Convert to p_\sigma(x_{n-1}\to x_n)
-
-					if (lightPdf > 0)
+					if (f != Vec3d())
 					{
+						// Calculate PDF for light and BSDF (in solid angle measure)
+						double lightPdf =
+							lightSelectionPdf *		// Selection
+							lightSampleRec.pdf *	// p_A(x_n)
+							dist2 / dDotN;			// Convert to p_\sigma(x_{n-1}\to x_n)
+
 						// It should be positive
 						double bsdfPdf = bsdf->Pdf(bsdfRec);
 
@@ -277,8 +388,8 @@ void PSSMLTRenderer::SampleAndEvaluatePath( const std::shared_ptr<Sampler>& samp
 		// BSDF sampling
 
 		BSDFSample bsdfSample;
-		bsdfSample.u = Vec2d(sampler->Next(), sampler->Next());
-		bsdfSample.uComponent = sampler->Next();
+		bsdfSample.u = Vec2d(sampler.Next(), sampler.Next());
+		bsdfSample.uComponent = sampler.Next();
 
 		BSDFRecord bsdfRec;
 		bsdfRec.type = BSDFType::All;
@@ -309,6 +420,9 @@ void PSSMLTRenderer::SampleAndEvaluatePath( const std::shared_ptr<Sampler>& samp
 
 		// ----------------------------------------------------------------------
 
+		// Light selection depends on the shading point, which is overwritten by the intersection
+		auto shadingNormal = isect.sn;
+
 		// Check intersection
 		if (!scene->Intersect(ray, isect))
 		{
@@ -317,7 +431,7 @@ void PSSMLTRenderer::SampleAndEvaluatePath( const std::shared_ptr<Sampler>& samp
 			return;
 		}
 
-		auto light = isect.primitive->Light();
+		auto* light = isect.light;
 
 		if (light != nullptr)
 		{
@@ -339,9 +453,9 @@ void PSSMLTRenderer::SampleAndEvaluatePath( const std::shared_ptr<Sampler>& samp
 				double lightPdf =
 					dDotN <= 0
 						? 0.0
-						: scene->LightSelectionPdf() *	// Selection
-							light->PdfPosition() *		// p_A(x_n)
-							dist2 / dDotN;				// Convert to p_\sigma(x_{n-1}\to x_n)
+						: scene->LightSelectionPdf(ray.o, shadingNormal, light, isect.lightTriangle) *	// Selection
+							light->PdfPosition(isect.lightTriangle) *	// p_A(x_n)
+							dist2 / dDotN;								// Convert to p_\sigma(x_{n-1}\to x_n)
 
 				// MIS weight (for BSDF sampling)
 				double w = bsdfPdf / (lightPdf + bsdfPdf);
@@ -358,7 +472,7 @@ void PSSMLTRenderer::SampleAndEvaluatePath( const std::shared_ptr<Sampler>& samp
 			// Russian roulette for path termination
 			double p = Math::Min(0.5, RenderUtils::Luminance(throughput));
 
-			if (sampler->Next() > p)
+			if (sampler.Next() > p)
 			{
 				break;
 			}
@@ -373,7 +487,7 @@ void PSSMLTRenderer::SampleAndEvaluatePath( const std::shared_ptr<Sampler>& samp
 
 void PSSMLTRenderer::RenderPassFinished()
 {
-	totalMutations += config->numMutations * config->numRenderTasks;
+	totalMutations += (long long)config->numMutations * NumRenderTasks();
 }
 
 void PSSMLTRenderer::SaveImageFinished()
@@ -386,12 +500,10 @@ double PSSMLTRenderer::ImageSaveWeight()
 	return (double)(config->width * config->height) / totalMutations;
 }
 
-std::shared_ptr<PSSMLTRenderer::Thread_InitParam> PSSMLTRenderer::Create_Thread_InitParam( int id )
+int PSSMLTRenderer::NumRenderTasks()
 {
-	auto param = std::make_shared<PSSMLT_Thread_InitParam>();
-	param->seed = seeds[id];
-	param->rSampler = std::make_shared<RestorableSampler>(*rSampler);
-	return param;
+	// Every task has at least one chain
+	return Math::Max(1, Math::Min(config->numRenderTasks, (int)chains.size()));
 }
 
 std::shared_ptr<PSSMLTRenderer::Thread_SharedData> PSSMLTRenderer::Create_Thread_SharedData()
@@ -401,44 +513,43 @@ std::shared_ptr<PSSMLTRenderer::Thread_SharedData> PSSMLTRenderer::Create_Thread
 
 void PSSMLTRenderer::InitializeThread( std::shared_ptr<Thread_InitParam>& p, std::shared_ptr<Thread_SharedData>& s )
 {
-	auto param = std::dynamic_pointer_cast<PSSMLT_Thread_InitParam>(p);
 	auto shared = std::dynamic_pointer_cast<PSSMLT_Thread_SharedData>(s);
-
-	// Initialize LazyPSSSampler
-
-	shared->current = 0;
-
-	// Replacing the random number generator of LazyPSSSampler with 
-	// that of RestorableSampler, LazyPSSSampler reproduces the seed samples and
-	// the samples are saved as an initial state of LazyPSSSampler.
-
-	shared->sampler = std::make_shared<LazyPSSSampler>(config->kernelSizeS1, config->kernelSizeS2);
-
-	param->rSampler->SetIndex(param->seed.index);
-	shared->sampler->SetRng(param->rSampler->Rng());
-
-	SampleAndEvaluatePath(shared->sampler, shared->record[shared->current]);
-	assert(param->seed.I == shared->record[shared->current].I);
-
-	shared->sampler->SetRng(shared->rng);
-	shared->sampler->Accept();
+	shared->splats = std::make_shared<SplatBuffer>(*shared->image, config->splatBufferSize);
 }
 
-void PSSMLTRenderer::ProcessThread_Render( std::shared_ptr<Thread_SharedData>& s )
+void PSSMLTRenderer::ProcessThread_Render( std::shared_ptr<Thread_SharedData>& s, int taskIndex )
 {
 	auto shared = std::dynamic_pointer_cast<PSSMLT_Thread_SharedData>(s);
 
+	// Contributions are accumulated to the image of the pass
+	shared->splats->SetImage(*shared->image);
+
+	// Chains of the task (taskIndex, taskIndex + #tasks, ...)
+	// A chain is processed only by one task in a pass,
+	// so the chains are not shared between the threads at the same time.
+	int numTasks = NumRenderTasks();
+	int numChains = (int)chains.size();
+	int numTaskChains = (numChains - taskIndex + numTasks - 1) / numTasks;
+
+	for (int c = taskIndex; c < numChains; c += numTasks)
+	{
+		chains[c].sampler.SetRng(shared->rng);
+	}
+
 	for (int i = 0; i < config->numMutations; i++)
 	{
-		PathSampleRecord& current = shared->record[shared->current];
-		PathSampleRecord& proposed = shared->record[1-shared->current];
+		// Interleave the chains of the task
+		auto& chain = chains[taskIndex + (i % numTaskChains) * numTasks];
+
+		PathSampleRecord& current = chain.record[chain.current];
+		PathSampleRecord& proposed = chain.record[1-chain.current];
 
 		// --------------------------------------------------------------------------------
 
 		bool largeStep = shared->rng->Next() < config->largeStepProb;
 
-		shared->sampler->SetLargeStep(largeStep);
-		SampleAndEvaluatePath(shared->sampler, proposed);
+		chain.sampler.SetLargeStep(largeStep);
+		SampleAndEvaluatePath(chain.sampler, proposed);
 
 		// --------------------------------------------------------------------------------
 
@@ -461,23 +572,26 @@ void PSSMLTRenderer::ProcessThread_Render( std::shared_ptr<Thread_SharedData>& s
 		if (shared->rng->Next() < a)
 		{
 			// Accepted
-			shared->sampler->Accept();
-			shared->current = 1 - shared->current;
+			chain.sampler.Accept();
+			chain.current = 1 - chain.current;
 		}
 		else
 		{
 			// Rejected
-			shared->sampler->Reject();
+			chain.sampler.Reject();
 		}
 
 		// --------------------------------------------------------------------------------
 
 		if (config->estimatorMode == PSSMLTEstimatorMode::Normal)
 		{
-			auto& c = shared->record[shared->current];
+			auto& c = chain.record[chain.current];
 			AccumulateColor(shared, c, b / c.I);
 		}
 	}
+
+	// Accumulate the remaining splats before the end of the task
+	shared->splats->Flush();
 }
 
 void PSSMLTRenderer::AccumulateColor( std::shared_ptr<PSSMLT_Thread_SharedData>& shared, PathSampleRecord& record, double weight )
@@ -486,7 +600,7 @@ void PSSMLTRenderer::AccumulateColor( std::shared_ptr<PSSMLT_Thread_SharedData>&
 
 	if (record.I > 0)
 	{
-		shared->color[p.y * config->width + p.x] += record.L * weight;
+		shared->splats->Splat(p.x, p.y, record.L * weight);
 	}
 }
 
@@ -24,25 +24,10 @@ double RestorableSampler::Next()
 	return rng->Next();
 }
 
-void RestorableSampler::SetIndex( int index )
+void RestorableSampler::SetIndex( long long index )
 {
-	// Reset the initial seed
-	//if (index < currentIndex)
-	//{
-	//	currentIndex = 0;
-	//	rng->SetSeed(initialSeed);
-	//}
-
-	currentIndex = 0;
-	rng->SetSeed(initialSeed);
-
-	// Generate samples until the given index
-	while (currentIndex < index)
-	{
-		// Discard the value
-		currentIndex++;
-		rng->Next();
-	}
+	currentIndex = index;
+	rng->SetIndex(index);
 }
 
 LazyPSSSampler::LazyPSSSampler( double s1, double s2 )
@@ -2,22 +2,80 @@
 #include <hinatacore/ptrenderer.h>
 #include <hinatacore/ray.h>
 #include <hinatacore/random.h>
+#include <hinatacore/sampler.h>
+#include <hinatacore/lowdiscrepancysampler.h>
 #include <hinatacore/scene.h>
 #include <hinatacore/perspectivecamera.h>
 #include <hinatacore/arealight.h>
 #include <hinatacore/environmentlight.h>
 #include <hinatacore/intersection.h>
-#include <hinatacore/primitive.h>
 #include <hinatacore/bsdf.h>
 #include <hinatacore/renderutils.h>
+#include <hinatacore/image.h>
+
+namespace
+{
+
+	// Fraction of the samples of an adaptive pass distributed uniformly,
+	// so that the pixels with underestimated errors are still sampled
+	const double AdaptiveUniformFraction = 0.1;
+
+	// Lower bound of the luminance dividing the errors,
+	// which avoids large relative errors in dark pixels
+	const double ErrorMinLuminance = 1e-2;
+
+	// Dimensions of the samples of a path.
+	// The position in the pixel uses the first dimensions,
+	// and each bounce uses a fixed number of dimensions
+	// (environment light sampling, BSDF sampling, and Russian roulette)
+	// whether they are consumed or not, so a dimension is used for the same purpose in all paths.
+	const int CameraDimensions = 2;
+	const int BounceDimensions = 6;
+
+	// Every other bit of v packed to the lower bits
+	HINATA_FORCE_INLINE unsigned int CompactBits(unsigned int v)
+	{
+		v &= 0x55555555;
+		v = (v ^ (v >> 1)) & 0x33333333;
+		v = (v ^ (v >> 2)) & 0x0f0f0f0f;
+		v = (v ^ (v >> 4)) & 0x00ff00ff;
+		v = (v ^ (v >> 8)) & 0x0000ffff;
+		return v;
+	}
+
+	// Coordinates of the m-th element in Morton order
+	HINATA_FORCE_INLINE void MortonDecode(unsigned int m, int& x, int& y)
+	{
+		x = (int)CompactBits(m);
+		y = (int)CompactBits(m >> 1);
+	}
+
+	// Grid of nx * ny = n strata of a pixel, as square as possible
+	void PixelStrata(int n, int& nx, int& ny)
+	{
+		nx = std::max(1, (int)std::sqrt((double)n));
+		while (n % nx != 0)
+		{
+			nx--;
+		}
+		ny = std::max(1, n / nx);
+	}
+
+}
 
 HINATA_NAMESPACE_BEGIN
 
 PTRendererConfig::PTRendererConfig()
 {
 	appName = "pt";
-	samplePerTask = 1000;
+	samplePerPixel = 1;
+	tileSize = 64;
+	pixelSampling = PTPixelSampling::Stratified;
+	samplerType = PTSamplerType::Random;
 	rrDepth = 3;
+	adaptiveSampling = false;
+	adaptiveInitialPasses = 4;
+	targetError = 0;
 }
 
 void PTRendererConfig::DefineOptions( boost::program_options::options_description& opt )
@@ -25,16 +83,61 @@ void PTRendererConfig::DefineOptions( boost::program_options::options_descriptio
 	namespace po = boost::program_options;
 
 	opt.add_options()
-		("sample-per-task", po::value<int>(), "Sample per task")
-		("rr-depth", po::value<int>(), "Depth to enable RR for path termination");
+		("sample-per-pixel", po::value<int>(), "Sample per pixel in a pass")
+		("tile-size", po::value<int>(), "Width and height of the tile rendered by a task")
+		("pixel-sampling", po::value<std::string>(), "Distribution of the samples in a tile (random, stratified)")
+		("sampler", po::value<std::string>(), "Sampler of the stratified or adaptive passes (random, sobol, halton)")
+		("rr-depth", po::value<int>(), "Depth to enable RR for path termination")
+		("adaptive-sampling", "Distribute the samples according to the estimated error of the pixels")
+		("adaptive-initial-passes", po::value<int>(), "Number of passes with uniform samples before adaptive sampling")
+		("target-error", po::value<double>(), "Finish when the relative errors of all pixels are below the value (0 to disable)");
 }
 
 void PTRendererConfig::ParseOptions( boost::program_options::variables_map& vm )
 {
-	if (vm.count("sample-per-task"))
-		samplePerTask = vm["sample-per-task"].as<int>();
+	if (vm.count("sample-per-pixel"))
+		samplePerPixel = vm["sample-per-pixel"].as<int>();
+	if (vm.count("tile-size"))
+		tileSize = Math::Max(1, vm["tile-size"].as<int>());
+
+	if (vm.count("pixel-sampling"))
+	{
+		std::string str = vm["pixel-sampling"].as<std::string>();
+		if (str == "random")
+			pixelSampling = PTPixelSampling::Random;
+		else if (str == "stratified")
+			pixelSampling = PTPixelSampling::Stratified;
+		else
+		{
+			std::cerr << "Invalid pixel sampling, setting to stratified" << std::endl;
+			pixelSampling = PTPixelSampling::Stratified;
+		}
+	}
+
+	if (vm.count("sampler"))
+	{
+		std::string str = vm["sampler"].as<std::string>();
+		if (str == "random")
+			samplerType = PTSamplerType::Random;
+		else if (str == "sobol")
+			samplerType = PTSamplerType::Sobol;
+		else if (str == "halton")
+			samplerType = PTSamplerType::Halton;
+		else
+		{
+			std::cerr << "Invalid sampler, setting to random" << std::endl;
+			samplerType = PTSamplerType::Random;
+		}
+	}
+
 	if (vm.count("rr-depth"))
 		rrDepth = vm["rr-depth"].as<int>();
+	if (vm.count("adaptive-sampling"))
+		adaptiveSampling = true;
+	if (vm.count("adaptive-initial-passes"))
+		adaptiveInitialPasses = Math::Max(1, vm["adaptive-initial-passes"].as<int>());
+	if (vm.count("target-error"))
+		targetError = vm["target-error"].as<double>();
 }
 
 // --------------------------------------------------------------------------------
@@ -48,48 +151,280 @@ PTRenderer::PTRenderer( const std::shared_ptr<PTRendererConfig>& config )
 
 void PTRenderer::Preprocess()
 {
-	processedSamples = 0;
+	pixelStats.assign(config->width * config->height, PixelStats());
+	samplerSeed = (unsigned int)std::time(nullptr);
+
+	numFinishedPasses = 0;
+	converged = false;
+
+	for (int i = 0; i < 2; i++)
+	{
+		tileErrors[i].assign(NumRenderTasks(), TileError());
+		passNumSamples[i].assign(config->width * config->height, 0);
+		uniformSamples[i] = config->samplePerPixel;
+		samplesPerError[i] = 0;
+	}
 }
 
 void PTRenderer::RenderPassFinished()
 {
-	processedSamples += config->samplePerTask * config->numRenderTasks;
+	numFinishedPasses++;
+
+	double errorSum = 0;
+	int numUnconvergedPixels = 0;
+
+	for (auto& tileError : tileErrors[pass % 2])
+	{
+		errorSum += tileError.errorSum;
+		numUnconvergedPixels += tileError.numUnconvergedPixels;
+	}
+
+	converged = config->targetError > 0 && numUnconvergedPixels == 0;
+
+	// Allocate the samples of the pass after the next.
+	// The total number of samples of a pass is the same as the uniform passes.
+	if (config->adaptiveSampling && numFinishedPasses >= config->adaptiveInitialPasses && errorSum > 0)
+	{
+		double numPassSamples = (double)config->width * config->height * config->samplePerPixel;
+		uniformSamples[pass % 2] = config->samplePerPixel * AdaptiveUniformFraction;
+		samplesPerError[pass % 2] = numPassSamples * (1.0 - AdaptiveUniformFraction) / errorSum;
+	}
 }
 
 double PTRenderer::ImageSaveWeight()
 {
-	return (double)(config->width * config->height) / processedSamples;
+	// Normalized with the per-pixel weights
+	return 1.0;
+}
+
+void PTRenderer::ImageSavePixelWeights( std::vector<double>& weights )
+{
+	// Sample counts of the saved pass; the tasks of the next pass are updating the statistics
+	auto& numSamples = passNumSamples[pass % 2];
+	weights.resize(numSamples.size());
+
+	for (size_t i = 0; i < numSamples.size(); i++)
+	{
+		int n = numSamples[i];
+		weights[i] = n > 0 ? 1.0 / n : 0.0;
+	}
+}
+
+bool PTRenderer::RenderConverged()
+{
+	return converged;
+}
+
+int PTRenderer::NumRenderTasks()
+{
+	int numTilesY = (config->height + config->tileSize - 1) / config->tileSize;
+	return NumTilesX() * numTilesY;
 }
 
-void PTRenderer::InitializeThread( std::shared_ptr<Thread_InitParam>& param, std::shared_ptr<Thread_SharedData>& shared )
+int PTRenderer::NumTilesX()
 {
+	return (config->width + config->tileSize - 1) / config->tileSize;
+}
 
+std::shared_ptr<PTRenderer::Thread_SharedData> PTRenderer::Create_Thread_SharedData()
+{
+	return std::make_shared<PT_Thread_SharedData>();
 }
 
-void PTRenderer::ProcessThread_Render( std::shared_ptr<Thread_SharedData>& shared )
+void PTRenderer::InitializeThread( std::shared_ptr<Thread_InitParam>& param, std::shared_ptr<Thread_SharedData>& s )
 {
+	auto shared = std::dynamic_pointer_cast<PT_Thread_SharedData>(s);
+	shared->randomSampler = std::make_shared<RandomSampler>(shared->rng);
+
+	// Low-discrepancy samplers of all threads share the seed,
+	// so the sequence of a pixel does not depend on the thread rendering it.
+	if (config->samplerType == PTSamplerType::Sobol)
+	{
+		shared->sampler = std::make_shared<SobolSampler>(shared->rng, samplerSeed);
+	}
+	else if (config->samplerType == PTSamplerType::Halton)
+	{
+		shared->sampler = std::make_shared<HaltonSampler>(shared->rng, samplerSeed);
+	}
+	else
+	{
+		shared->sampler = shared->randomSampler;
+	}
+}
+
+void PTRenderer::ProcessThread_Render( std::shared_ptr<Thread_SharedData>& s, int taskIndex )
+{
+	auto shared = std::dynamic_pointer_cast<PT_Thread_SharedData>(s);
+
+	// Region of the tile
+	int tileX = taskIndex % NumTilesX() * config->tileSize;
+	int tileY = taskIndex / NumTilesX() * config->tileSize;
+	int tileWidth = Math::Min(config->tileSize, config->width - tileX);
+	int tileHeight = Math::Min(config->tileSize, config->height - tileY);
+
+	shared->tile.assign(tileWidth * tileHeight, Vec3d());
+
+	auto& sampler = *shared->randomSampler;
+
+	if (config->pixelSampling == PTPixelSampling::Random && samplesPerError[shared->pass % 2] == 0)
+	{
+		// Same number of samples per pixel for all tiles,
+		// so the density of the samples is uniform over the image.
+		int numSamples = tileWidth * tileHeight * config->samplePerPixel;
+		Ray initialRay;
+
+		for (int i = 0; i < numSamples; i++)
+		{
+			// Raster position in the tile
+			Vec2d u(sampler.Next(), sampler.Next());
+
+			int x = Math::Min((int)(u.x * tileWidth), tileWidth - 1);
+			int y = Math::Min((int)(u.y * tileHeight), tileHeight - 1);
+
+			Vec2d rasterPos(
+				(tileX + u.x * tileWidth) / config->width,
+				(tileY + u.y * tileHeight) / config->height);
+
+			// Generate ray
+			double _;
+			scene->Camera()->SampleAndEvaluate(rasterPos, initialRay, _);
+
+			// Evaluate radiance and accumulate
+			auto L = Li(initialRay, sampler);
+			shared->tile[y * tileWidth + x] += L;
+			pixelStats[(tileY + y) * config->width + tileX + x].Add(RenderUtils::Luminance(L));
+		}
+	}
+	else
+	{
+		// Pixels in Morton order in the tile,
+		// so consecutive camera rays and writes to the tile are close to each other.
+		// The number of samples of a pixel depends on the estimated error of the pixel in the adaptive passes.
+		int size = 1;
+		while (size < Math::Max(tileWidth, tileHeight))
+		{
+			size *= 2;
+		}
+
+		for (unsigned int m = 0; m < (unsigned int)(size * size); m++)
+		{
+			int x, y;
+			MortonDecode(m, x, y);
+
+			if (x >= tileWidth || y >= tileHeight)
+			{
+				continue;
+			}
+
+			int numSamples =
+				samplesPerError[shared->pass % 2] == 0
+					? config->samplePerPixel
+					: NumPixelSamples(pixelStats[(tileY + y) * config->width + tileX + x], sampler, shared->pass);
+
+			RenderPixel(*shared, tileX, tileY, tileWidth, x, y, numSamples);
+		}
+	}
+
+	// Tiles do not overlap, so the tile is written without locking the image
+	shared->image->Accumulate(Vec4i(tileX, tileY, tileWidth, tileHeight), shared->tile);
+
+	// Errors of the tile for the sample allocation
+	// and the sample counts for the normalization of the image of the pass
+	auto& tileError = tileErrors[shared->pass % 2][taskIndex];
+	auto& numSamples = passNumSamples[shared->pass % 2];
+	tileError.errorSum = 0;
+	tileError.numUnconvergedPixels = 0;
+
+	for (int y = 0; y < tileHeight; y++)
+	{
+		for (int x = 0; x < tileWidth; x++)
+		{
+			int i = (tileY + y) * config->width + tileX + x;
+			numSamples[i] = pixelStats[i].numSamples;
+
+			double error = PixelError(pixelStats[i]);
+
+			if (error > config->targetError)
+			{
+				tileError.numUnconvergedPixels++;
+			}
+
+			// Pixels without enough samples are sampled uniformly
+			if (error < Inf)
+			{
+				tileError.errorSum += error;
+			}
+		}
+	}
+}
+
+void PTRenderer::RenderPixel( PT_Thread_SharedData& shared, int tileX, int tileY, int tileWidth, int x, int y, int numSamples )
+{
+	auto& sampler = *shared.sampler;
+	auto& stats = pixelStats[(tileY + y) * config->width + tileX + x];
+	Vec2i pixel(tileX + x, tileY + y);
 	Ray initialRay;
 
-	for (int i = 0; i < config->samplePerTask; i++)
+	int nx, ny;
+	PixelStrata(numSamples, nx, ny);
+
+	for (int i = 0; i < numSamples; i++)
 	{
-		// Raster position
-		Vec2d rasterPos(shared->rng->Next(), shared->rng->Next());
+		// The sequence of the pixel continues over the passes
+		sampler.StartSample(pixel, stats.numSamples);
+
+		// Position in the pixel.
+		// The points of the low-discrepancy samplers are already stratified,
+		// otherwise the samples are jittered in the strata of the pixel.
+		Vec2d u(sampler.Next(), sampler.Next());
 
-		int x = (int)(rasterPos.x * config->width);
-		int y = (int)(rasterPos.y * config->height);
+		if (config->samplerType == PTSamplerType::Random)
+		{
+			u = Vec2d((i % nx + u.x) / nx, (i / nx + u.y) / ny);
+		}
+
+		Vec2d rasterPos(
+			(pixel.x + u.x) / config->width,
+			(pixel.y + u.y) / config->height);
 
-		// Generate ray
 		double _;
 		scene->Camera()->SampleAndEvaluate(rasterPos, initialRay, _);
 
-		// Evaluate radiance and accumulate
-		shared->color[y * config->width + x] += Li(initialRay, shared);
+		auto L = Li(initialRay, sampler);
+		shared.tile[y * tileWidth + x] += L;
+		stats.Add(RenderUtils::Luminance(L));
+	}
+}
+
+double PTRenderer::PixelError( const PixelStats& stats )
+{
+	if (stats.numSamples < 2)
+	{
+		return Inf;
 	}
+
+	// Standard error of the mean relative to the mean
+	double variance = stats.m2 / (stats.numSamples - 1);
+	return std::sqrt(variance / stats.numSamples) / Math::Max(stats.mean, ErrorMinLuminance);
+}
+
+int PTRenderer::NumPixelSamples( const PixelStats& stats, RandomSampler& sampler, int pass )
+{
+	double error = PixelError(stats);
+
+	if (error == Inf)
+	{
+		return config->samplePerPixel;
+	}
+
+	// Stochastic rounding keeps the expected number of samples
+	double n = uniformSamples[pass % 2] + samplesPerError[pass % 2] * error;
+	return (int)(n + sampler.Next());
 }
 
 // --------------------------------------------------------------------------------
 
-Vec3d PTRenderer::Li( Ray& initialRay, std::shared_ptr<Thread_SharedData>& shared )
+Vec3d PTRenderer::Li( Ray& initialRay, Sampler& sampler )
 {
 	Ray ray = initialRay;
 	Intersection isect;
@@ -98,23 +433,39 @@ Vec3d PTRenderer::Li( Ray& initialRay, std::shared_ptr<Thread_SharedData>& share
 	Vec3d throughput(1.0);
 	int depth = 0;
 
+	// PDF of the last BSDF sampling (in solid angle measure),
+	// or zero for the camera ray and the specular interactions which disables MIS
+	double bsdfPdf = 0;
+
+	auto& envLight = scene->GetEnvironmentLight();
+
 	while (true)
 	{
 		// Check intersection
 		if (!scene->Intersect(ray, isect))
 		{
 			// There is no intersection, evaluate environment light if exists.
-			auto& envLight = scene->GetEnvironmentLight();
-
 			if (envLight != nullptr)
 			{
-				L += throughput * envLight->Evaluate(-ray.d);
+				auto Le = envLight->Evaluate(-ray.d);
+
+				if (bsdfPdf == 0)
+				{
+					L += throughput * Le;
+				}
+				else
+				{
+					// MIS weight (for BSDF sampling)
+					double envPdf = envLight->Pdf(-ray.d);
+					double w = bsdfPdf / (bsdfPdf + envPdf);
+					L += throughput * Le * w;
+				}
 			}
 
 			break;
 		}
 
-		auto light = isect.primitive->Light();
+		auto* light = isect.light;
 
 		if (light != nullptr)
 		{
@@ -125,11 +476,49 @@ Vec3d PTRenderer::Li( Ray& initialRay, std::shared_ptr<Thread_SharedData>& share
 		// ----------------------------------------------------------------------
 
 		// Sample BSDF
-		std::shared_ptr<BSDF> bsdf = isect.primitive->Bsdf();
+		auto* bsdf = isect.bsdf;
+
+		sampler.SetDimension(CameraDimensions + depth * BounceDimensions);
+
+		if (envLight != nullptr)
+		{
+			// Explicit (direct) environment light sampling
+			Vec3d d;
+			double envPdf;
+			auto Le = envLight->Sample(Vec2d(sampler.Next(), sampler.Next()), d, envPdf);
+
+			if (envPdf > 0 && Le != Vec3d())
+			{
+				BSDFRecord envRecord;
+				envRecord.type = BSDFType::All;
+				envRecord.adjoint = false;
+				envRecord.wi = Math::Normalize(isect.worldToShading * -ray.d);
+				envRecord.wo = Math::Normalize(isect.worldToShading * -d);
+
+				// Evaluate BSDF (with cosine term)
+				auto f = bsdf->Evaluate(envRecord, isect);
+
+				if (f != Vec3d())
+				{
+					Ray shadowRay;
+					shadowRay.o = isect.p;
+					shadowRay.d = -d;
+					shadowRay.minT = isect.rayEpsilon;
+					shadowRay.maxT = Inf;
+
+					if (!scene->Occluded(shadowRay))
+					{
+						// MIS weight (for environment light sampling)
+						double w = envPdf / (envPdf + bsdf->Pdf(envRecord));
+						L += throughput * f * Le * (w / envPdf);
+					}
+				}
+			}
+		}
 
 		BSDFSample sample;
-		sample.u = Vec2d(shared->rng->Next(), shared->rng->Next());
-		sample.uComponent = shared->rng->Next();
+		sample.u = Vec2d(sampler.Next(), sampler.Next());
+		sample.uComponent = sampler.Next();
 
 		BSDFRecord record;
 		record.type = BSDFType::All;
@@ -149,6 +538,7 @@ Vec3d PTRenderer::Li( Ray& initialRay, std::shared_ptr<Thread_SharedData>& share
 
 		// Update throughput
 		throughput *= weight;
+		bsdfPdf = (record.sampledType & BSDFType::Delta) != 0 ? 0 : pdf;
 
 		// Setup next ray
 		ray.d = record.wo;
@@ -163,7 +553,7 @@ Vec3d PTRenderer::Li( Ray& initialRay, std::shared_ptr<Thread_SharedData>& share
 			// Russian roulette for path termination
 			double p = std::min(0.5, RenderUtils::Luminance(throughput));
 
-			if (shared->rng->Next() > p)
+			if (sampler.Next() > p)
 			{
 				break;
 			}
@@ -1,6 +1,57 @@
 #include "pch.h"
 #include <hinatacore/random.h>
 
+namespace
+{
+
+	const unsigned int PhiloxM0 = 0xD2511F53;
+	const unsigned int PhiloxM1 = 0xCD9E8D57;
+	const unsigned int PhiloxW0 = 0x9E3779B9;
+	const unsigned int PhiloxW1 = 0xBB67AE85;
+	const int PhiloxRounds = 10;
+
+	HINATA_FORCE_INLINE void MulHiLo(unsigned int a, unsigned int b, unsigned int& hi, unsigned int& lo)
+	{
+		unsigned long long p = (unsigned long long)a * b;
+		hi = (unsigned int)(p >> 32);
+		lo = (unsigned int)p;
+	}
+
+	// 53-bit double in [0, 1) from 64 random bits
+	HINATA_FORCE_INLINE double ToDouble(unsigned int a, unsigned int b)
+	{
+		return ((a >> 5) * 67108864.0 + (b >> 6)) * (1.0 / 9007199254740992.0);
+	}
+
+#ifdef HINATA_USE_SSE
+
+	// Multiply the four lanes and split the 64-bit products into the higher and lower 32 bits
+	HINATA_FORCE_INLINE void MulHiLo(__m128i a, __m128i b, __m128i& hi, __m128i& lo)
+	{
+		__m128i p02 = _mm_mul_epu32(a, b);
+		__m128i p13 = _mm_mul_epu32(_mm_srli_epi64(a, 32), _mm_srli_epi64(b, 32));
+
+		// (lo0, lo2, hi0, hi2) and (lo1, lo3, hi1, hi3)
+		p02 = _mm_shuffle_epi32(p02, _MM_SHUFFLE(3, 1, 2, 0));
+		p13 = _mm_shuffle_epi32(p13, _MM_SHUFFLE(3, 1, 2, 0));
+
+		lo = _mm_unpacklo_epi32(p02, p13);
+		hi = _mm_unpackhi_epi32(p02, p13);
+	}
+
+	// Two numbers in [0, 1) from the lower two lanes of the random bits
+	HINATA_FORCE_INLINE __m128d ToDouble(__m128i a, __m128i b)
+	{
+		// Shifted values fit in signed 32-bit integers
+		__m128d da = _mm_cvtepi32_pd(_mm_srli_epi32(a, 5));
+		__m128d db = _mm_cvtepi32_pd(_mm_srli_epi32(b, 6));
+		return _mm_mul_pd(_mm_add_pd(_mm_mul_pd(da, _mm_set1_pd(67108864.0)), db), _mm_set1_pd(1.0 / 9007199254740992.0));
+	}
+
+#endif
+
+}
+
 HINATA_NAMESPACE_BEGIN
 
 Random::Random( unsigned int seed )
@@ -10,13 +61,121 @@ Random::Random( unsigned int seed )
 
 double Random::Next()
 {
-	return uniformReal(engine);
+	// A block contains two numbers
+	if ((index & 1) == 0)
+	{
+		GenerateBlock(index >> 1);
+	}
+
+	int i = (int)(index & 1) * 2;
+	index++;
+
+	return ToDouble(bits[i], bits[i + 1]);
 }
 
 void Random::SetSeed( unsigned int seed )
 {
-	engine.seed(seed);
-	uniformReal.reset();
+	key = seed;
+	index = 0;
+}
+
+void Random::NextN( double* v, int n )
+{
+	int i = 0;
+
+	// Finish the current block
+	if (n > 0 && (index & 1) != 0)
+	{
+		v[i++] = Next();
+	}
+
+#ifdef HINATA_USE_SSE
+	// Four blocks in the lanes at once
+	const __m128i m0 = _mm_set1_epi32(PhiloxM0);
+	const __m128i m1 = _mm_set1_epi32(PhiloxM1);
+
+	for (; i + 8 <= n; i += 8)
+	{
+		unsigned long long block = index >> 1;
+
+		__m128i c0 = _mm_set_epi32((int)(block + 3), (int)(block + 2), (int)(block + 1), (int)block);
+		__m128i c1 = _mm_set_epi32((int)((block + 3) >> 32), (int)((block + 2) >> 32), (int)((block + 1) >> 32), (int)(block >> 32));
+		__m128i c2 = _mm_setzero_si128();
+		__m128i c3 = _mm_setzero_si128();
+		unsigned int k0 = key;
+		unsigned int k1 = 0;
+
+		for (int round = 0; round < PhiloxRounds; round++)
+		{
+			__m128i hi0, lo0, hi1, lo1;
+			MulHiLo(m0, c0, hi0, lo0);
+			MulHiLo(m1, c2, hi1, lo1);
+
+			c0 = _mm_xor_si128(_mm_xor_si128(hi1, c1), _mm_set1_epi32((int)k0));
+			c1 = lo1;
+			c2 = _mm_xor_si128(_mm_xor_si128(hi0, c3), _mm_set1_epi32((int)k1));
+			c3 = lo0;
+
+			k0 += PhiloxW0;
+			k1 += PhiloxW1;
+		}
+
+		// First and second numbers of the blocks
+		__m128d first01 = ToDouble(c0, c1);
+		__m128d second01 = ToDouble(c2, c3);
+		__m128d first23 = ToDouble(_mm_shuffle_epi32(c0, _MM_SHUFFLE(1, 0, 3, 2)), _mm_shuffle_epi32(c1, _MM_SHUFFLE(1, 0, 3, 2)));
+		__m128d second23 = ToDouble(_mm_shuffle_epi32(c2, _MM_SHUFFLE(1, 0, 3, 2)), _mm_shuffle_epi32(c3, _MM_SHUFFLE(1, 0, 3, 2)));
+
+		_mm_storeu_pd(v + i,     _mm_unpacklo_pd(first01, second01));
+		_mm_storeu_pd(v + i + 2, _mm_unpackhi_pd(first01, second01));
+		_mm_storeu_pd(v + i + 4, _mm_unpacklo_pd(first23, second23));
+		_mm_storeu_pd(v + i + 6, _mm_unpackhi_pd(first23, second23));
+
+		index += 8;
+	}
+#endif
+
+	for (; i < n; i++)
+	{
+		v[i] = Next();
+	}
+}
+
+void Random::SetIndex( unsigned long long index )
+{
+	this->index = index;
+
+	// Next() generates the block only at the beginning of the block
+	if ((index & 1) != 0)
+	{
+		GenerateBlock(index >> 1);
+	}
+}
+
+void Random::GenerateBlock( unsigned long long block )
+{
+	unsigned int c[4] = { (unsigned int)block, (unsigned int)(block >> 32), 0, 0 };
+	unsigned int k[2] = { key, 0 };
+
+	for (int round = 0; round < PhiloxRounds; round++)
+	{
+		unsigned int hi0, lo0, hi1, lo1;
+		MulHiLo(PhiloxM0, c[0], hi0, lo0);
+		MulHiLo(PhiloxM1, c[2], hi1, lo1);
+
+		c[0] = hi1 ^ c[1] ^ k[0];
+		c[1] = lo1;
+		c[2] = hi0 ^ c[3] ^ k[1];
+		c[3] = lo0;
+
+		k[0] += PhiloxW0;
+		k[1] += PhiloxW1;
+	}
+
+	bits[0] = c[0];
+	bits[1] = c[1];
+	bits[2] = c[2];
+	bits[3] = c[3];
 }
 
-HINATA_NAMESPACE_END
\ No newline at end of file
+HINATA_NAMESPACE_END
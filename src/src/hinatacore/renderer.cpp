@@ -4,6 +4,8 @@
 #include <hinatacore/cornellboxscene.h>
 #include <hinatacore/bvhscene.h>
 #include <hinatacore/random.h>
+#include <hinatacore/taskscheduler.h>
+#include <hinatacore/imagewriter.h>
 
 HINATA_NAMESPACE_BEGIN
 
@@ -14,6 +16,7 @@ RendererConfig::RendererConfig()
 	height = 1024;
 	outputDir = ".";
 	outputFilePrefix = "";
+	imageFormat = "ppm";
 	disableOutputFileSuffix = false;
 	fixedScene = true;
 	scenePath = "scene.hinata";
@@ -48,6 +51,7 @@ bool RendererConfig::ProcessArgs( int argc, char** argv )
 		("height", po::value<int>(), "Height of the image")
 		("output-dir", po::value<std::string>(), "Output directory")
 		("output-file-prefix", po::value<std::string>(), "Prefix of output files (auto if empty)")
+		("image-format", po::value<std::string>(), "Format of output images (ppm, pfm, exr)")
 		("disable-output-file-suffix", "Disable suffix in output files")
 		("fixed-scene", "Render fixed scene (Cornell Box)")
 		("scene-path", po::value<std::string>(), "Path to the scene file")
@@ -87,6 +91,8 @@ bool RendererConfig::ProcessArgs( int argc, char** argv )
 		outputDir = vm["output-dir"].as<std::string>();
 	if (vm.count("output-file-prefix"))
 		outputFilePrefix = vm["output-file-prefix"].as<std::string>();
+	if (vm.count("image-format"))
+		imageFormat = vm["image-format"].as<std::string>();
 	if (vm.count("disable-output-file-suffix"))
 		disableOutputFileSuffix = true;
 	if (vm.count("fixed-scene"))
@@ -115,6 +121,12 @@ bool RendererConfig::ProcessArgs( int argc, char** argv )
 	if (vm.count("bg-color-b"))
 		bgColor.b = vm["bg-color-b"].as<double>();
 
+	if (imageFormat != "ppm" && imageFormat != "pfm" && imageFormat != "exr")
+	{
+		std::cerr << "Invalid image format : " << imageFormat << std::endl;
+		return false;
+	}
+
 	ParseOptions(vm);
 
 	return true;
@@ -124,15 +136,25 @@ bool RendererConfig::ProcessArgs( int argc, char** argv )
 
 Renderer::Renderer( const std::shared_ptr<RendererConfig>& config )
 	: commonConfig(config)
-	, finishedTasks(0)
-	, waitingThreads(0)
+	, scheduler(new TaskScheduler(config->numThreads))
 	, image(new Image(config->width, config->height))
 	, scene(
 		config->fixedScene
 			? static_cast<Scene*>(new CornellBoxScene((double)config->width / config->height))
-			: static_cast<Scene*>(new BVHScene(config->scenePath)))
+			: static_cast<Scene*>(new BVHScene(config->scenePath, *scheduler)))
+	, numRenderTasks(0)
+	, numFinalizedPasses(0)
+	, startablePass(0)
+	, pass(0)
+	, nextImageSaveTime(0)
+	, totalImageSaves(0)
+	, renderFinished(false)
 {
-
+	remainingTasks[0] = 0;
+	remainingTasks[1] = 0;
+	completedPasses[0] = completedPasses[1] = false;
+	lastPass = 0;
+	numInFlightTasks = 0;
 }
 
 Renderer::~Renderer()
@@ -146,25 +168,20 @@ void Renderer::Render()
 
 	// --------------------------------------------------------------------------------
 
-	// Create threads
-	std::vector<std::thread> threads;
+	// Thread data is created by each worker thread before processing its first render task
+	threadSharedData.assign(scheduler->NumThreads(), nullptr);
 
-	for (int i = 0; i < commonConfig->numThreads; i++)
-	{
-		auto param = Create_Thread_InitParam(i);
-		param->id = i;
-		threads.push_back(std::thread(&Renderer::ProcessThread, this, param));
-	}
+	// Images are written in background
+	imageWriter.reset(new ImageWriter(commonConfig->width, commonConfig->height));
 
 	// --------------------------------------------------------------------------------
 
 	// Timestamp
-	auto start = std::chrono::high_resolution_clock::now();
-	auto time = std::chrono::high_resolution_clock::to_time_t(start);
-	double nextImageSaveTime = commonConfig->imageSaveIntervalTime;
-	int totalImageSaves = 0;
+	renderStart = std::chrono::high_resolution_clock::now();
+	auto time = std::chrono::high_resolution_clock::to_time_t(renderStart);
+	nextImageSaveTime = commonConfig->imageSaveIntervalTime;
+	totalImageSaves = 0;
 
-	std::string timeStamp;
 	std::stringstream ss;
 
 #ifdef HINATA_PLATFORM_WINDOWS
@@ -180,195 +197,256 @@ void Renderer::Render()
 	// --------------------------------------------------------------------------------
 
 	// Render loop
-	int pass = 0;
-	double elapsed = 0;
-
-	while (elapsed < commonConfig->executionTime)
+	// Passes are chained by the workers (see ProcessTask and FinishPass),
+	// so the main thread only reports the passes.
+	numRenderTasks = NumRenderTasks();
+	for (int i = 0; i < 2; i++)
 	{
-		if (!commonConfig->quiet)
-			std::cerr << "Pass #" << pass << std::endl;
+		passImages[i].reset(new Image(commonConfig->width, commonConfig->height));
+		remainingTasks[i] = numRenderTasks;
+	}
 
-		// --------------------------------------------------------------------------------
+	pass = 0;
+	numFinalizedPasses = 0;
+	startablePass = 1;
+	completedPasses[0] = completedPasses[1] = false;
+	lastPass = std::numeric_limits<int>::max();
+	pendingTasks.clear();
+	renderFinished = false;
 
-		// Dispatch render tasks
-		finishedTasks = 0;
+	// Tasks of the following passes are submitted by the tasks
+	for (int i = 0; i < numRenderTasks; i++)
+	{
+		SubmitTask(0, i);
+	}
 
-		// Enqueue tasks
-		for (int y = 0; y < commonConfig->numRenderTasks; y++)
-		{
-			Task task;
-			task.command = Command::Render;
-			task.needSync = false;
-			queue.Enqueue(task);
-		}
+	while (true)
+	{
+		PassResult result;
 
-		// Wait for tasks
 		{
-			std::unique_lock<std::mutex> lock(taskFinishedMutex);
-
-			taskFinished.wait(lock,
-				[this]{
-					// Print progress
-					if (!commonConfig->quiet)
-					{
-						std::cerr <<
-							(boost::format("\r  Progress : %.2lf %%")
-							% ((double)finishedTasks / commonConfig->numRenderTasks * 100.0)).str();
-					}
-					return finishedTasks == commonConfig->numRenderTasks;
-			});
-
-			if (!commonConfig->quiet)
-				std::cerr << std::endl;
-		}
-
-		// --------------------------------------------------------------------------------
+			// Finished when the last pass is reported and the skipped tasks are drained
+			std::unique_lock<std::mutex> lock(passFinishedMutex);
+			passFinished.wait(lock, [this]{ return !passResults.empty() || (renderFinished && numInFlightTasks == 0); });
 
-		// Gather image buffers
-		finishedTasks = 0;
+			if (passResults.empty())
+			{
+				break;
+			}
 
-		for (int i = 0; i < commonConfig->numThreads; i++)
-		{
-			Task task;
-			task.command = Command::UpdateImage;
-			task.needSync = true;
-			queue.Enqueue(task);
+			result = passResults.front();
+			passResults.pop();
 		}
 
+		if (!commonConfig->quiet)
 		{
-			std::unique_lock<std::mutex> lock(taskFinishedMutex);
-			taskFinished.wait(lock, [this]{ return finishedTasks == commonConfig->numThreads; });
-		}
+			std::cerr << "Pass #" << result.pass << std::endl;
+			std::cerr << (boost::format("  Elapsed time : %.2lf seconds") % result.elapsed).str() << std::endl;
 
-		// --------------------------------------------------------------------------------
-
-		// Print elapsed time
-		auto now = std::chrono::high_resolution_clock::now();
-		elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(now - start).count() / 1000.0;			
+			if (!result.savedImagePath.empty())
+			{
+				std::cerr << "  Saving image : " << result.savedImagePath << std::endl;
+			}
 
-		if (!commonConfig->quiet)
-		{
-			std::cerr << (boost::format("  Elapsed time : %.2lf seconds") % elapsed).str() << std::endl;
+			std::cerr << std::endl;
 		}
+	}
 
-		// --------------------------------------------------------------------------------
+	// --------------------------------------------------------------------------------
 
-		pass++;
-		RenderPassFinished();
+	// No tasks are left after the last pass
+	// Destroying the writer waits for the pending images.
+	imageWriter.reset();
+}
 
-		// Save image
-		if (elapsed > nextImageSaveTime - Eps)
-		{
-			namespace fs = boost::filesystem;
+void Renderer::InitializeWorker( int threadIndex )
+{
+	auto param = Create_Thread_InitParam(threadIndex);
+	param->id = threadIndex;
 
-			totalImageSaves++;
-			nextImageSaveTime += commonConfig->imageSaveIntervalTime;
+	auto shared = Create_Thread_SharedData();
+	shared->rng = std::make_shared<Random>((unsigned long)std::time(nullptr) + threadIndex);
+	// Replaced by the pass and its image for each task
+	shared->pass = 0;
+	shared->image = passImages[0].get();
 
-			fs::path outputDir(commonConfig->outputDir);
+	InitializeThread(param, shared);
 
-			if (!fs::exists(outputDir))
-			{
-				fs::create_directories(outputDir);
-			}
+	threadSharedData[threadIndex] = shared;
+}
 
-			auto prefix =
-				commonConfig->outputFilePrefix == ""
-				? commonConfig->appName + "-" + timeStamp
-				: commonConfig->outputFilePrefix;
+void Renderer::SubmitTask( int pass, int taskIndex )
+{
+	numInFlightTasks++;
+	scheduler->Submit([this, pass, taskIndex](int threadIndex){ ProcessTask(pass, taskIndex, threadIndex); });
+}
 
-			auto suffix =
-				commonConfig->disableOutputFileSuffix
-				? ""
-				: "-" + (boost::format("%d-%.2lf") % totalImageSaves % elapsed).str();
+void Renderer::ProcessTask( int pass, int taskIndex, int threadIndex )
+{
+	// The tasks of the passes after the last pass are only drained
+	if (pass <= lastPass)
+	{
+		if (!threadSharedData[threadIndex])
+		{
+			InitializeWorker(threadIndex);
+		}
 
-			auto fileName = prefix + suffix + ".ppm";
-			auto path = outputDir / fileName;
+		auto& shared = threadSharedData[threadIndex];
+		shared->pass = pass;
+		shared->image = passImages[pass % 2].get();
+		ProcessThread_Render(shared, taskIndex);
+	}
 
-			if (!commonConfig->quiet)
+	// Continue to the task of the next pass with the same index.
+	// It is pushed to the deque of this worker, so it usually runs next on the same worker.
+	// If the next pass is not startable yet, it is submitted when the current pass is finished.
+	{
+		std::unique_lock<std::mutex> lock(passMutex);
+		if (pass + 1 <= lastPass)
+		{
+			if (pass + 1 <= startablePass)
 			{
-				std::cerr << "  Saving image : " << path << std::endl;
+				SubmitTask(pass + 1, taskIndex);
+			}
+			else
+			{
+				pendingTasks.push_back(taskIndex);
 			}
-
-			image->Save(path.string(), ImageSaveWeight());
-			SaveImageFinished();
-		}	
-
-		if (!commonConfig->quiet)
-		{
-			std::cerr << std::endl;
 		}
 	}
 
-	// --------------------------------------------------------------------------------
-
-	queue.SetDone();
+	if (--remainingTasks[pass % 2] == 0)
+	{
+		FinishPass(pass);
+	}
 
-	for (auto& thread : threads)
+	// Decremented in the lock, so that the main thread does not return from Render()
+	// while the last task is still touching the renderer
 	{
-		thread.join();
+		std::unique_lock<std::mutex> lock(passFinishedMutex);
+		if (--numInFlightTasks == 0)
+		{
+			passFinished.notify_one();
+		}
 	}
 }
 
-void Renderer::ProcessThread( std::shared_ptr<Thread_InitParam> param )
+void Renderer::FinishPass( int pass )
 {
-	Task task;
+	// The tasks of the next pass can finish before the current pass is finished by another worker.
+	// Then the pass is only marked as completed and the worker finishing the current pass
+	// continues to it, so that no worker waits for the other passes.
+	{
+		std::unique_lock<std::mutex> lock(passMutex);
+		completedPasses[pass % 2] = true;
 
-	auto shared = Create_Thread_SharedData();
+		if (numFinalizedPasses != pass || pass > lastPass)
+		{
+			return;
+		}
+	}
 
-	shared->rng = std::make_shared<Random>((unsigned long)std::time(nullptr) + param->id);
-	shared->color.assign(commonConfig->width * commonConfig->height, Vec3d());
+	while (true)
+	{
+		// All tasks of the pass are finished.
+		// The other workers continue with the tasks of the next pass,
+		// which are accumulated to the other image.
+		this->pass = pass;
+		auto& passImage = *passImages[pass % 2];
+		image->Accumulate(passImage);
+		passImage.Clear();
 
-	threadSharedData.push_back(shared);
+		RenderPassFinished();
 
-	InitializeThread(param, shared);
+		PassResult result;
+		result.pass = pass;
+		result.elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::high_resolution_clock::now() - renderStart).count() / 1000.0;
 
-	while (!queue.Done())
-	{
-		queue.Dequeue(task);
+		// Converged renderers stop before the execution time and save the final image
+		bool converged = RenderConverged();
 
-		if (queue.Done())
+		// Save image
+		// Only the copy of the image is made here and the writer thread encodes and writes it.
+		// The workers are not waiting for the save since they process the next pass meanwhile.
+		if (result.elapsed > nextImageSaveTime - Eps || converged)
 		{
-			break;
+			nextImageSaveTime += commonConfig->imageSaveIntervalTime;
+			totalImageSaves++;
+			result.savedImagePath = ImagePath(result.elapsed);
+			imageSavePixelWeights.clear();
+			ImageSavePixelWeights(imageSavePixelWeights);
+			imageWriter->Save(*image, result.savedImagePath, ImageSaveWeight(), imageSavePixelWeights);
+			SaveImageFinished();
 		}
 
-		switch (task.command)
+		// Start the pass after the next, which uses the data of the current pass
+		bool finished = result.elapsed >= commonConfig->executionTime || converged;
+
 		{
-		case Command::Render:
+			std::unique_lock<std::mutex> lock(passMutex);
+
+			completedPasses[pass % 2] = false;
+			remainingTasks[pass % 2] = numRenderTasks;
+			numFinalizedPasses++;
+
+			if (finished)
 			{
-				ProcessThread_Render(shared);
-				break;
+				lastPass = pass;
 			}
-
-		case Command::UpdateImage:
+			else
 			{
-				image->Accumulate(Vec4i(0, 0, commonConfig->width, commonConfig->height), shared->color);
-				shared->color.assign(commonConfig->width * commonConfig->height, Vec3d());
-				break;
+				startablePass = pass + 2;
+				for (int taskIndex : pendingTasks)
+				{
+					SubmitTask(pass + 2, taskIndex);
+				}
 			}
-		}
 
-		// Barrier
-		if (task.needSync)
-		{
-			std::unique_lock<std::mutex> lock(taskSyncMutex);
+			pendingTasks.clear();
 
-			if (++waitingThreads == commonConfig->numThreads)
+			// Reported before the next pass is finished, so that the results are in order
 			{
-				waitingThreads = 0;
-				taskSync.notify_all();
+				std::unique_lock<std::mutex> lock(passFinishedMutex);
+				passResults.push(result);
+				renderFinished = finished;
+				passFinished.notify_one();
 			}
-			else
+
+			// Continue to the next pass if its tasks are already finished.
+			// Checked in the same lock as the increment, so either this worker
+			// or the worker finishing the tasks of the next pass finishes it.
+			pass++;
+			if (!completedPasses[pass % 2] || pass > lastPass)
 			{
-				taskSync.wait(lock);
+				return;
 			}
 		}
+	}
+}
 
-		{
-			std::unique_lock<std::mutex> lock(taskFinishedMutex);
-			finishedTasks++;
-			taskFinished.notify_one();
-		}
+std::string Renderer::ImagePath( double elapsed )
+{
+	namespace fs = boost::filesystem;
+
+	fs::path outputDir(commonConfig->outputDir);
+
+	if (!fs::exists(outputDir))
+	{
+		fs::create_directories(outputDir);
 	}
+
+	auto prefix =
+		commonConfig->outputFilePrefix == ""
+		? commonConfig->appName + "-" + timeStamp
+		: commonConfig->outputFilePrefix;
+
+	auto suffix =
+		commonConfig->disableOutputFileSuffix
+		? ""
+		: "-" + (boost::format("%d-%.2lf") % totalImageSaves % elapsed).str();
+
+	auto fileName = prefix + suffix + "." + commonConfig->imageFormat;
+	return (outputDir / fileName).string();
 }
 
 HINATA_NAMESPACE_END
\ No newline at end of file
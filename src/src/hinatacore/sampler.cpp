@@ -5,13 +5,28 @@
 HINATA_NAMESPACE_BEGIN
 
 RandomSampler::RandomSampler()
+	: rng(std::make_shared<Random>((unsigned long)std::time(nullptr)))
+	, batchIndex(BatchSize)
 {
-	rng = std::make_shared<Random>((unsigned long)std::time(nullptr));
+
+}
+
+RandomSampler::RandomSampler( const std::shared_ptr<Random>& rng )
+	: rng(rng)
+	, batchIndex(BatchSize)
+{
+
 }
 
 double RandomSampler::Next()
 {
-	return rng->Next();
+	if (batchIndex == BatchSize)
+	{
+		rng->NextN(batch, BatchSize);
+		batchIndex = 0;
+	}
+
+	return batch[batchIndex++];
 }
 
 HINATA_NAMESPACE_END
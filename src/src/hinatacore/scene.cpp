@@ -1,17 +1,51 @@
 #include "pch.h"
 #include <hinatacore/scene.h>
+#include <hinatacore/arealight.h>
+#include <hinatacore/renderutils.h>
 
 HINATA_NAMESPACE_BEGIN
 
-void Scene::SampleLight( double& u, std::shared_ptr<AreaLight>& light, double& pdf )
+void Scene::SampleLight( double& u, AreaLight*& light, double& pdf )
 {
-	int n = (int)lights.size();
-	int index = std::min((int)std::floor(u * n), n - 1);
+	int index = lightDistribution.Sample(u);
+	light = lights[index].get();
+	pdf = lightDistribution.Pdf(index);
+}
+
+double Scene::LightSelectionPdf( const AreaLight* light ) const
+{
+	return lightDistribution.Pdf(light->Index());
+}
+
+bool Scene::SampleLight( const Vec3d& p, const Vec3d& n, double& u, AreaLight*& light, int& triangle, double& pdf )
+{
+	int index;
+	if (!lightBVH.Sample(p, n, u, index, triangle, pdf))
+	{
+		return false;
+	}
+
+	light = lights[index].get();
+	return true;
+}
+
+double Scene::LightSelectionPdf( const Vec3d& p, const Vec3d& n, const AreaLight* light, int triangle ) const
+{
+	return lightBVH.Pdf(p, n, light->Index(), triangle);
+}
+
+void Scene::InitializeLightDistribution()
+{
+	std::vector<double> weights;
+
+	for (int i = 0; i < (int)lights.size(); i++)
+	{
+		lights[i]->SetIndex(i);
+		weights.push_back(RenderUtils::Luminance(lights[i]->Power()));
+	}
 
-	// u' = (u - delta * i) / delta
-	u = u * n - (double)index;
-	light = lights[index];
-	pdf = 1.0 / n;
+	lightDistribution.Build(weights);
+	lightBVH.Build(lights);
 }
 
 HINATA_NAMESPACE_END
\ No newline at end of file
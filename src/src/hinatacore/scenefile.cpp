@@ -0,0 +1,505 @@
+#include "pch.h"
+#include <hinatacore/scenefile.h>
+#include <hinatacore/scenedata.h>
+#include <hinatacore/bvhscene.h>
+#include <hinatacore/taskscheduler.h>
+#include <boost/archive/binary_oarchive.hpp>
+#include <boost/archive/binary_iarchive.hpp>
+#include <boost/interprocess/streams/bufferstream.hpp>
+#include <fstream>
+#include <cstring>
+
+HINATA_NAMESPACE_BEGIN
+
+/*!
+	Header of the scene file.
+	Placed at the beginning of the file.
+*/
+struct SceneFileHeader
+{
+
+	char magic[8];							// Magic number
+	unsigned int version;					// Version of the layout
+	unsigned int byteOrder;					// Byte order tag
+	unsigned int vec2dSize;					// Size of the elements
+	unsigned int vec3dSize;
+	unsigned int vec3iSize;
+	unsigned int qbvhNodeSize;
+	unsigned long long metadataOffset;		// Offset to the metadata
+	unsigned long long metadataSize;		// Size of the metadata
+	unsigned long long meshTableOffset;		// Offset to the mesh table
+	unsigned long long numMeshes;			// Number of entries in the mesh table
+	unsigned long long bvhTableOffset;		// Offset to the BVH table (numMeshes entries), or 0 if no BVH cache
+
+};
+
+/*!
+	Mesh table entry.
+	Offsets from the beginning of the file and number of elements of each mesh attribute.
+*/
+struct SceneFileMeshEntry
+{
+
+	unsigned long long positionsOffset;
+	unsigned long long numPositions;
+	unsigned long long normalsOffset;
+	unsigned long long numNormals;
+	unsigned long long texcoordsOffset;
+	unsigned long long numTexcoords;
+	unsigned long long facesOffset;
+	unsigned long long numFaces;
+	unsigned long long hash;				// Hash of the geometry computed on saving (BVHScene::MeshHash)
+
+};
+
+/*!
+	BVH table entry.
+	BVH cache of the mesh with the same index.
+	The arrays are the build product of BVH.
+*/
+struct SceneFileBVHEntry
+{
+
+	unsigned long long hash;				// Hash of the mesh when the BVH is built, or 0 if no cache
+	unsigned long long version;				// BVHScene::BVHCacheVersion of the builder
+	unsigned long long nodesOffset;
+	unsigned long long numNodes;
+	unsigned long long primitiveIndicesOffset;
+	unsigned long long numPrimitiveIndices;
+	double boundMin[3];
+	double boundMax[3];
+	long long numBuildNodes;
+	double sahCost;
+
+};
+
+namespace
+{
+
+	const char SceneFileMagic[8] = { 'H', 'I', 'N', 'A', 'T', 'A', 'S', 'C' };
+	const unsigned int SceneFileVersion = 3;
+	const unsigned int SceneFileByteOrder = 0x01020304;
+	const unsigned long long SceneFileAlignment = 64;
+
+	unsigned long long Align(unsigned long long offset)
+	{
+		return (offset + SceneFileAlignment - 1) / SceneFileAlignment * SceneFileAlignment;
+	}
+
+	/*!
+		Write the array at the next aligned position.
+		\return Offset to the array.
+	*/
+	template <typename T>
+	unsigned long long WriteArray(std::ofstream& ofs, const T* data, size_t count)
+	{
+		unsigned long long offset = Align((unsigned long long)ofs.tellp());
+		while ((unsigned long long)ofs.tellp() < offset)
+		{
+			ofs.put(0);
+		}
+
+		if (count > 0)
+		{
+			ofs.write(reinterpret_cast<const char*>(data), sizeof(T) * count);
+		}
+
+		return offset;
+	}
+
+	template <typename T>
+	unsigned long long WriteArray(std::ofstream& ofs, const std::vector<T>& v)
+	{
+		return WriteArray(ofs, v.empty() ? nullptr : &v[0], v.size());
+	}
+
+}
+
+SceneFile::SceneFile( const std::string& path )
+	: path(path)
+{
+	try
+	{
+		mapping = boost::interprocess::file_mapping(path.c_str(), boost::interprocess::read_only);
+		region = boost::interprocess::mapped_region(mapping, boost::interprocess::read_only);
+	}
+	catch (boost::interprocess::interprocess_exception& e)
+	{
+#ifdef HINATA_ARCH_X86
+		// The file is mapped at once, which fails for large files in 32-bit processes
+		throw std::exception(boost::str(
+			boost::format("boost::interprocess::interprocess_exception : %s (%s, large scene files require the x64 build)") % e.what() % path).c_str());
+#else
+		throw std::exception(boost::str(
+			boost::format("boost::interprocess::interprocess_exception : %s (%s)") % e.what() % path).c_str());
+#endif
+	}
+
+	// Check header
+	unsigned long long fileSize = region.get_size();
+	if (fileSize < sizeof(SceneFileHeader))
+	{
+		throw std::exception(boost::str(boost::format("Invalid scene file : %s") % path).c_str());
+	}
+
+	const auto& header = *static_cast<const SceneFileHeader*>(region.get_address());
+
+	if (std::memcmp(header.magic, SceneFileMagic, sizeof(SceneFileMagic)) != 0)
+	{
+		throw std::exception(boost::str(boost::format("Invalid scene file : %s") % path).c_str());
+	}
+
+	if (header.version != SceneFileVersion)
+	{
+		throw std::exception(boost::str(
+			boost::format("Unsupported scene file version : %d (expected %d)") % header.version % SceneFileVersion).c_str());
+	}
+
+	if (header.byteOrder != SceneFileByteOrder)
+	{
+		throw std::exception("Unsupported byte order of the scene file");
+	}
+
+	if (header.vec2dSize != sizeof(Vec2d) || header.vec3dSize != sizeof(Vec3d) || header.vec3iSize != sizeof(Vec3i) || header.qbvhNodeSize != sizeof(QBVHNode))
+	{
+		throw std::exception("Incompatible element layout of the scene file");
+	}
+
+	if (header.meshTableOffset % sizeof(unsigned long long) != 0 ||
+		header.meshTableOffset > fileSize ||
+		header.numMeshes > (fileSize - header.meshTableOffset) / sizeof(SceneFileMeshEntry) ||
+		header.metadataOffset > fileSize ||
+		header.metadataSize > fileSize - header.metadataOffset ||
+		header.bvhTableOffset % sizeof(unsigned long long) != 0 ||
+		header.bvhTableOffset > fileSize ||
+		(header.bvhTableOffset > 0 && header.numMeshes > (fileSize - header.bvhTableOffset) / sizeof(SceneFileBVHEntry)))
+	{
+		throw std::exception(boost::str(boost::format("Corrupted scene file : %s") % path).c_str());
+	}
+
+	// Check mesh table and BVH table
+	// The elements are indexed with int.
+	auto check = [&](unsigned long long offset, unsigned long long count, size_t size)
+	{
+		if (offset % SceneFileAlignment != 0 || offset > fileSize || count > (fileSize - offset) / size ||
+			count > (unsigned long long)std::numeric_limits<int>::max())
+		{
+			throw std::exception(boost::str(boost::format("Corrupted scene file : %s") % path).c_str());
+		}
+	};
+
+	for (int i = 0; i < (int)header.numMeshes; i++)
+	{
+		const auto& entry = MeshEntry(i);
+		check(entry.positionsOffset, entry.numPositions, sizeof(Vec3d));
+		check(entry.normalsOffset, entry.numNormals, sizeof(Vec3d));
+		check(entry.texcoordsOffset, entry.numTexcoords, sizeof(Vec2d));
+		check(entry.facesOffset, entry.numFaces, sizeof(Vec3i));
+
+		const auto* bvhEntry = BVHEntry(i);
+		if (bvhEntry != nullptr && bvhEntry->numNodes > 0)
+		{
+			check(bvhEntry->nodesOffset, bvhEntry->numNodes, sizeof(QBVHNode));
+			check(bvhEntry->primitiveIndicesOffset, bvhEntry->numPrimitiveIndices, sizeof(int));
+		}
+	}
+
+	// Load metadata
+	try
+	{
+		boost::interprocess::ibufferstream stream(
+			static_cast<const char*>(region.get_address()) + header.metadataOffset,
+			(size_t)header.metadataSize);
+		boost::archive::binary_iarchive ia(static_cast<std::istream&>(stream));
+		ia & boost::serialization::make_nvp("HinataScene", sceneData);
+	}
+	catch (boost::archive::archive_exception& e)
+	{
+		throw std::exception(boost::str(
+			boost::format("boost::archive::archive_exception : %s") % e.what()).c_str());
+	}
+
+	if (sceneData->meshes.size() != header.numMeshes)
+	{
+		throw std::exception(boost::str(boost::format("Corrupted scene file : %s") % path).c_str());
+	}
+}
+
+ConstArray<Vec3d> SceneFile::Positions( int meshIndex ) const
+{
+	const auto& entry = MeshEntry(meshIndex);
+	return MappedArray<Vec3d>(entry.positionsOffset, entry.numPositions);
+}
+
+ConstArray<Vec3d> SceneFile::Normals( int meshIndex ) const
+{
+	const auto& entry = MeshEntry(meshIndex);
+	return MappedArray<Vec3d>(entry.normalsOffset, entry.numNormals);
+}
+
+ConstArray<Vec2d> SceneFile::Texcoords( int meshIndex ) const
+{
+	const auto& entry = MeshEntry(meshIndex);
+	return MappedArray<Vec2d>(entry.texcoordsOffset, entry.numTexcoords);
+}
+
+ConstArray<Vec3i> SceneFile::Faces( int meshIndex ) const
+{
+	const auto& entry = MeshEntry(meshIndex);
+	return MappedArray<Vec3i>(entry.facesOffset, entry.numFaces);
+}
+
+template <typename T>
+ConstArray<T> SceneFile::MappedArray( unsigned long long offset, unsigned long long count ) const
+{
+	if (count == 0)
+	{
+		return ConstArray<T>();
+	}
+
+	return ConstArray<T>(reinterpret_cast<const T*>(static_cast<const char*>(region.get_address()) + offset), (size_t)count);
+}
+
+bool SceneFile::MeshBVH( int meshIndex, BVH& bvh ) const
+{
+	const auto* bvhEntry = BVHEntry(meshIndex);
+
+	// Stored hashes are compared, so the mesh is not read for the check.
+	// Both hashes are computed by the converter, so the caches built
+	// by an older builder are rejected by the version.
+	const auto& entry = MeshEntry(meshIndex);
+	if (bvhEntry == nullptr || bvhEntry->numNodes == 0 || bvhEntry->hash != entry.hash || bvhEntry->version != BVHScene::BVHCacheVersion)
+	{
+		return false;
+	}
+
+	const char* base = static_cast<const char*>(region.get_address());
+
+	AABB bound;
+	bound.min = Vec3d(bvhEntry->boundMin[0], bvhEntry->boundMin[1], bvhEntry->boundMin[2]);
+	bound.max = Vec3d(bvhEntry->boundMax[0], bvhEntry->boundMax[1], bvhEntry->boundMax[2]);
+
+	bvh.Set(
+		ConstArray<QBVHNode, QBVHNodeAllocator>(reinterpret_cast<const QBVHNode*>(base + bvhEntry->nodesOffset), (size_t)bvhEntry->numNodes),
+		MappedArray<int>(bvhEntry->primitiveIndicesOffset, bvhEntry->numPrimitiveIndices),
+		bound, (int)bvhEntry->numBuildNodes, bvhEntry->sahCost);
+
+	// The traversal does not check the indices in the nodes
+	if (!bvh.Valid((int)entry.numFaces))
+	{
+		throw std::exception(boost::str(boost::format("Corrupted BVH cache in the scene file : %s") % path).c_str());
+	}
+
+	return true;
+}
+
+const SceneFileMeshEntry& SceneFile::MeshEntry( int meshIndex ) const
+{
+	const auto& header = *static_cast<const SceneFileHeader*>(region.get_address());
+	const auto* table = reinterpret_cast<const SceneFileMeshEntry*>(static_cast<const char*>(region.get_address()) + header.meshTableOffset);
+	return table[meshIndex];
+}
+
+const SceneFileBVHEntry* SceneFile::BVHEntry( int meshIndex ) const
+{
+	const auto& header = *static_cast<const SceneFileHeader*>(region.get_address());
+	if (header.bvhTableOffset == 0)
+	{
+		return nullptr;
+	}
+
+	const auto* table = reinterpret_cast<const SceneFileBVHEntry*>(static_cast<const char*>(region.get_address()) + header.bvhTableOffset);
+	return &table[meshIndex];
+}
+
+void SceneFile::CheckFaces( int meshIndex, TaskScheduler& scheduler ) const
+{
+	// Faces index the positions, normals and texture coordinates (if any),
+	// so a corrupted index would cause out-of-bounds reads in the intersection.
+	const auto& entry = MeshEntry(meshIndex);
+	unsigned long long numVertices = Math::Min(entry.numPositions, entry.numNormals);
+	if (entry.numTexcoords > 0)
+	{
+		numVertices = Math::Min(numVertices, entry.numTexcoords);
+	}
+
+	// The chunks only record the failure, since the exceptions must not escape the tasks
+	auto faces = Faces(meshIndex);
+	std::atomic<bool> valid;
+	valid = true;
+
+	scheduler.ParallelFor(scheduler.NumThreads(), 0, (int)faces.size(), [&](int, int begin, int end)
+	{
+		for (int i = begin; i < end && valid; i++)
+		{
+			const auto& face = faces[i];
+			for (int j = 0; j < 3; j++)
+			{
+				if (face[j] < 0 || (unsigned long long)face[j] >= numVertices)
+				{
+					valid = false;
+				}
+			}
+		}
+	});
+
+	if (!valid)
+	{
+		throw std::exception(boost::str(boost::format("Invalid face index in the scene file : %s") % path).c_str());
+	}
+}
+
+void SceneFile::Save( const std::string& path, const boost::shared_ptr<SceneData>& sceneData )
+{
+	std::ofstream ofs(path, std::ofstream::out | std::ofstream::binary | std::ofstream::trunc);
+
+	if (!ofs)
+	{
+		throw std::exception(boost::str(
+			boost::format("std::ofstream : %s") % boost::filesystem::path(path).string()).c_str());
+	}
+
+	// Header and mesh table are written after the contents are placed
+	SceneFileHeader header;
+	std::memset(&header, 0, sizeof(SceneFileHeader));
+	std::memcpy(header.magic, SceneFileMagic, sizeof(SceneFileMagic));
+	header.version = SceneFileVersion;
+	header.byteOrder = SceneFileByteOrder;
+	header.vec2dSize = sizeof(Vec2d);
+	header.vec3dSize = sizeof(Vec3d);
+	header.vec3iSize = sizeof(Vec3i);
+	header.qbvhNodeSize = sizeof(QBVHNode);
+	header.meshTableOffset = sizeof(SceneFileHeader);
+	header.numMeshes = sceneData->meshes.size();
+
+	// BVH table is written only if the BVH cache is built for all meshes
+	bool hasBVHCache = !sceneData->meshes.empty() && sceneData->meshBVHs.size() == sceneData->meshes.size();
+	header.bvhTableOffset = hasBVHCache ? header.meshTableOffset + sizeof(SceneFileMeshEntry) * header.numMeshes : 0;
+
+	std::vector<SceneFileMeshEntry> meshTable(sceneData->meshes.size());
+	std::vector<SceneFileBVHEntry> bvhTable(hasBVHCache ? sceneData->meshes.size() : 0);
+	std::memset(meshTable.data(), 0, sizeof(SceneFileMeshEntry) * meshTable.size());
+	std::memset(bvhTable.data(), 0, sizeof(SceneFileBVHEntry) * bvhTable.size());
+	ofs.write(reinterpret_cast<const char*>(&header), sizeof(SceneFileHeader));
+	ofs.write(reinterpret_cast<const char*>(meshTable.data()), sizeof(SceneFileMeshEntry) * meshTable.size());
+	ofs.write(reinterpret_cast<const char*>(bvhTable.data()), sizeof(SceneFileBVHEntry) * bvhTable.size());
+
+	// Mesh attributes
+	for (size_t i = 0; i < sceneData->meshes.size(); i++)
+	{
+		auto& meshData = sceneData->meshes[i];
+		auto& entry = meshTable[i];
+
+		entry.positionsOffset = WriteArray(ofs, meshData->positions);
+		entry.numPositions = meshData->positions.size();
+		entry.normalsOffset = WriteArray(ofs, meshData->normals);
+		entry.numNormals = meshData->normals.size();
+		entry.texcoordsOffset = WriteArray(ofs, meshData->texcoords);
+		entry.numTexcoords = meshData->texcoords.size();
+		entry.facesOffset = WriteArray(ofs, meshData->faces);
+		entry.numFaces = meshData->faces.size();
+
+		// The hash is computed here, so that the BVH cache is checked
+		// without reading the mesh on loading
+		entry.hash = BVHScene::MeshHash(MakeConstArrayView(meshData->positions), MakeConstArrayView(meshData->faces));
+
+		if (hasBVHCache)
+		{
+			auto& meshBVH = *sceneData->meshBVHs[i];
+			auto& bvhEntry = bvhTable[i];
+			auto& nodes = meshBVH.bvh.Nodes();
+			auto& primitiveIndices = meshBVH.bvh.PrimitiveIndices();
+			auto bound = meshBVH.bvh.Bound();
+
+			bvhEntry.hash = meshBVH.hash;
+			bvhEntry.version = BVHScene::BVHCacheVersion;
+			bvhEntry.nodesOffset = WriteArray(ofs, nodes.data(), nodes.size());
+			bvhEntry.numNodes = nodes.size();
+			bvhEntry.primitiveIndicesOffset = WriteArray(ofs, primitiveIndices.data(), primitiveIndices.size());
+			bvhEntry.numPrimitiveIndices = primitiveIndices.size();
+
+			for (int axis = 0; axis < 3; axis++)
+			{
+				bvhEntry.boundMin[axis] = bound.min[axis];
+				bvhEntry.boundMax[axis] = bound.max[axis];
+			}
+
+			bvhEntry.numBuildNodes = meshBVH.bvh.NumBuildNodes();
+			bvhEntry.sahCost = meshBVH.bvh.SAHCost();
+		}
+	}
+
+	// Metadata
+	// Mesh attributes and BVH caches are temporarily moved out so that they are not serialized twice.
+	std::ostringstream metadata;
+	std::vector<SceneDataElement_TriangleMesh> attributes(sceneData->meshes.size());
+	std::vector<boost::shared_ptr<SceneDataElement_MeshBVH>> meshBVHs;
+	meshBVHs.swap(sceneData->meshBVHs);
+
+	for (size_t i = 0; i < sceneData->meshes.size(); i++)
+	{
+		attributes[i].positions.swap(sceneData->meshes[i]->positions);
+		attributes[i].normals.swap(sceneData->meshes[i]->normals);
+		attributes[i].texcoords.swap(sceneData->meshes[i]->texcoords);
+		attributes[i].faces.swap(sceneData->meshes[i]->faces);
+	}
+
+	try
+	{
+		boost::archive::binary_oarchive oa(metadata);
+		oa & boost::serialization::make_nvp("HinataScene", sceneData);
+	}
+	catch (boost::archive::archive_exception& e)
+	{
+		throw std::exception(boost::str(
+			boost::format("boost::archive::archive_exception : %s") % e.what()).c_str());
+	}
+
+	for (size_t i = 0; i < sceneData->meshes.size(); i++)
+	{
+		attributes[i].positions.swap(sceneData->meshes[i]->positions);
+		attributes[i].normals.swap(sceneData->meshes[i]->normals);
+		attributes[i].texcoords.swap(sceneData->meshes[i]->texcoords);
+		attributes[i].faces.swap(sceneData->meshes[i]->faces);
+	}
+
+	meshBVHs.swap(sceneData->meshBVHs);
+
+	auto metadataString = metadata.str();
+	header.metadataOffset = Align((unsigned long long)ofs.tellp());
+	header.metadataSize = metadataString.size();
+
+	while ((unsigned long long)ofs.tellp() < header.metadataOffset)
+	{
+		ofs.put(0);
+	}
+
+	ofs.write(metadataString.data(), metadataString.size());
+
+	// Header, mesh table and BVH table
+	ofs.seekp(0);
+	ofs.write(reinterpret_cast<const char*>(&header), sizeof(SceneFileHeader));
+	ofs.write(reinterpret_cast<const char*>(meshTable.data()), sizeof(SceneFileMeshEntry) * meshTable.size());
+	ofs.write(reinterpret_cast<const char*>(bvhTable.data()), sizeof(SceneFileBVHEntry) * bvhTable.size());
+
+	if (!ofs)
+	{
+		throw std::exception(boost::str(
+			boost::format("Failed to write scene file : %s") % boost::filesystem::path(path).string()).c_str());
+	}
+}
+
+bool SceneFile::IsSceneFile( const std::string& path )
+{
+	std::ifstream ifs(path, std::ifstream::in | std::ifstream::binary);
+	char magic[sizeof(SceneFileMagic)];
+
+	if (!ifs.read(magic, sizeof(magic)))
+	{
+		return false;
+	}
+
+	return std::memcmp(magic, SceneFileMagic, sizeof(SceneFileMagic)) == 0;
+}
+
+HINATA_NAMESPACE_END
\ No newline at end of file
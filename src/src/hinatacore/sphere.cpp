@@ -47,6 +47,40 @@ bool Sphere::Intersect( Ray& ray, Intersection& isect )
 		}
 	}
 
+	FillIntersection(ray, t, Vec2d(), isect);
+	ray.maxT = t;
+
+	return true;
+}
+
+bool Sphere::Intersect( const Ray& ray )
+{
+	auto po = ray.o - position;
+	double a = Math::Dot(ray.d, ray.d);
+	double b = 2.0 * Math::Dot(po, ray.d);
+	double c = Math::Dot(po, po) - radius * radius;
+	double det = b * b - 4.0 * a * c;
+
+	if (det < 0.0)
+	{
+		return false;
+	}
+
+	double e = std::sqrt(det);
+	double denom = 2.0 * a;
+	double t0 = (-b - e) / denom;
+	double t1 = (-b + e) / denom;
+
+	if (t0 > ray.maxT || t1 < ray.minT)
+	{
+		return false;
+	}
+
+	return t0 >= ray.minT || t1 <= ray.maxT;
+}
+
+void Sphere::FillIntersection( const Ray& ray, double t, const Vec2d& b, Intersection& isect )
+{
 	isect.p = ray.o + t * ray.d;
 	isect.gn = isect.sn = Math::Normalize(isect.p - position);
 
@@ -54,9 +88,6 @@ bool Sphere::Intersect( Ray& ray, Intersection& isect )
 
 	isect.uv = Vec2d();
 	isect.rayEpsilon = 1e-5 * t;
-	ray.maxT = t;
-
-	return true;
 }
 
 void Sphere::SamplePosition( ShapePositionSampleRecord& record, const Mat4d& transform )
@@ -0,0 +1,199 @@
+#include "pch.h"
+#include <hinatacore/taskscheduler.h>
+
+HINATA_NAMESPACE_BEGIN
+
+TaskScheduler::TaskScheduler( int numThreads )
+	: done(false)
+{
+	numQueuedTasks = 0;
+	nextWorker = 0;
+
+	numThreads = std::max(1, numThreads);
+
+	for (int i = 0; i < numThreads; i++)
+	{
+		workers.push_back(std::unique_ptr<Worker>(new Worker));
+	}
+
+	for (int i = 0; i < numThreads; i++)
+	{
+		threads.push_back(std::thread(&TaskScheduler::Process, this, i));
+	}
+}
+
+TaskScheduler::~TaskScheduler()
+{
+	{
+		std::unique_lock<std::mutex> lock(sleepMutex);
+		done = true;
+		wakeUp.notify_all();
+	}
+
+	for (auto& thread : threads)
+	{
+		thread.join();
+	}
+}
+
+void TaskScheduler::Submit( const Task& task )
+{
+	// Count the task before pushing it, so that the sleeping workers never miss it
+	numQueuedTasks++;
+
+	int threadIndex = CurrentThreadIndex();
+	auto& worker = *workers[threadIndex >= 0 ? threadIndex : nextWorker++ % workers.size()];
+
+	{
+		std::unique_lock<std::mutex> lock(worker.mutex);
+		worker.tasks.push_back(task);
+	}
+
+	{
+		std::unique_lock<std::mutex> lock(sleepMutex);
+		wakeUp.notify_one();
+	}
+}
+
+void TaskScheduler::ParallelFor( int numChunks, int begin, int end, const std::function<void (int, int, int)>& func )
+{
+	numChunks = std::min(numChunks, end - begin);
+	if (numChunks <= 1)
+	{
+		if (begin < end)
+		{
+			func(0, begin, end);
+		}
+		return;
+	}
+
+	// State shared with the submitted tasks.
+	// The tasks can start after the function returns, so the state is reference counted.
+	struct State
+	{
+		std::function<void (int, int, int)> func;
+		int numChunks;
+		int begin;
+		long long n;
+		std::atomic<int> nextChunk;
+		std::atomic<int> remainingChunks;
+		std::mutex mutex;
+		std::condition_variable finished;
+	};
+
+	auto state = std::make_shared<State>();
+	state->func = func;
+	state->numChunks = numChunks;
+	state->begin = begin;
+	state->n = end - begin;
+	state->nextChunk = 0;
+	state->remainingChunks = numChunks;
+
+	// Claim and process the chunks until no chunk is left
+	auto processChunks = [](State& state)
+	{
+		int i;
+		while ((i = state.nextChunk++) < state.numChunks)
+		{
+			int chunkBegin = state.begin + (int)(state.n * i / state.numChunks);
+			int chunkEnd = state.begin + (int)(state.n * (i + 1) / state.numChunks);
+			state.func(i, chunkBegin, chunkEnd);
+
+			if (--state.remainingChunks == 0)
+			{
+				std::unique_lock<std::mutex> lock(state.mutex);
+				state.finished.notify_all();
+			}
+		}
+	};
+
+	int numTasks = std::min(numChunks - 1, NumThreads());
+	for (int i = 0; i < numTasks; i++)
+	{
+		Submit([state, processChunks](int){ processChunks(*state); });
+	}
+
+	processChunks(*state);
+
+	// Remaining chunks are being processed by the other threads
+	std::unique_lock<std::mutex> lock(state->mutex);
+	state->finished.wait(lock, [&state]{ return state->remainingChunks == 0; });
+}
+
+void TaskScheduler::Process( int threadIndex )
+{
+	Task task;
+
+	while (true)
+	{
+		if (Pop(threadIndex, task) || Steal(threadIndex, task))
+		{
+			numQueuedTasks--;
+			task(threadIndex);
+			continue;
+		}
+
+		// Sleep until a task is submitted
+		std::unique_lock<std::mutex> lock(sleepMutex);
+		wakeUp.wait(lock, [this]{ return done || numQueuedTasks > 0; });
+
+		if (done)
+		{
+			break;
+		}
+	}
+}
+
+bool TaskScheduler::Pop( int threadIndex, Task& task )
+{
+	auto& worker = *workers[threadIndex];
+	std::unique_lock<std::mutex> lock(worker.mutex);
+
+	if (worker.tasks.empty())
+	{
+		return false;
+	}
+
+	task = std::move(worker.tasks.back());
+	worker.tasks.pop_back();
+
+	return true;
+}
+
+bool TaskScheduler::Steal( int threadIndex, Task& task )
+{
+	int numWorkers = (int)workers.size();
+
+	for (int i = 1; i < numWorkers; i++)
+	{
+		auto& victim = *workers[(threadIndex + i) % numWorkers];
+		std::unique_lock<std::mutex> lock(victim.mutex);
+
+		if (!victim.tasks.empty())
+		{
+			task = std::move(victim.tasks.front());
+			victim.tasks.pop_front();
+			return true;
+		}
+	}
+
+	return false;
+}
+
+int TaskScheduler::CurrentThreadIndex() const
+{
+	// The threads are not modified after the construction.
+	// Looked up by the id since thread-local variables are not available in VS2012.
+	auto id = std::this_thread::get_id();
+	for (int i = 0; i < (int)threads.size(); i++)
+	{
+		if (threads[i].get_id() == id)
+		{
+			return i;
+		}
+	}
+
+	return -1;
+}
+
+HINATA_NAMESPACE_END
\ No newline at end of file
@@ -23,10 +23,10 @@ bool Triangle::Intersect( Ray& ray, Intersection& isect )
 
 	auto e1 = p2 - p1;
 	auto e2 = p3 - p1;
-	auto gn = Math::Normalize(Math::Cross(e1, e2));
 
 	// If the intersected mesh is one sided, ignore the ray from the back side.
-	if (mesh->oneSided && Math::Dot(gn, -ray.d) < 0)
+	// Normalization of the geometry normal is not necessary only to check the side.
+	if (mesh->oneSided && Math::Dot(Math::Cross(e1, e2), -ray.d) < 0)
 	{
 		return false;
 	}
@@ -67,37 +67,65 @@ bool Triangle::Intersect( Ray& ray, Intersection& isect )
 		return false;
 	}
 
-	// ------------------------------------------------------------
+	FillIntersection(ray, t, Vec2d(b1, b2), isect);
+	ray.maxT = t;
 
-	// Use shading normal
-	auto& n1 = mesh->normals[v1];
-	auto& n2 = mesh->normals[v2];
-	auto& n3 = mesh->normals[v3];
+	return true;
+}
 
-	isect.p = ray.o + t * ray.d;
-	isect.gn = gn;
-	isect.sn = Math::Normalize(n1 * (1.0 - b1 - b2) + n2 * b1 + n3 * b2);
+void Triangle::FillIntersection( const Ray& ray, double t, const Vec2d& b, Intersection& isect )
+{
+	FillIntersection(*mesh, Vec3i(v1, v2, v3), ray, t, b, isect);
+}
 
-	RenderUtils::CreateCoordinateSystem(isect.sn, isect.ss, isect.st);
+bool Triangle::Intersect( const Ray& ray )
+{
+	auto& p1 = mesh->positions[v1];
+	auto& p2 = mesh->positions[v2];
+	auto& p3 = mesh->positions[v3];
 
-	// Texture coordinates
-	if (!mesh->texcoords.empty())
+	auto e1 = p2 - p1;
+	auto e2 = p3 - p1;
+
+	// If the intersected mesh is one sided, ignore the ray from the back side.
+	// Normalization of the geometry normal is not necessary only to check the side.
+	if (mesh->oneSided && Math::Dot(Math::Cross(e1, e2), -ray.d) < 0)
 	{
-		auto& uv1 = mesh->texcoords[v1];
-		auto& uv2 = mesh->texcoords[v2];
-		auto& uv3 = mesh->texcoords[v3];
+		return false;
+	}
 
-		isect.uv = uv1 * (1.0 - b1 - b2) + uv2 * b1 + uv3 * b2;
+	auto s1 = Math::Cross(ray.d, e2);
+	double divisor = Math::Dot(s1, e1);
+
+	if (divisor == 0.0)
+	{
+		return false;
 	}
-	else
+
+	double invDivisor = 1.0 / divisor;
+
+	// First barycentric coordinate
+	auto d = ray.o - p1;
+	double b1 = Math::Dot(d, s1) * invDivisor;
+
+	if (b1 < 0.0 || b1 > 1.0)
 	{
-		isect.uv = Vec2d();
+		return false;
 	}
 
-	isect.rayEpsilon = 1e-5 * t;
-	ray.maxT = t;
+	// Second barycentric coordinate
+	auto s2 = Math::Cross(d, e1);
+	double b2 = Math::Dot(ray.d, s2) * invDivisor;
 
-	return true;
+	if (b2 < 0.0 || b1 + b2 > 1.0)
+	{
+		return false;
+	}
+
+	// Intersection point
+	double t = Math::Dot(e2, s2) * invDivisor;
+
+	return t >= ray.minT && t <= ray.maxT;
 }
 
 void Triangle::SamplePosition( ShapePositionSampleRecord& record, const Mat4d& transform )
@@ -154,4 +182,41 @@ Vec3d Triangle::Position( int i, const Mat4d& transform )
 		i == 2 ? Vec3d(transform * Vec4d(mesh->positions[v3], 1.0)) : Vec3d();
 }
 
+void Triangle::FillIntersection( const TriangleMesh& mesh, const Vec3i& face, const Ray& ray, double t, const Vec2d& b, Intersection& isect )
+{
+	auto& p1 = mesh.positions[face[0]];
+	auto& p2 = mesh.positions[face[1]];
+	auto& p3 = mesh.positions[face[2]];
+
+	// Use shading normal
+	auto& n1 = mesh.normals[face[0]];
+	auto& n2 = mesh.normals[face[1]];
+	auto& n3 = mesh.normals[face[2]];
+
+	double b1 = b.x;
+	double b2 = b.y;
+
+	isect.p = ray.o + t * ray.d;
+	isect.gn = Math::Normalize(Math::Cross(p2 - p1, p3 - p1));
+	isect.sn = Math::Normalize(n1 * (1.0 - b1 - b2) + n2 * b1 + n3 * b2);
+
+	RenderUtils::CreateCoordinateSystem(isect.sn, isect.ss, isect.st);
+
+	// Texture coordinates
+	if (!mesh.texcoords.empty())
+	{
+		auto& uv1 = mesh.texcoords[face[0]];
+		auto& uv2 = mesh.texcoords[face[1]];
+		auto& uv3 = mesh.texcoords[face[2]];
+
+		isect.uv = uv1 * (1.0 - b1 - b2) + uv2 * b1 + uv3 * b2;
+	}
+	else
+	{
+		isect.uv = Vec2d();
+	}
+
+	isect.rayEpsilon = 1e-5 * t;
+}
+
 HINATA_NAMESPACE_END
\ No newline at end of file
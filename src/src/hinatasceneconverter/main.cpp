@@ -1,10 +1,12 @@
 #include "colladaloader.h"
 #include <hinatacore/scenedata.h>
+#include <hinatacore/bvhscene.h>
+#include <hinatacore/scenefile.h>
+#include <hinatacore/taskscheduler.h>
 #include <iostream>
 #include <fstream>
+#include <thread>
 #include <boost/format.hpp>
-#include <boost/archive/binary_oarchive.hpp>
-#include <boost/archive/binary_iarchive.hpp>
 
 using namespace hinata;
 
@@ -23,25 +25,25 @@ int main()
 	loader.Load(param);
 	std::cout << "Load completed" << std::endl;
 
-	// --------------------------------------------------------------------------------
-
-	// Serialize scene
-	std::ofstream ofs("scene.hinata", std::ofstream::out | std::ofstream::binary | std::ofstream::trunc);
-
-	if (!ofs)
+	// Build BVH cache
+	// The renderer loads the cached BVHs instead of building them.
 	{
-		std::cerr << "std::ofstream" << std::endl;
-		return 1;
+		TaskScheduler scheduler((int)std::thread::hardware_concurrency());
+		BVHScene::BuildBVHCache(*loader.GetSceneData(), scheduler);
 	}
+	std::cout << "BVH cache build completed" << std::endl;
+
+	// --------------------------------------------------------------------------------
 
+	// Save scene
+	// Mesh attributes are stored as raw arrays which are memory-mapped by the renderer.
 	try
 	{
-		boost::archive::binary_oarchive oa(ofs);
-		oa & boost::serialization::make_nvp("HinataScene", loader.GetSceneData());
+		SceneFile::Save("scene.hinata", loader.GetSceneData());
 	}
-	catch (boost::archive::archive_exception& e)
+	catch (std::exception& e)
 	{
-		std::cerr << boost::str(boost::format("boost::archive::xml_oarchive : %s") % e.what()) << std::endl;;
+		std::cerr << e.what() << std::endl;
 		return 1;
 	}
 